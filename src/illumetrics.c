@@ -19,7 +19,9 @@
 #include <dirent.h>
 #include <pwd.h>
 #include <strings.h>
+#include <string.h>
 #include <limits.h>
+#include <getopt.h>
 
 /*
  * Global Variables
@@ -33,11 +35,13 @@ struct passwd *pwd;
 char *home;
 char init_cwd[PATH_MAX];
 char *illumetrics_stor;
+char stor_path[PATH_MAX]; /* absolute path of the stor/ directory */
 int home_fd;
 int illumetrics_fd;
 int stor_fd;
 int lists_fd;
 #define REPO_LS_PATHS 8
+#define	SECS_PER_DAY	86400
 char *repo_list_paths[REPO_LS_PATHS] = {"lists/build_system",
 	"lists/distributed_storage", "lists/documentation", "lists/compiler",
 	"lists/kernel", "lists/userland", "lists/orchestration",
@@ -49,19 +53,22 @@ rep_type_t repo_types[REPO_LS_PATHS] = {BUILD_SYSTEM, DISTRIBUTED_STORAGE,
 	DOCUMENTATION, COMPILER, KERNEL, USERLAND, ORCHESTRATION,
 	VIRTUALIZATION};
 slablist_t *repos;
+/* the repos slablist, flattened, and indexed by rp_id */
+repo_t **repo_table;
+uint32_t nrepos;
 /* See constraints_t struct in illumetrics_impl.h */
 constraints_t constraints;
 
-/* the global graphs */
-lg_graph_t *email2author;
-lg_graph_t *author2commit;
-lg_graph_t *file2author;
-lg_graph_t *file2commit;
-lg_graph_t *dir2author;
-lg_graph_t *dir2commit;
 
 /* forward declarations */
 void construct_graphs();
+void print_dir_histogram();
+void centrality();
+void author_work();
+void repository_work();
+void repository_list();
+void cross_polination();
+void repo_walk_end(repo_t *, int);
 
 qwork_t
 str2qwork(char *s)
@@ -97,10 +104,18 @@ str2int64(char *s)
 cent_t
 str2cent(char *s)
 {
-	int cmp = strcmp("degree", s);
+	int cmp = strcmp("activity", s);
+	if (!cmp) {
+		return (CENT_ACTIVITY);
+	}
+	cmp = strcmp("degree", s);
 	if (!cmp) {
 		return (CENT_DEGREE);
 	}
+	cmp = strcmp("strength", s);
+	if (!cmp) {
+		return (CENT_STRENGTH);
+	}
 	cmp = strcmp("closeness", s);
 	if (!cmp) {
 		return (CENT_CLOSENESS);
@@ -118,9 +133,15 @@ str2cent(char *s)
  * The arguments to the command are pretty simple.
  *
  * 	pull - pulls all repos in the lists
+ *		-j <jobs>
+ *			//number of repos to clone or fetch at the same time.
+ *			Forks that name an upstream in the lists are pulled
+ *			after everything else, and share its objects.
  *	aliases - outputs probable aliases based on emails
  *		-D <date>[,<date>]
  *			//restrict calculations to date or daterange
+ *		-n <NUMBER>
+ *			//top NUMBER clusters of aliases by confidence
  *	author - given an author's name or email, we can drill down into
  *	    specifics
  *		-a <name | email>
@@ -150,17 +171,61 @@ str2cent(char *s)
  *			limited by the distance/number-of-hops specified in
  *			`-d`.
  *		-D <date>[,<date>]
- *		-c <degree | closeness | betweeness>
- *			//centrality value to use
+ *		-c <degree | strength | closeness | betweeness | activity>
+ *			//centrality value to use. Degree is the number of
+ *			co-authors (authors that share a file), and strength
+ *			weighs each of them by the files they share. Activity
+ *			isn't a centrality: it ranks authors by the commits or
+ *			distinct files they have, counted during ingestion.
+ *		-w [commit | file]
+ *			//activity counts commits or distinct files
+ *		-s <K>
+ *			//estimate betweenness from K random authors instead
+ *			of all of them, and report the error bound
+ *		-H <authors>
+ *			//files with more authors than this (i.e. top-level
+ *			Makefiles) don't connect their authors. Defaults to
+ *			PROJ_DEFAULT_HUBCAP.
+ *		-W <days>
+ *			//only connect authors whose modifications to a common
+ *			file are at most this many days apart, weighted by how
+ *			close they are. Strength sums those weights instead of
+ *			shared files, and degree counts the connected authors.
  *
  *	repository - do repository centric calculations
- *		-l //lists all repos
+ *		-l //lists all repos, with the number of commits in each, the
+ *			number first seen in it, and the number shared with
+ *			other repos
+ *		-x //cross-polination: the number of commits that
+ *			originated in each repo, and the flow of commits
+ *			between repos
+ *		-X <sha1>
+ *			//cross-polination of one commit: its origin, and the
+ *			commit at which it arrived in each repo, in order
  *		-D <date>[,<date>]
  *		-w [commit | file | line]
  *		-n <NUMBER>
  *			//top NUMBER contributors by amount of work done
  *
+ *	Every argument also takes:
+ *		--stats[=<file>]
+ *			//report the time, CPU, peak RSS, rates and
+ *			allocations of each phase of the run on stderr, or
+ *			write them to <file> as JSON ("-" is stdout)
+ *		--verify-snapshot
+ *			//checksum every section of the snapshot when loading
+ *			it, instead of only the list of repositories
+ *
  */
+#define	OPT_STATS	256
+#define	OPT_VERIFY_SNAP	257
+
+struct option long_opts[] = {
+	{"stats", optional_argument, NULL, OPT_STATS},
+	{"verify-snapshot", no_argument, NULL, OPT_VERIFY_SNAP},
+	{NULL, 0, NULL, 0}
+};
+
 repo_t *find_repo(char *);
 void
 args_to_constraints(int ac, char **av)
@@ -182,13 +247,26 @@ args_to_constraints(int ac, char **av)
 	} else if (!strcmp(av[1], "repository")) {
 		constraints.cn_arg = REPOSITORY;
 	}
+	/* no `-D` means all of history */
+	constraints.cn_start_date = INT64_MIN;
+	constraints.cn_end_date = INT64_MAX;
+	constraints.cn_hubcap = PROJ_DEFAULT_HUBCAP;
 	int c;
 	char *comma;
 	char *start_date_str;
 	char *end_date_str;
-	while ((c = getopt(ac - 1, av+1, "a:w:r:f:D:hn:d:c:")) != -1) {
+	while ((c = getopt_long(ac - 1, av+1,
+	    "a:w:r:f:D:hlxX:n:d:c:j:H:s:W:", long_opts, NULL)) != -1) {
 		switch (c) {
 
+		case OPT_STATS:
+			constraints.cn_stats = 1;
+			constraints.cn_stats_file = optarg;
+			break;
+		case OPT_VERIFY_SNAP:
+			constraints.cn_snap_verify = 1;
+			break;
+
 		case 'a':
 			constraints.cn_author = optarg;
 			break;
@@ -219,24 +297,48 @@ args_to_constraints(int ac, char **av)
 			 */
 			start_date_str = optarg;
 			comma = strchr(optarg, ',');
-			tm_t *edate = &(constraints.cn_end_date);
-			tm_t *sdate = &(constraints.cn_start_date);
+			tm_t edate;
+			tm_t sdate;
+			bzero(&edate, sizeof (tm_t));
+			bzero(&sdate, sizeof (tm_t));
 			if (comma != NULL) {
 				*comma = '\0';
 				end_date_str = comma + 1;
-				strptime(end_date_str, "%D", edate);
+				strptime(end_date_str, "%D", &edate);
+				/* the end date is inclusive */
+				edate.tm_hour = 23;
+				edate.tm_min = 59;
+				edate.tm_sec = 59;
 			} else {
 				/* current time */
 				time_t curtime;
 				curtime = time(NULL);
-				(void)localtime_r(&curtime, edate);
+				(void)localtime_r(&curtime, &edate);
 			}
 			strptime(start_date_str, "%D",
-				sdate);
+				&sdate);
+			/*
+			 * Commit times are compared against these millions of
+			 * times, so we convert them to epoch seconds once.
+			 */
+			sdate.tm_isdst = -1;
+			edate.tm_isdst = -1;
+			constraints.cn_start_date = mktime(&sdate);
+			constraints.cn_end_date = mktime(&edate);
 			break;
 		case 'h':
 			constraints.cn_hist = 1;
 			break;
+		case 'l':
+			constraints.cn_list = 1;
+			break;
+		case 'x':
+			constraints.cn_xpol = 1;
+			break;
+		case 'X':
+			constraints.cn_xpol = 1;
+			constraints.cn_xpol_commit = optarg;
+			break;
 		case 'd':
 			constraints.cn_dist = str2int64(optarg);
 			if (constraints.cn_dist < 0) {
@@ -255,10 +357,51 @@ args_to_constraints(int ac, char **av)
 				fprintf(stderr,
 				    "Centrality value must be one of:\n");
 				fprintf(stderr,
-				    "\t%s\n\t%s\n\t%s\n",
-				    "degree", "closeness", "betweeness");
+				    "\t%s\n\t%s\n\t%s\n\t%s\n\t%s\n",
+				    "degree", "strength", "closeness",
+				    "betweenness", "activity");
+				exit(-1);
+			}
+			break;
+
+		case 'j':
+			constraints.cn_jobs = str2int64(optarg);
+			if (constraints.cn_jobs < 1) {
+				fprintf(stderr,
+				    "need at least one job!\n");
+				exit(-1);
+			}
+			break;
+
+		case 'H':
+			constraints.cn_hubcap = str2int64(optarg);
+			if (constraints.cn_hubcap < 2 ||
+			    constraints.cn_hubcap > UINT32_MAX) {
+				fprintf(stderr,
+				    "hub cap must be at least 2!\n");
+				exit(-1);
+			}
+			break;
+
+		case 's':
+			constraints.cn_samples = str2int64(optarg);
+			if (constraints.cn_samples < 1 ||
+			    constraints.cn_samples > UINT32_MAX) {
+				fprintf(stderr,
+				    "need at least one sample!\n");
+				exit(-1);
+			}
+			break;
+
+		case 'W':
+			constraints.cn_window = str2int64(optarg);
+			if (constraints.cn_window < 1 ||
+			    constraints.cn_window > INT64_MAX / SECS_PER_DAY) {
+				fprintf(stderr,
+				    "window must be at least a day!\n");
 				exit(-1);
 			}
+			constraints.cn_window *= SECS_PER_DAY;
 			break;
 
 		case ':':
@@ -279,18 +422,55 @@ int
 main(int ac, char **av)
 {
 	ILLUMETRICS_GOT_HERE(__LINE__);
+	stats_begin(SP_LOAD);
 	illumetrics_umem_init();
+	ilm_intern_init();
+	cstore_init();
+	trie_init();
+	graph_init();
+	deg_init();
+	numstat_init();
 	git_libgit2_init();
 	open_fds();
 	load_repositories();
+	cset_init();
+	stats_end(SP_LOAD);
 	args_to_constraints(ac, av);
 	if (constraints.cn_arg == PULL) {
 		printf("Pulling in all repos...\n");
+		stats_begin(SP_PULL);
 		update_all_repos();
+		stats_end(SP_PULL);
 		printf("Done.\n");
 	}
 	purge_unrecognized_repos();
+	stats_begin(SP_GRAPHS);
 	construct_graphs();
+	stats_end(SP_GRAPHS);
+	if (constraints.cn_hist) {
+		print_dir_histogram();
+	}
+	if (constraints.cn_arg == AUTHOR && constraints.cn_author != NULL) {
+		author_work();
+	}
+	if (constraints.cn_arg == REPOSITORY && constraints.cn_xpol) {
+		cross_polination();
+	} else if (constraints.cn_arg == REPOSITORY && constraints.cn_list) {
+		repository_list();
+	} else if (constraints.cn_arg == REPOSITORY) {
+		repository_work();
+	}
+	if (constraints.cn_arg == ALIASES) {
+		alias_report(constraints.cn_num);
+	}
+	if (constraints.cn_arg == CENTRALITY) {
+		stats_begin(SP_CENT);
+		centrality();
+		stats_end(SP_CENT);
+	}
+	if (constraints.cn_stats) {
+		stats_report(constraints.cn_stats_file);
+	}
 	git_libgit2_shutdown();
 	return (0);
 }
@@ -368,10 +548,11 @@ atomic_write(int fd, void *buf, size_t sz)
  * corresponds to a single line in the file. We allocate a buffer for the whole
  * file. We copy the contents of the file into the buffer. We then replace the
  * newlines with a NULL and store pointers to the beginnings of these strings
- * into an array, and return the array.
+ * into an array, and return the array. The size of the file goes into `szp`,
+ * for rm_lines().
  */
 char **
-get_lines(int fd, int *lns)
+get_lines(int fd, int *lns, size_t *szp)
 {
 	struct stat st;
 	int fs = fstat(fd, &st);
@@ -392,9 +573,9 @@ get_lines(int fd, int *lns)
 	}
 	char **lines = ilm_mk_buf(sizeof (char *) * nlines);
 	i = 0;
-	int j = 0;
+	size_t j = 0;
 	int next = 1;
-	while (i < st.st_size) {
+	while (i < st.st_size && j < nlines) {
 		if (next) {
 			lines[j] = buf+i;
 			j++;
@@ -405,10 +586,27 @@ get_lines(int fd, int *lns)
 		}
 		i++;
 	}
+	if (nlines == 0) {
+		ilm_rm_buf(buf, st.st_size);
+	}
 	*lns = nlines;
+	*szp = st.st_size;
 	return (lines);
 }
 
+/*
+ * Frees the lines returned by get_lines(). They are all in one buffer, which
+ * starts with the first line.
+ */
+void
+rm_lines(char **lines, int nlines, size_t sz)
+{
+	if (nlines > 0) {
+		ilm_rm_buf(lines[0], sz);
+	}
+	ilm_rm_buf(lines, sizeof (char *) * nlines);
+}
+
 /*
  * Given a repo_t, we use its URL to determine what the owner's username is and
  * what the repository's name is. We can use this data to determine where in
@@ -417,6 +615,13 @@ get_lines(int fd, int *lns)
  * we bail. This is becuase we want to make sure that we properly extract the
  * username and repository-name from the URL.
  *
+ * Besides github, we recognize `file://` URLs. These point at repositories on
+ * the local machine, and are mostly useful for testing `pull` against local
+ * bare repos. The last two components of a `file://` path are treated exactly
+ * like the username and repository-name of a github URL, so
+ * `file:///tmp/repos/joyent/illumos-joyent.git` ends up in
+ * `stor/joyent/illumos-joyent`.
+ *
  * We assume that the username corresponds to the patron-name. For example
  * 'joyent'. This isn't a particularly good assumption to make, but it is
  * expedient. If this becomes a problem we should create a mapping between
@@ -428,68 +633,49 @@ void
 repo_derive_url(repo_t *r)
 {
 	char *url = r->rp_url;
-	int cmp = strncmp(url, "git://github.com/", 17);
-	char username[FILENAME_MAX];
-	int ulen = 0;
-	char reponame[FILENAME_MAX];
-	int rlen = 0;
-	bzero(username, FILENAME_MAX);
-	bzero(reponame, FILENAME_MAX);
-	if (!cmp) {
-		char *fullname = url + 17;
-		/*
-		 * This is the slash ('/') that divides the username from the
-		 * repo name.
-		 */
-		char *slash = strchr(fullname, '/');
-		/*
-		 * This is the dot ('.') that divides the repo name from the
-		 * file extention (.git). We would use strchr, but a repo name
-		 * can contain more than one dot.
-		 */
-		char *dot = slash;
-		while (*dot != '\0') {
-			dot++;
-		}
-		dot--;
-		while (*dot != '.') {
-			dot--;
-		}
-		if (slash == NULL) {
-			fprintf(stderr,
-			    "URL %s doesn't contain a slash (/).\n",
-			    url);
-			exit(-1);
-		}
-		if (dot == NULL) {
-			fprintf(stderr,
-			    "URL %s doesn't contain a '.git' suffix.\n",
-			    url);
-			exit(-1);
-		}
-		char *cur = url + 17; /* cursor */
-		int i = 0;
-		while (cur != slash) {
-			username[i] = *cur;
-			i++;
-			cur++;
-		}
-		ulen = i;
-		cur++; /* jump over the slash */
-		i = 0;
-		while (*cur != *dot) {
-			reponame[i] = *cur;
-			i++;
-			cur++;
-		}
-		rlen = i;
-		char *owner = ilm_mk_zbuf(ulen + 1);
-		char *name = ilm_mk_zbuf(rlen + 1);
-		bcopy(username, owner, ulen);
-		bcopy(reponame, name, rlen);
-		r->rp_owner = owner;
-		r->rp_name = name;
+	char *path;
+	if (!strncmp(url, "git://github.com/", 17)) {
+		path = url + 17;
+	} else if (!strncmp(url, "file://", 7)) {
+		path = url + 7;
+	} else {
+		fprintf(stderr, "URL %s has an unrecognized domain.\n", url);
+		exit(-1);
+	}
+	/*
+	 * We work backwards from the end of the URL, ignoring trailing slashes
+	 * and the (optional) '.git' suffix. We can't just search for the first
+	 * dot, because a repo name can contain more than one dot.
+	 */
+	char *end = path + strlen(path);
+	while (end > path && end[-1] == '/') {
+		end--;
+	}
+	if (end - path > 4 && !strncmp(end - 4, ".git", 4)) {
+		end -= 4;
+	}
+	char *name = end;
+	while (name > path && name[-1] != '/') {
+		name--;
+	}
+	/* This is the slash ('/') that divides the username from the name. */
+	char *slash = name - 1;
+	char *owner = slash;
+	while (owner > path && owner[-1] != '/') {
+		owner--;
 	}
+	if (name == path || name == end || owner >= slash) {
+		fprintf(stderr,
+		    "URL %s doesn't contain a <user>/<repo> path.\n",
+		    url);
+		exit(-1);
+	}
+	int ulen = slash - owner;
+	int rlen = end - name;
+	r->rp_owner = ilm_mk_zbuf(ulen + 1);
+	r->rp_name = ilm_mk_zbuf(rlen + 1);
+	bcopy(owner, r->rp_owner, ulen);
+	bcopy(name, r->rp_name, rlen);
 }
 
 /*
@@ -525,6 +711,9 @@ url_to_repo(char *url, rep_type_t rt)
 	 * by URL.
 	 */
 	int cmp = strncmp(url, "git://", 6);
+	if (cmp) {
+		cmp = strncmp(url, "file://", 7);
+	}
 	if (!cmp) {
 		r->rp_vcs = GIT;
 		repo_derive_url(r);
@@ -601,6 +790,67 @@ copy_dir(char *dir, int fd)
 	close(dfd);
 }
 
+/*
+ * Repositories are numbered in the order of the repos slablist. The commit
+ * records refer to their repository by this number.
+ */
+selem_t
+number_repos_foldr(selem_t zn, selem_t *e, uint64_t sz)
+{
+	uint64_t i = 0;
+	while (i < sz) {
+		repo_t *r = e[i].sle_p;
+		r->rp_id = nrepos;
+		repo_table[nrepos] = r;
+		nrepos++;
+		i++;
+	}
+	return (zn);
+}
+
+/*
+ * A line in a list-file can name the repository's upstream after the URL, as
+ * in:
+ *
+ *	git://github.com/joyent/illumos-joyent.git illumos/illumos-gate
+ *
+ * Such a fork borrows the objects of its upstream instead of storing its own
+ * copies (see repo_share_objects()). Here we point each fork at its upstream.
+ * The upstream has to be in the lists, and can't be a fork itself, so that
+ * pulling all of the upstreams before any of the forks is enough.
+ */
+void
+resolve_upstreams()
+{
+	uint32_t i = 0;
+	while (i < nrepos) {
+		repo_t *r = repo_table[i];
+		i++;
+		if (r->rp_upname == NULL) {
+			continue;
+		}
+		/* find_repo() cuts the name in two, so it gets a copy */
+		char fullname[PATH_MAX];
+		(void) snprintf(fullname, PATH_MAX, "%s", r->rp_upname);
+		repo_t *up = NULL;
+		if (strchr(fullname, '/') != NULL) {
+			up = find_repo(fullname);
+		}
+		if (up == NULL || up == r) {
+			fprintf(stderr, "%s/%s: unknown upstream %s\n",
+			    r->rp_owner, r->rp_name, r->rp_upname);
+			exit(-1);
+		}
+		if (up->rp_upname != NULL) {
+			fprintf(stderr, "%s/%s: upstream %s is a fork of %s\n",
+			    r->rp_owner, r->rp_name, r->rp_upname,
+			    up->rp_upname);
+			exit(-1);
+		}
+		r->rp_upstream = up;
+	}
+}
+
 /*
  * This function essentially goes through the list-files and fills out the
  * repos slablist.
@@ -622,10 +872,22 @@ retry_list_fd_open:;
 			copy_dir(PREFIX"config/lists/", lists_fd);
 			goto retry_list_fd_open;
 		}
-		char **urls = get_lines(fd, &lines);
+		/* the lines are kept, since rp_upname points into them */
+		size_t sz;
+		char **urls = get_lines(fd, &lines, &sz);
 		close(fd);
 		int j = 0;
 		while (j < lines) {
+			/* the URL can be followed by the fork's upstream */
+			char *up = strpbrk(urls[j], " \t");
+			if (up != NULL) {
+				*up = '\0';
+				up++;
+				up += strspn(up, " \t");
+				if (*up == '\0') {
+					up = NULL;
+				}
+			}
 			repo_t *rep = url_to_repo(urls[j], repo_types[i]);
 			selem_t srep;
 			srep.sle_p = rep;
@@ -637,6 +899,7 @@ retry_list_fd_open:;
 				    urls[j]);
 				exit(-1);
 			} else {
+				rep->rp_upname = up;
 				int slstat = slablist_add(repos, srep, 0);
 				if (slstat == SL_EDUP) {
 					fprintf(stderr, "In File: %s ",
@@ -651,6 +914,11 @@ retry_list_fd_open:;
 		}
 		i++;
 	}
+	repo_table = ilm_mk_zbuf(sizeof (repo_t *) * slablist_get_elems(repos));
+	selem_t zn;
+	zn.sle_u = 0;
+	(void) slablist_foldr(repos, number_repos_foldr, zn);
+	resolve_upstreams();
 }
 
 
@@ -683,8 +951,12 @@ open_fds()
 		exit(-1);
 	}
 	uid = getuid();
-	pwd = getpwuid(uid);
-	home = pwd->pw_dir;
+	/* $HOME wins, so that the tests can run in a scratch directory */
+	home = getenv("HOME");
+	if (home == NULL || *home == '\0') {
+		pwd = getpwuid(uid);
+		home = pwd->pw_dir;
+	}
 	DIR *home_dir = opendir(home);
 	if (home_dir == NULL) {
 		perror("open_fds:opendir:$HOME");
@@ -749,6 +1021,19 @@ open_fds()
 		perror("open_fds:dirfd:stor");
 		exit(-1);
 	}
+	/*
+	 * Some libraries (like libgit2) accept pathnames instead of file
+	 * descriptors. So we also remember the absolute path of the stor
+	 * directory, which lets us build the path of any repository without
+	 * touching the cwd. The cwd is shared by every thread in the process,
+	 * so nothing outside of this function may change it.
+	 */
+	char *rpret = realpath(illumetrics_stor == NULL ? "stor" :
+	    illumetrics_stor, stor_path);
+	if (rpret == NULL) {
+		perror("open_fds:realpath:stor");
+		exit(-1);
+	}
 
 	DIR *lists_dir = opendir("lists");
 	if (lists_dir == NULL) {
@@ -789,142 +1074,986 @@ handle_git_error(int error)
 	exit(error);
 }
 
+/*
+ * Fills `path` (which must be PATH_MAX bytes) with the absolute path of the
+ * repository's storage directory, `stor/<owner>/<name>`.
+ */
+void
+repo_get_path(repo_t *r, char *path)
+{
+	int plen = snprintf(path, PATH_MAX, "%s/%s/%s", stor_path,
+	    r->rp_owner, r->rp_name);
+	if (plen >= PATH_MAX) {
+		fprintf(stderr, "repo_get_path: path of %s/%s is too long\n",
+		    r->rp_owner, r->rp_name);
+		exit(-1);
+	}
+}
+
+/*
+ * Like handle_git_error(), but for errors that only doom a single repository.
+ * We record the error in the pull_result_t instead of exiting.
+ */
+void
+record_git_error(pull_result_t *pr, int error)
+{
+	const git_error *e = giterr_last();
+	pr->pr_status = PS_FAILED;
+	pr->pr_error = error;
+	(void) snprintf(pr->pr_msg, sizeof (pr->pr_msg), "%s",
+	    e == NULL ? "unknown error" : e->message);
+}
+
+/*
+ * Makes a failed system call, described by `what` and errno, the last libgit2
+ * error of this thread, so that record_git_error() can report it. Returns
+ * GIT_ERROR.
+ */
+int
+set_os_error(const char *what)
+{
+	char msg[128];
+	(void) snprintf(msg, sizeof (msg), "%s: %s", what, strerror(errno));
+	giterr_set_str(GITERR_OS, msg);
+	return (GIT_ERROR);
+}
+
+/*
+ * Returns a monotonic timestamp in nanoseconds.
+ */
+int64_t
+ilm_gethrtime()
+{
+	struct timespec ts;
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+/*
+ * libgit2 calls this as objects arrive. We only keep the latest totals, which
+ * end up in the pull summary.
+ */
+int
+pull_progress_cb(const git_transfer_progress *stats, void *arg)
+{
+	pull_result_t *pr = arg;
+	pr->pr_objects = stats->received_objects;
+	pr->pr_bytes = stats->received_bytes;
+	return (0);
+}
+
+/*
+ * Sharing Objects Between Forks
+ * =============================
+ *
+ * The illumos forks (illumos-joyent, illumos-omnios, and so on) contain
+ * nearly all of illumos-gate's history, so cloning each of them downloads and
+ * stores the same multi-gigabyte object database over and over. Instead, a
+ * fork that declares an upstream in the list-files (see resolve_upstreams())
+ * borrows the upstream's objects through git alternates: the fork's
+ * `objects/info/alternates` names the upstream's `objects` directory, and
+ * git looks there for any object that the fork doesn't have.
+ *
+ * Before every fetch, the fork also gets a copy of the upstream's
+ * remote-tracking refs, under UPSTREAM_REFS. The fetch negotiation offers the
+ * remote every local ref, so the remote only sends the objects that aren't
+ * reachable from the upstream's tips, and those are all that the fork stores.
+ * The history walk only follows ORIGIN_REFS, so the copies don't add the
+ * upstream's branches to the fork.
+ *
+ * The upstreams are pulled before the forks (see update_all_repos()). If the
+ * upstream can't be opened (i.e. its clone failed), the fork is pulled in
+ * full. A fork that was cloned before it declared its upstream keeps the
+ * objects it already has, and only stores less from then on.
+ */
+#define	ORIGIN_REFS	"refs/remotes/origin/"
+#define	UPSTREAM_REFS	"refs/upstream/"
+
+/*
+ * Returns 1 if the alternates file at `alt` already lists `objs`, 0 if it
+ * doesn't, and a libgit2 error if it can't be read.
+ */
+int
+alternates_has(char *alt, char *objs)
+{
+	int fd = open(alt, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			return (set_os_error("alternates_has:open"));
+		}
+		return (0);
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int error = set_os_error("alternates_has:fstat");
+		(void) close(fd);
+		return (error);
+	}
+	char *buf = ilm_mk_zbuf(st.st_size + 1);
+	atomic_read(fd, buf, st.st_size);
+	(void) close(fd);
+	int found = 0;
+	char *line = buf;
+	while (line < buf + st.st_size && !found) {
+		char *nl = strchr(line, '\n');
+		if (nl != NULL) {
+			*nl = '\0';
+		}
+		found = !strcmp(line, objs);
+		line += strlen(line) + 1;
+	}
+	ilm_rm_buf(buf, st.st_size + 1);
+	return (found);
+}
+
+/*
+ * Makes `gr` borrow the objects of `r`'s upstream, and copies the upstream's
+ * remote-tracking refs into it. Returns a libgit2 error if `gr` can't be
+ * updated.
+ */
+int
+repo_share_objects(repo_t *r, git_repository_t *gr)
+{
+	char up_path[PATH_MAX];
+	git_repository_t *up;
+	repo_get_path(r->rp_upstream, up_path);
+	if (git_repository_open(&up, up_path) < 0) {
+		fprintf(stderr, "Can't open %s, pulling %s/%s in full.\n",
+		    up_path, r->rp_owner, r->rp_name);
+		return (0);
+	}
+	/* git_repository_path() is the git dir, with a trailing slash */
+	char objs[PATH_MAX];
+	char info[PATH_MAX];
+	char alt[PATH_MAX];
+	if (snprintf(objs, PATH_MAX, "%sobjects",
+	    git_repository_path(up)) >= PATH_MAX ||
+	    snprintf(info, PATH_MAX, "%sobjects/info",
+	    git_repository_path(gr)) >= PATH_MAX ||
+	    snprintf(alt, PATH_MAX, "%sobjects/info/alternates",
+	    git_repository_path(gr)) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		git_repository_free(up);
+		return (set_os_error("repo_share_objects:snprintf"));
+	}
+	int mkd = mkdir(info, S_IRWXU);
+	if (mkd < 0 && errno != EEXIST) {
+		git_repository_free(up);
+		return (set_os_error("repo_share_objects:mkdir:objects/info"));
+	}
+	int error = alternates_has(alt, objs);
+	if (error == 0) {
+		int fd = open(alt, O_WRONLY | O_CREAT | O_APPEND, S_IRWXU);
+		if (fd < 0) {
+			git_repository_free(up);
+			return (set_os_error(
+			    "repo_share_objects:open:alternates"));
+		}
+		atomic_write(fd, objs, strlen(objs));
+		atomic_write(fd, "\n", 1);
+		(void) close(fd);
+		/* the odb of `gr` may already be open, so we tell it too */
+		git_odb *odb;
+		error = git_repository_odb(&odb, gr);
+		if (error == 0) {
+			error = git_odb_add_disk_alternate(odb, objs);
+			git_odb_free(odb);
+		}
+	} else if (error == 1) {
+		error = 0;
+	}
+	git_reference_iterator *it = NULL;
+	git_reference *ref;
+	if (error == 0) {
+		error = git_reference_iterator_glob_new(&it, up,
+		    ORIGIN_REFS "*");
+	}
+	while (error == 0 && (error = git_reference_next(&ref, it)) == 0) {
+		if (git_reference_type(ref) == GIT_REF_OID) {
+			char name[PATH_MAX];
+			git_reference *copy;
+			(void) snprintf(name, PATH_MAX, "%s%s", UPSTREAM_REFS,
+			    git_reference_name(ref) + strlen(ORIGIN_REFS));
+			error = git_reference_create(&copy, gr, name,
+			    git_reference_target(ref), 1, NULL, NULL);
+			if (error == 0) {
+				git_reference_free(copy);
+			}
+		}
+		git_reference_free(ref);
+	}
+	if (error == GIT_ITEROVER) {
+		error = 0;
+	}
+	if (it != NULL) {
+		git_reference_iterator_free(it);
+	}
+	git_repository_free(up);
+	return (error);
+}
+
+int repo_make_bare(repo_t *, int);
 /*
  * Synchronizes on-disk repo with canonical remote repo. If there is no on-disk
- * repo, we clone one into the expected location.
+ * repo, we clone a bare one into the expected location. If there is one with a
+ * working tree, we make it bare first (see repo_make_bare()).
+ *
+ * This function is called concurrently by the pull workers, so it must not
+ * change any process-wide state (like the cwd) and must not exit on
+ * repository-specific errors. Everything is done relative to `stor_fd`, or
+ * with absolute paths derived from `stor_path`. The outcome goes into `pr`.
  */
 void
-repo_pull(repo_t *r)
+repo_pull(repo_t *r, pull_result_t *pr)
 {
+	int64_t start = ilm_gethrtime();
 	int clone = 1; /* we try to clone by default */
+	pr->pr_repo = r;
+	ILLUMETRICS_PULL_START(r->rp_owner, r->rp_name);
+	int error = 0;
+	int owner_fd = -1;
 	int mkd = mkdirat(stor_fd, r->rp_owner, S_IRWXU);
 	if (mkd < 0 && errno != EEXIST) {
-		perror("repo_pull:mkdirat:stor/owner");
-		exit(-1);
+		error = set_os_error("repo_pull:mkdirat:stor/owner");
+	} else if ((owner_fd = openat(stor_fd, r->rp_owner,
+	    O_RDONLY | O_DIRECTORY)) < 0) {
+		error = set_os_error("repo_pull:openat:stor/owner");
+	} else {
+		/* a half-converted repository doesn't exist until it's done */
+		error = repo_make_bare(r, owner_fd);
 	}
-	fchdir(stor_fd);
-	DIR *owner_dir = opendir(r->rp_owner);
-	if (owner_dir == NULL) {
-		perror("repo_pull:opendir:stor/owner");
-		exit(-1);
+	if (error == 0) {
+		mkd = mkdirat(owner_fd, r->rp_name, S_IRWXU);
+		if (mkd < 0 && errno != EEXIST) {
+			error = set_os_error(
+			    "repo_pull:mkdirat:stor/owner/name");
+		} else if (mkd < 0 && errno == EEXIST) {
+			/* but we try to fetch/pull if dir exists */
+			clone = 0;
+		}
 	}
-	int owner_fd = dirfd(owner_dir);
-	if (owner_fd < 0) {
-		perror("repo_pull:dirfd:stor/owner");
-		exit(-1);
+	if (owner_fd >= 0) {
+		(void) close(owner_fd);
 	}
-	mkd = mkdirat(owner_fd, r->rp_name, S_IRWXU);
-	if (mkd < 0 && errno != EEXIST) {
-		perror("repo_pull:mkdirat:stor/owner");
-		exit(-1);
-	} else if (mkd < 0 && errno == EEXIST) {
-		/* but we try to fetch/pull if dir exists */
-		clone = 0;
+	if (error < 0) {
+		record_git_error(pr, error);
+		pr->pr_nsec = ilm_gethrtime() - start;
+		ILLUMETRICS_PULL_DONE(r->rp_owner, r->rp_name, pr->pr_status,
+		    pr->pr_objects, pr->pr_bytes);
+		return;
 	}
 
-	/*
-	 * We now get the full pathname  of the repo, by cd'ing into it and
-	 * getting the cwd. Some libraries (like libgit2) accept pathnames
-	 * instead of file descriptors.
-	 */
-	fchdir(owner_fd);
-	chdir(r->rp_name);
 	char repo_path[PATH_MAX];
-	bzero(repo_path, PATH_MAX);
-	char *cwd_ret = getcwd(repo_path, PATH_MAX);
-	if (cwd_ret == NULL) {
-		perror("repo_pull:getcwd");
-		exit(-1);
-	}
-	int error;
+	repo_get_path(r, repo_path);
 	/* git structure declarations */
 	git_repository_t *gr = NULL;
 	git_remote_t *grem = NULL;
 	git_clone_options gopts = GIT_CLONE_OPTIONS_INIT;
+	git_remote_callbacks gcbs = GIT_REMOTE_CALLBACKS_INIT;
 
 	switch (r->rp_vcs) {
 
 	case GIT:
 
-		if (clone) {
+		if (clone && r->rp_upstream == NULL) {
 			printf("Cloning into %s...\n", repo_path);
+			gopts.bare = 1;
+			gopts.remote_callbacks.transfer_progress =
+			    pull_progress_cb;
+			gopts.remote_callbacks.payload = pr;
 			error = git_clone(&gr, r->rp_url, repo_path, &gopts);
 			if (error < 0) {
-				handle_git_error(error);
+				record_git_error(pr, error);
+				break;
 			}
+			pr->pr_status = PS_CLONED;
 			printf("Finished cloning into %s...\n", repo_path);
+			break;
+		}
+		if (clone) {
+			/*
+			 * git_clone() would fetch before we get a chance to
+			 * share objects, so we put a fork's clone together by
+			 * hand.
+			 */
+			printf("Cloning into %s...\n", repo_path);
+			error = git_repository_init(&gr, repo_path, 1);
+			if (error < 0) {
+				record_git_error(pr, error);
+				break;
+			}
+			error = git_remote_create(&grem, gr, "origin",
+			    r->rp_url);
 		} else {
+			printf("Pulling into %s...\n", repo_path);
 			error = git_repository_open(&gr, repo_path);
 			if (error < 0) {
-				handle_git_error(error);
+				record_git_error(pr, error);
+				break;
 			}
 			error = git_remote_lookup(&grem, gr, "origin");
+		}
+		if (error < 0) {
+			record_git_error(pr, error);
+			break;
+		}
+		if (r->rp_upstream != NULL) {
+			error = repo_share_objects(r, gr);
 			if (error < 0) {
-				handle_git_error(error);
-			}
-			/*
-			 * XXX the libgit2 interfaces keep changing, so this
-			 * function has an extra arg in newer version of
-			 * libgit2. I never thought that the github guys were
-			 * such amatuers.
-			 */
-			printf("Pulling into %s...\n", repo_path);
-			error = git_remote_fetch(grem, NULL, NULL);
-			if (error < 0) {
-				handle_git_error(error);
+				record_git_error(pr, error);
+				break;
 			}
-			printf("Finished pulling into %s...\n", repo_path);
 		}
+		gcbs.transfer_progress = pull_progress_cb;
+		gcbs.payload = pr;
+		error = git_remote_set_callbacks(grem, &gcbs);
+		if (error < 0) {
+			record_git_error(pr, error);
+			break;
+		}
+		/*
+		 * XXX the libgit2 interfaces keep changing, so this
+		 * function has an extra arg in newer version of
+		 * libgit2. I never thought that the github guys were
+		 * such amatuers.
+		 */
+		error = git_remote_fetch(grem, NULL, NULL);
+		if (error < 0) {
+			record_git_error(pr, error);
+			break;
+		}
+		pr->pr_status = clone ? PS_CLONED : PS_FETCHED;
+		printf("Finished %s into %s...\n",
+		    clone ? "cloning" : "pulling", repo_path);
 		break;
 	case HG:
 		fprintf(stderr, "Pull not supported on Mercurial repositories.\n");
 		fprintf(stderr, "Skipping repository %s.\n", r->rp_url);
+		pr->pr_status = PS_SKIPPED;
 		break;
 	case SVN:
 		fprintf(stderr, "Pull not supported on SVN repositories.\n");
 		fprintf(stderr, "Skipping repository %s.\n", r->rp_url);
+		pr->pr_status = PS_SKIPPED;
 		break;
 	case CVS:
 		fprintf(stderr, "Pull not supported on CVS repositories.\n");
 		fprintf(stderr, "Skipping repository %s.\n", r->rp_url);
+		pr->pr_status = PS_SKIPPED;
 		break;
 	case SCCS:
 		fprintf(stderr, "Pull not supported on SCCS repositories.\n");
 		fprintf(stderr, "Skipping repository %s.\n", r->rp_url);
+		pr->pr_status = PS_SKIPPED;
 		break;
 	}
+	if (grem != NULL) {
+		git_remote_free(grem);
+	}
+	if (gr != NULL) {
+		git_repository_free(gr);
+	}
+	pr->pr_nsec = ilm_gethrtime() - start;
+	ILLUMETRICS_PULL_DONE(r->rp_owner, r->rp_name, pr->pr_status,
+	    pr->pr_objects, pr->pr_bytes);
 }
 
 /*
- * Returns the next commit. We don't want to load all of the commits into
- * memory, we just stream them, and add their information to the graphs,
- * mentioned in `illumetrics_impl.h`. The first commit retrieved is the commit
- * made closest to constraints.cn_start_date. Similarly the last commit
- * retrieved is the commit made closes to constraints.cn_end_date. If there are
- * no commits in that range we return NULL. If we reach the end of the commits
- * in that range, we return NULL.
+ * Ingestion State
+ * ===============
+ *
+ * Every repository has a small state file, `stor/<owner>/<name>/HWM_FILE`,
+ * that contains one line per ref:
+ *
+ *	<40 hex digits of the commit sha1> <ref name>
+ *
+ * Each line is the high-water mark of that ref: the tip it pointed to the
+ * last time we finished ingesting the repository. When a walk is incremental
+ * we push the current tips and hide the saved ones, so that libgit2 only
+ * visits commits that are reachable from the new tips but not from the old
+ * ones. On a nightly run, that's just the day's commits.
+ *
+ * The marks describe what is in the snapshot (see illumetrics_snap.c), so
+ * they only advance after a snapshot has been saved, and a walk is only
+ * incremental if it adds to a loaded snapshot. Without a snapshot, the
+ * saved marks mean nothing, and we walk the whole history.
  */
-repo_commit_t *
-repo_get_next_commit(repo_t *r)
+#define	HWM_FILE	".illumetrics_hwm"
+#define	HWM_TMP_FILE	".illumetrics_hwm.tmp"
+#define	TIPS_GLOB	ORIGIN_REFS "*"
+
+void
+sha1_from_oid(sha1_t *s, const git_oid *o)
 {
-	fprintf(stderr, "Commit log functionality is not yet implemented.\n");
-	fprintf(stderr, "Bailing...\n");
-	exit(0);
-	switch (r->rp_vcs) {
+	bcopy(o->id, s, sizeof (sha1_t));
+}
 
-	case GIT:
-		return (NULL);
-		break;
-	case HG:
-		return (NULL);
-		break;
-	case SVN:
-		return (NULL);
-		break;
-	case CVS:
-		return (NULL);
-		break;
-	case SCCS:
+void
+sha1_to_oid(git_oid *o, sha1_t *s)
+{
+	bcopy(s, o->id, sizeof (sha1_t));
+}
+
+/*
+ * Appends a copy of (ref, oid) to the array at `*hwm`, growing it as needed.
+ * We grow by doubling, so `*n` being a power of two means the array is full.
+ */
+void
+hwm_append(repo_hwm_t **hwm, int *n, const char *ref, const git_oid *oid)
+{
+	if (*n == 0 || (*n & (*n - 1)) == 0) {
+		int cap = *n == 0 ? 1 : *n * 2;
+		repo_hwm_t *nhwm = ilm_mk_zbuf(sizeof (repo_hwm_t) * cap);
+		if (*n > 0) {
+			bcopy(*hwm, nhwm, sizeof (repo_hwm_t) * *n);
+			ilm_rm_buf(*hwm, sizeof (repo_hwm_t) * *n);
+		}
+		*hwm = nhwm;
+	}
+	(*hwm)[*n].rh_ref = ilm_mk_str(ref);
+	sha1_from_oid(&(*hwm)[*n].rh_sha1, oid);
+	(*n)++;
+}
+
+void
+hwm_destroy(repo_hwm_t *hwm, int n)
+{
+	int i = 0;
+	while (i < n) {
+		ilm_rm_str(hwm[i].rh_ref);
+		i++;
+	}
+	if (n > 0) {
+		int cap = 1;
+		while (cap < n) {
+			cap *= 2;
+		}
+		ilm_rm_buf(hwm, sizeof (repo_hwm_t) * cap);
+	}
+}
+
+/*
+ * Reads the repository's state file into `rp_hwm`. A missing state file just
+ * means that the repository has never been ingested.
+ */
+void
+repo_hwm_load(repo_t *r)
+{
+	char path[PATH_MAX];
+	(void) snprintf(path, PATH_MAX, "%s/%s/%s", r->rp_owner, r->rp_name,
+	    HWM_FILE);
+	hwm_destroy(r->rp_hwm, r->rp_nhwm);
+	r->rp_hwm = NULL;
+	r->rp_nhwm = 0;
+	int fd = openat(stor_fd, path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			perror("repo_hwm_load:openat");
+			exit(-1);
+		}
+		return;
+	}
+	int lines = 0;
+	size_t sz;
+	char **hwms = get_lines(fd, &lines, &sz);
+	(void) close(fd);
+	int i = 0;
+	while (i < lines) {
+		git_oid oid;
+		char *sp = strchr(hwms[i], ' ');
+		if (sp == NULL || sp - hwms[i] != GIT_OID_HEXSZ ||
+		    git_oid_fromstrn(&oid, hwms[i], GIT_OID_HEXSZ) < 0) {
+			fprintf(stderr, "%s/%s: malformed line in %s: %s\n",
+			    r->rp_owner, r->rp_name, HWM_FILE, hwms[i]);
+			exit(-1);
+		}
+		hwm_append(&r->rp_hwm, &r->rp_nhwm, sp + 1, &oid);
+		i++;
+	}
+	rm_lines(hwms, lines, sz);
+}
+
+/*
+ * Replaces the repository's state file with the tips that we saw at the
+ * beginning of the walk that just completed. We write a temporary file and
+ * rename it over the old one, so that a crash never leaves a truncated file.
+ */
+void
+repo_hwm_save(repo_t *r)
+{
+	char tmp[PATH_MAX];
+	char path[PATH_MAX];
+	(void) snprintf(tmp, PATH_MAX, "%s/%s/%s", r->rp_owner, r->rp_name,
+	    HWM_TMP_FILE);
+	(void) snprintf(path, PATH_MAX, "%s/%s/%s", r->rp_owner, r->rp_name,
+	    HWM_FILE);
+	int fd = openat(stor_fd, tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+	if (fd < 0) {
+		perror("repo_hwm_save:openat");
+		exit(-1);
+	}
+	int i = 0;
+	while (i < r->rp_ntips) {
+		git_oid oid;
+		char line[GIT_OID_HEXSZ + PATH_MAX + 2];
+		sha1_to_oid(&oid, &r->rp_tips[i].rh_sha1);
+		git_oid_fmt(line, &oid);
+		int len = GIT_OID_HEXSZ + snprintf(line + GIT_OID_HEXSZ,
+		    sizeof (line) - GIT_OID_HEXSZ, " %s\n",
+		    r->rp_tips[i].rh_ref);
+		atomic_write(fd, line, len);
+		i++;
+	}
+	if (fsync(fd) < 0) {
+		perror("repo_hwm_save:fsync");
+		exit(-1);
+	}
+	(void) close(fd);
+	if (renameat(stor_fd, tmp, stor_fd, path) < 0) {
+		perror("repo_hwm_save:renameat");
+		exit(-1);
+	}
+	hwm_destroy(r->rp_hwm, r->rp_nhwm);
+	r->rp_hwm = r->rp_tips;
+	r->rp_nhwm = r->rp_ntips;
+	r->rp_tips = NULL;
+	r->rp_ntips = 0;
+}
+
+/*
+ * Bare Storage
+ * ============
+ *
+ * Illumetrics only reads history, so the repositories in `stor/` are bare:
+ * `stor/<owner>/<name>` is the git directory itself, and there's no working
+ * tree. A checkout of illumos-gate is hundreds of thousands of files that
+ * nothing ever looks at. All of the history readers (the walk, the diff
+ * workers, numstat) work from the object database only, and the state file
+ * (HWM_FILE) simply sits in the git directory.
+ *
+ * Older versions of illumetrics cloned with a working tree. `pull` converts
+ * such a repository in place before fetching into it:
+ *
+ *	1. `<name>/.git` is renamed to `.<name>.bare`, next to `<name>`.
+ *	2. The state file is moved into `.<name>.bare`, the index is removed,
+ *	   and `core.bare` is set.
+ *	3. What's left of `<name>` (the working tree) is removed.
+ *	4. `.<name>.bare` is renamed to `<name>`.
+ *
+ * Every step can be repeated, and the presence of `.<name>.bare` means that
+ * steps 2 to 4 haven't finished, so an interrupted conversion is completed by
+ * the next `pull`.
+ */
+#define	BARE_TMP_FMT	".%s.bare"
+
+/*
+ * Removes `name`, which is in the directory `dfd`, and everything under it.
+ * It's not an error if `name` doesn't exist. Returns a libgit2 error if
+ * anything can't be removed, in which case some of it may be left.
+ */
+int
+remove_tree(int dfd, char *name)
+{
+	if (unlinkat(dfd, name, 0) == 0 || errno == ENOENT) {
+		return (0);
+	}
+	if (errno != EISDIR && errno != EPERM) {
+		return (set_os_error("remove_tree:unlinkat"));
+	}
+	int fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (fd < 0) {
+		return (set_os_error("remove_tree:openat"));
+	}
+	DIR *d = fdopendir(fd);
+	if (d == NULL) {
+		int error = set_os_error("remove_tree:fdopendir");
+		(void) close(fd);
+		return (error);
+	}
+	struct dirent *de;
+	int error = 0;
+	while (error == 0) {
+		errno = 0;
+		de = readdir(d);
+		if (de == NULL) {
+			if (errno != 0) {
+				error = set_os_error("remove_tree:readdir");
+			}
+			break;
+		}
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+			continue;
+		}
+		error = remove_tree(fd, de->d_name);
+	}
+	(void) closedir(d);
+	if (error == 0 && unlinkat(dfd, name, AT_REMOVEDIR) < 0) {
+		error = set_os_error("remove_tree:unlinkat:dir");
+	}
+	return (error);
+}
+
+/*
+ * Converts the repository's checkout into a bare repository, or finishes a
+ * conversion that was interrupted (see above). Does nothing to a repository
+ * that is already bare, or that doesn't exist yet. `owner_fd` is the
+ * `stor/<owner>` directory. Returns a libgit2 error if any step fails, in
+ * which case the repository is left as `.<name>.bare` (if it got that far),
+ * and the next `pull` picks up from there.
+ */
+int
+repo_make_bare(repo_t *r, int owner_fd)
+{
+	char tmp[PATH_MAX];
+	char path[PATH_MAX];
+	if (snprintf(tmp, PATH_MAX, BARE_TMP_FMT, r->rp_name) >= PATH_MAX ||
+	    snprintf(path, PATH_MAX, "%s/.git", r->rp_name) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return (set_os_error("repo_make_bare:snprintf"));
+	}
+	if (renameat(owner_fd, path, owner_fd, tmp) == 0) {
+		printf("Converting %s/%s to a bare repository...\n",
+		    r->rp_owner, r->rp_name);
+	} else if (errno != ENOENT) {
+		return (set_os_error("repo_make_bare:renameat:.git"));
+	}
+	struct stat st;
+	if (fstatat(owner_fd, tmp, &st, 0) < 0) {
+		if (errno != ENOENT) {
+			return (set_os_error("repo_make_bare:fstatat"));
+		}
+		return (0);
+	}
+
+	char from[PATH_MAX];
+	char to[PATH_MAX];
+	if (snprintf(from, PATH_MAX, "%s/%s", r->rp_name,
+	    HWM_FILE) >= PATH_MAX ||
+	    snprintf(to, PATH_MAX, "%s/%s", tmp, HWM_FILE) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return (set_os_error("repo_make_bare:snprintf:hwm"));
+	}
+	if (renameat(owner_fd, from, owner_fd, to) < 0 && errno != ENOENT) {
+		return (set_os_error("repo_make_bare:renameat:hwm"));
+	}
+	if (snprintf(path, PATH_MAX, "%s/index", tmp) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return (set_os_error("repo_make_bare:snprintf:index"));
+	}
+	if (unlinkat(owner_fd, path, 0) < 0 && errno != ENOENT) {
+		return (set_os_error("repo_make_bare:unlinkat:index"));
+	}
+	git_repository_t *gr;
+	git_config *cfg;
+	if (snprintf(path, PATH_MAX, "%s/%s/%s", stor_path, r->rp_owner,
+	    tmp) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return (set_os_error("repo_make_bare:snprintf:open"));
+	}
+	int error = git_repository_open(&gr, path);
+	if (error < 0) {
+		return (error);
+	}
+	error = git_repository_config(&cfg, gr);
+	if (error == 0) {
+		error = git_config_set_bool(cfg, "core.bare", 1);
+		git_config_free(cfg);
+	}
+	git_repository_free(gr);
+	if (error < 0) {
+		return (error);
+	}
+
+	error = remove_tree(owner_fd, r->rp_name);
+	if (error < 0) {
+		return (error);
+	}
+	if (renameat(owner_fd, tmp, owner_fd, r->rp_name) < 0) {
+		return (set_os_error("repo_make_bare:renameat"));
+	}
+	return (0);
+}
+
+/*
+ * Records the tips of the remote-tracking refs in `rp_tips`. A repository
+ * that has no remote-tracking refs (i.e. one that we didn't clone) falls back
+ * to HEAD.
+ */
+int
+repo_collect_tips(repo_t *r)
+{
+	git_reference_iterator *it;
+	git_reference *ref;
+	int error = git_reference_iterator_glob_new(&it, r->rp_git, TIPS_GLOB);
+	if (error < 0) {
+		return (error);
+	}
+	while ((error = git_reference_next(&ref, it)) == 0) {
+		/* origin/HEAD is symbolic, and duplicates another ref */
+		if (git_reference_type(ref) == GIT_REF_OID) {
+			hwm_append(&r->rp_tips, &r->rp_ntips,
+			    git_reference_name(ref), git_reference_target(ref));
+		}
+		git_reference_free(ref);
+	}
+	git_reference_iterator_free(it);
+	if (error != GIT_ITEROVER) {
+		return (error);
+	}
+	if (r->rp_ntips == 0) {
+		git_oid head;
+		error = git_reference_name_to_id(&head, r->rp_git, "HEAD");
+		if (error < 0) {
+			return (error);
+		}
+		hwm_append(&r->rp_tips, &r->rp_ntips, "HEAD", &head);
+	}
+	return (0);
+}
+
+/*
+ * Opens the repository and prepares a history walk over it. If `incremental`
+ * is set, the walk excludes everything reachable from the saved high-water
+ * marks. Returns non-zero if the repository can't be walked, in which case
+ * the caller should skip it.
+ */
+int
+repo_walk_begin(repo_t *r, int incremental)
+{
+	if (r->rp_vcs != GIT) {
+		fprintf(stderr, "History not supported on %s, skipping.\n",
+		    r->rp_url);
+		return (-1);
+	}
+	char repo_path[PATH_MAX];
+	repo_get_path(r, repo_path);
+	int error = git_repository_open(&r->rp_git, repo_path);
+	if (error < 0) {
+		goto fail;
+	}
+	error = git_revwalk_new(&r->rp_walk, r->rp_git);
+	if (error < 0) {
+		goto fail;
+	}
+	git_revwalk_sorting(r->rp_walk, GIT_SORT_TIME);
+	error = repo_collect_tips(r);
+	if (error < 0) {
+		goto fail;
+	}
+	int i = 0;
+	while (i < r->rp_ntips) {
+		git_oid oid;
+		sha1_to_oid(&oid, &r->rp_tips[i].rh_sha1);
+		error = git_revwalk_push(r->rp_walk, &oid);
+		if (error < 0) {
+			goto fail;
+		}
+		i++;
+	}
+	r->rp_batch = diff_batch_create(repo_path);
+	if (r->rp_batch == NULL) {
+		error = -1;
+		goto fail;
+	}
+	r->rp_walkerr = 0;
+	r->rp_walkdone = 0;
+	r->rp_incremental = incremental;
+	if (incremental) {
+		repo_hwm_load(r);
+		i = 0;
+		while (i < r->rp_nhwm) {
+			git_oid oid;
+			sha1_to_oid(&oid, &r->rp_hwm[i].rh_sha1);
+			/*
+			 * A saved commit may have vanished (i.e. after a force
+			 * push). That's harmless, we just walk a bit more.
+			 */
+			(void) git_revwalk_hide(r->rp_walk, &oid);
+			i++;
+		}
+	}
+	return (0);
+
+fail:;
+	const git_error *e = giterr_last();
+	fprintf(stderr, "Can't walk %s/%s, skipping: %s\n", r->rp_owner,
+	    r->rp_name, e == NULL ? "unknown error" : e->message);
+	repo_walk_end(r, 0);
+	return (-1);
+}
+
+/*
+ * Tears down the history walk. If the walk ran to completion, we hang on to
+ * the tips we started from, which become the new high-water marks once the
+ * snapshot has been saved (see repo_marks_foldr()).
+ */
+void
+repo_walk_end(repo_t *r, int completed)
+{
+	if (!completed || r->rp_walkerr) {
+		hwm_destroy(r->rp_tips, r->rp_ntips);
+		r->rp_tips = NULL;
+		r->rp_ntips = 0;
+	}
+	if (r->rp_batch != NULL) {
+		diff_batch_destroy(r->rp_batch);
+		r->rp_batch = NULL;
+	}
+	r->rp_incremental = 0;
+	if (r->rp_walk != NULL) {
+		git_revwalk_free(r->rp_walk);
+		r->rp_walk = NULL;
+	}
+	if (r->rp_git != NULL) {
+		git_repository_free(r->rp_git);
+		r->rp_git = NULL;
+	}
+}
+
+/*
+ * Records the git error that ended the walk. We don't exit, the walk just
+ * ends early, and the repository's high-water marks stay where they were.
+ */
+repo_commit_t *
+walk_git_error(repo_t *r, int error)
+{
+	const git_error *e = giterr_last();
+	fprintf(stderr, "Error %d walking %s/%s: %s\n", error, r->rp_owner,
+	    r->rp_name, e == NULL ? "unknown error" : e->message);
+	r->rp_walkerr = 1;
+	return (NULL);
+}
+
+/*
+ * Walks ahead, filling the repository's diff batch with the commits in the
+ * date range, and then diffs the whole batch in parallel. Returns non-zero if
+ * the walk hit an error.
+ */
+int
+repo_fill_batch(repo_t *r)
+{
+	git_oid oid;
+	git_commit *gc = NULL;
+	diff_slot_t *ds;
+	int error;
+	uint64_t nwalked = 0;
+	stats_begin(SP_WALK);
+	while ((ds = diff_batch_slot(r->rp_batch)) != NULL) {
+		error = git_revwalk_next(&oid, r->rp_walk);
+		if (error == GIT_ITEROVER) {
+			r->rp_walkdone = 1;
+			diff_batch_unslot(r->rp_batch);
+			break;
+		}
+		if (error < 0) {
+			goto fail;
+		}
+		error = git_commit_lookup(&gc, r->rp_git, &oid);
+		if (error < 0) {
+			goto fail;
+		}
+		int64_t ctime = git_commit_time(gc);
+		if (!r->rp_incremental && ctime > constraints.cn_end_date) {
+			git_commit_free(gc);
+			diff_batch_unslot(r->rp_batch);
+			continue;
+		}
+		if (!r->rp_incremental &&
+		    ctime < constraints.cn_start_date) {
+			git_commit_free(gc);
+			r->rp_walkdone = 1;
+			diff_batch_unslot(r->rp_batch);
+			break;
+		}
+		repo_commit_t *c = &ds->ds_commit;
+		const git_signature *sig = git_commit_author(gc);
+		sha1_from_oid(&c->rc_sha1, &oid);
+		c->rc_repo = r->rp_id;
+		c->rc_time = ctime;
+		c->rc_author = ilm_intern_str(sig->name);
+		c->rc_email = ilm_intern_str(sig->email);
+		int np = git_commit_parentcount(gc);
+		sha1_t *parents = diff_slot_parents(r->rp_batch, ds, np);
+		int i = 0;
+		while (i < np) {
+			sha1_from_oid(&parents[i], git_commit_parent_id(gc, i));
+			i++;
+		}
+		git_commit_free(gc);
+		nwalked++;
+	}
+	stats_count(SP_WALK, nwalked, 0);
+	stats_end(SP_WALK);
+	stats_begin(SP_DIFF);
+	diff_batch_run(r->rp_batch);
+	stats_count(SP_DIFF, nwalked, 0);
+	stats_end(SP_DIFF);
+	return (0);
+
+fail:
+	stats_count(SP_WALK, nwalked, 0);
+	stats_end(SP_WALK);
+	diff_batch_unslot(r->rp_batch);
+	(void) walk_git_error(r, error);
+	r->rp_walkdone = 1;
+	return (error);
+}
+
+/*
+ * Returns the next commit. We don't want to load all of the commits into
+ * memory, we just stream them, and add their information to the graphs,
+ * mentioned in `illumetrics_impl.h`. The first commit retrieved is the commit
+ * made closest to constraints.cn_end_date. Similarly the last commit
+ * retrieved is the commit made closest to constraints.cn_start_date. If there
+ * are no commits in that range we return NULL. If we reach the end of the
+ * commits in that range, we return NULL.
+ *
+ * The walk goes from the newest commit to the oldest, so commits newer than
+ * the end date are skipped before we pay for their diffs, and the first commit
+ * older than the start date ends the walk. Commits are walked a batch at a
+ * time, and each batch is diffed in parallel (see illumetrics_diff.c), but
+ * they are still returned in walk order. The returned repo_commit_t, and the
+ * arrays of file IDs and parents returned through `files` and `parents`,
+ * belong to the walk and are overwritten once the batch is refilled.
+ * Incremental walks ignore the date range, since they have to ingest
+ * everything new.
+ */
+repo_commit_t *
+repo_get_next_commit(repo_t *r, ilm_id_t **files, sha1_t **parents,
+    uint32_t *nparents)
+{
+	diff_slot_t *ds;
+	switch (r->rp_vcs) {
+
+	case GIT:
+		ds = diff_batch_next(r->rp_batch);
+		if (ds == NULL) {
+			if (r->rp_walkdone || repo_fill_batch(r) != 0) {
+				return (NULL);
+			}
+			ds = diff_batch_next(r->rp_batch);
+			if (ds == NULL) {
+				return (NULL);
+			}
+		}
+		if (ds->ds_error < 0) {
+			return (walk_git_error(r, ds->ds_error));
+		}
+		*files = ds->ds_files;
+		*parents = ds->ds_parents;
+		*nparents = ds->ds_nparents;
+		return (&ds->ds_commit);
+		break;
+	case HG:
+		return (NULL);
+		break;
+	case SVN:
+		return (NULL);
+		break;
+	case CVS:
+		return (NULL);
+		break;
+	case SCCS:
 		return (NULL);
 		break;
 	}
@@ -933,21 +2062,88 @@ repo_get_next_commit(repo_t *r)
 
 
 /*
- * This function is currently serial -- we pull repos one-by-one. Would be cool
- * if we could parallelize this.
+ * Pulling is done by a bounded pool of worker threads (see `-j`). The repos
+ * slablist is first flattened into an array, and each worker repeatedly
+ * claims the next unclaimed repository until there are none left. This way a
+ * huge repository like illumos-gate only ties up one worker, while the others
+ * get through the small repositories.
+ *
+ * Forks borrow objects from their upstreams, so the pool makes two rounds
+ * over the array: the first one pulls everything but the forks, and the
+ * second one pulls the forks.
  */
+typedef struct pull_pool {
+	repo_t		**pp_repos;
+	pull_result_t	*pp_results;
+	uint64_t	pp_nrepos;
+	uint64_t	pp_next; /* next unclaimed repo */
+	int		pp_forks; /* bool, this round pulls the forks */
+	pthread_mutex_t	pp_lock;
+} pull_pool_t;
 
 selem_t
-pull_foldr(selem_t ignore, selem_t *e, uint64_t sz)
+pull_foldr(selem_t zpool, selem_t *e, uint64_t sz)
 {
-	repo_t *r = NULL;
+	pull_pool_t *pp = zpool.sle_p;
 	uint64_t i = 0;
 	while (i < sz) {
-		r = e[i].sle_p;
-		repo_pull(r);
+		pp->pp_repos[pp->pp_nrepos] = e[i].sle_p;
+		pp->pp_nrepos++;
 		i++;
 	}
-	return (ignore);
+	return (zpool);
+}
+
+void *
+pull_worker(void *arg)
+{
+	pull_pool_t *pp = arg;
+	while (1) {
+		(void) pthread_mutex_lock(&pp->pp_lock);
+		uint64_t i = pp->pp_next;
+		pp->pp_next++;
+		(void) pthread_mutex_unlock(&pp->pp_lock);
+		if (i >= pp->pp_nrepos) {
+			break;
+		}
+		repo_t *r = pp->pp_repos[i];
+		if ((r->rp_upstream != NULL) != pp->pp_forks) {
+			continue;
+		}
+		repo_pull(r, &pp->pp_results[i]);
+	}
+	return (NULL);
+}
+
+char *pull_status_str[] = {"cloned", "fetched", "skipped", "FAILED"};
+
+/*
+ * Prints one line per repository, in the order of the repos slablist, and
+ * returns the number of failed pulls.
+ */
+uint64_t
+print_pull_summary(pull_pool_t *pp)
+{
+	uint64_t failed = 0;
+	uint64_t i = 0;
+	printf("\n%-8s %10s %12s %9s  %s\n", "STATUS", "OBJECTS", "BYTES",
+	    "SECONDS", "REPOSITORY");
+	while (i < pp->pp_nrepos) {
+		pull_result_t *pr = &pp->pp_results[i];
+		printf("%-8s %10llu %12llu %9.2f  %s/%s\n",
+		    pull_status_str[pr->pr_status],
+		    (unsigned long long)pr->pr_objects,
+		    (unsigned long long)pr->pr_bytes,
+		    (double)pr->pr_nsec / 1e9,
+		    pr->pr_repo->rp_owner, pr->pr_repo->rp_name);
+		if (pr->pr_status == PS_FAILED) {
+			printf("%8s error %d: %s\n", "", pr->pr_error,
+			    pr->pr_msg);
+			failed++;
+		}
+		i++;
+	}
+	return (failed);
 }
 
 /*
@@ -957,8 +2153,57 @@ pull_foldr(selem_t ignore, selem_t *e, uint64_t sz)
 void
 update_all_repos()
 {
-	selem_t ignore;
-	(void)slablist_foldr(repos, pull_foldr, ignore);
+	pull_pool_t pp;
+	uint64_t nrepos = slablist_get_elems(repos);
+	bzero(&pp, sizeof (pp));
+	pp.pp_repos = ilm_mk_zbuf(sizeof (repo_t *) * nrepos);
+	pp.pp_results = ilm_mk_zbuf(sizeof (pull_result_t) * nrepos);
+	(void) pthread_mutex_init(&pp.pp_lock, NULL);
+	selem_t zpool;
+	zpool.sle_p = &pp;
+	(void) slablist_foldr(repos, pull_foldr, zpool);
+
+	int64_t njobs = constraints.cn_jobs;
+	if (njobs < 1) {
+		njobs = 1;
+	}
+	if ((uint64_t)njobs > nrepos) {
+		njobs = nrepos;
+	}
+	pthread_t *workers = ilm_mk_zbuf(sizeof (pthread_t) * njobs);
+	int round = 0;
+	while (round < 2) {
+		pp.pp_forks = round;
+		pp.pp_next = 0;
+		int64_t i = 0;
+		while (i < njobs) {
+			int pc = pthread_create(&workers[i], NULL, pull_worker,
+			    &pp);
+			if (pc != 0) {
+				fprintf(stderr,
+				    "update_all_repos:pthread_create: %s\n",
+				    strerror(pc));
+				exit(-1);
+			}
+			i++;
+		}
+		i = 0;
+		while (i < njobs) {
+			(void) pthread_join(workers[i], NULL);
+			i++;
+		}
+		round++;
+	}
+
+	uint64_t failed = print_pull_summary(&pp);
+	if (failed > 0) {
+		fprintf(stderr, "%llu of %llu repositories failed to pull.\n",
+		    (unsigned long long)failed, (unsigned long long)nrepos);
+	}
+	(void) pthread_mutex_destroy(&pp.pp_lock);
+	ilm_rm_buf(workers, sizeof (pthread_t) * njobs);
+	ilm_rm_buf(pp.pp_results, sizeof (pull_result_t) * nrepos);
+	ilm_rm_buf(pp.pp_repos, sizeof (repo_t *) * nrepos);
 }
 
 /*
@@ -971,91 +2216,696 @@ purge_unrecognized_repos()
 }
 
 
+#ifdef LIBGRAPH
+/*
+ * The graph behind each graph_id_t. Nothing reads these; the analyses read the
+ * edge logs. Building with -D LIBGRAPH populates them anyway, for poking at
+ * libgraph itself, at the cost of a slab list insert per edge.
+ */
+lg_graph_t *graph_lg[GR_NGRAPHS];
+#endif
+
+/*
+ * Adds the edge to the graph's edge log.
+ */
+void
+ilm_connect(graph_id_t g, gelem_t src, gelem_t dst)
+{
+#ifdef LIBGRAPH
+	lg_connect(graph_lg[g], src, dst);
+#endif
+	graph_log_edge(g, src.ge_u, dst.ge_u);
+	stats_count(SP_GRAPHS, 0, 1);
+	ILLUMETRICS_EDGE_ADD(g, src.ge_u, dst.ge_u);
+}
+
+/* the trie node of `-f`, or 0 (the root) if there is none */
+uint32_t subtree_node;
+/* scratch space for the files of a commit that are below `-f` */
+ilm_vec_t subtree_files;
+
+typedef struct dir_edge_arg {
+	gelem_t	de_author;
+	gelem_t	de_commit;
+} dir_edge_arg_t;
+
+void
+dir_edges_cb(uint32_t dir, void *arg)
+{
+	dir_edge_arg_t *de = arg;
+	gelem_t d;
+	d.ge_u = NODE_KEY(NK_DIR, dir);
+	ilm_connect(GR_DIR2COMMIT, d, de->de_commit);
+	ilm_connect(GR_DIR2AUTHOR, d, de->de_author);
+}
+
+/*
+ * Drops the files that aren't below `-f`. Returns the number of files left,
+ * which are in `*files`.
+ */
+uint32_t
+filter_subtree(ilm_id_t **files, uint32_t nfiles)
+{
+	if (subtree_node == 0) {
+		return (nfiles);
+	}
+	subtree_files.v_len = 0;
+	uint32_t j = 0;
+	while (j < nfiles) {
+		if (trie_is_under(trie_file((*files)[j]), subtree_node)) {
+			ilm_id_t *f = ilm_vec_append(&subtree_files, 1);
+			*f = (*files)[j];
+		}
+		j++;
+	}
+	*files = subtree_files.v_buf;
+	return (subtree_files.v_len);
+}
+
 /*
  * Graph Construction. So we've gone over which graphs we want to construct, in
  * `illumetrics_impl.h`. Now we want to actually construct these graphs. What
  * we essentially do is go over the stream of commits using
  * `repo_get_next_commit`, and add to each graph using the information in each
  * commit.
+ *
+ * If `zincr` is set, the graphs were loaded from a snapshot, and we only walk
+ * what's newer than that.
  */
 selem_t
-build_graphs_foldr(selem_t ignored, selem_t *e, uint64_t sz)
+build_graphs_foldr(selem_t zincr, selem_t *e, uint64_t sz)
 {
 	uint64_t i = 0;
 	while (i < sz) {
 		repo_t *r = e[i].sle_p;
-		repo_commit_t *c = repo_get_next_commit(r);
-		/* We add an email -> author edge */
-		gelem_t author;
-		gelem_t email;
-		author.ge_p = c->rc_author;
-		email.ge_p = c->rc_email;
-		lg_connect(email2author, email, author);
-		/* We add a author -> commit edge */
-		gelem_t commit;
-		commit.ge_p = c->rc_sha1;
-		/* We add a file-mod -> commit edge */
-		int j = 0;
-		gelem_t file;
-		/*
-		 * XXX Do we want to include absolute paths to single files
-		 * only? Or do we want to break up the path into super paths?
-		 * For example say we modify foo/bar/qwe/asd.
-		 *
-		 * We can either do:
-		 *	foo/bar/qwe/asd -> author
-		 * or:
-		 *	foo/bar/qwe/asd -> author
-		 *	foo/bar/qwe-> author
-		 *	foo/bar/ -> author
-		 *	foo/ -> author
-		 *
-		 * The former is more compact, and we know that every
-		 * source-component of the edge is a file (and not _maybe_ a
-		 * directory). We can also derive the latter from the former
-		 * should the need arise.
-		 *
-		 * In fact we want 2 graphs:
-		 *	- A graph with file mods
-		 *	- A graph with directory mods
-		 * This way there is no ambiguity.
-		 *
-		 * TODO: Everything I just wrote above.
-		 */
+		if (constraints.cn_repo != NULL && constraints.cn_repo != r) {
+			i++;
+			continue;
+		}
+		if (repo_walk_begin(r, (int)zincr.sle_u) != 0) {
+			i++;
+			continue;
+		}
+		repo_commit_t *c;
+		ilm_id_t *files;
+		sha1_t *parents;
+		uint32_t np;
+		while ((c = repo_get_next_commit(r, &files, &parents, &np)) !=
+		    NULL) {
+			/* each commit counts once, in the first repo */
+			if (!cset_add(&c->rc_sha1, c->rc_repo, parents, np)) {
+				continue;
+			}
+			c->rc_nfiles = filter_subtree(&files, c->rc_nfiles);
+			if (subtree_node != 0 && c->rc_nfiles == 0) {
+				continue;
+			}
+			uint32_t cidx = cstore_add(c, files);
+			stats_count(SP_GRAPHS, 1, 0);
+			ILLUMETRICS_COMMIT_INGESTED(c->rc_repo,
+			    (uint8_t *)&c->rc_sha1, c->rc_nfiles);
+			/* We add an email -> author edge */
+			gelem_t author;
+			gelem_t email;
+			author.ge_u = NODE_KEY(NK_AUTHOR, c->rc_author);
+			email.ge_u = NODE_KEY(NK_EMAIL, c->rc_email);
+			ilm_connect(GR_EMAIL2AUTHOR, email, author);
+			/* We add a author -> commit edge */
+			gelem_t commit;
+			commit.ge_u = NODE_KEY(NK_COMMIT, cidx);
+			ilm_connect(GR_AUTHOR2COMMIT, author, commit);
+			deg_add_commit(c->rc_author);
+			/*
+			 * We add file-mod -> commit and file-mod -> author
+			 * edges.
+			 */
+			uint32_t j = 0;
+			gelem_t file;
+			dir_edge_arg_t de;
+			de.de_author = author;
+			de.de_commit = commit;
+			uint32_t stamp = trie_new_stamp();
+			/*
+			 * Do we want to include absolute paths to single files
+			 * only? Or do we want to break up the path into super
+			 * paths? For example say we modify foo/bar/qwe/asd.
+			 *
+			 * We can either do:
+			 *	foo/bar/qwe/asd -> author
+			 * or:
+			 *	foo/bar/qwe/asd -> author
+			 *	foo/bar/qwe-> author
+			 *	foo/bar/ -> author
+			 *	foo/ -> author
+			 *
+			 * The former is more compact, and we know that every
+			 * source-component of the edge is a file (and not
+			 * _maybe_ a directory). We can also derive the latter
+			 * from the former should the need arise.
+			 *
+			 * In fact we want 2 graphs:
+			 *	- A graph with file mods
+			 *	- A graph with directory mods
+			 * This way there is no ambiguity.
+			 *
+			 * The directories come from the path trie (see
+			 * illumetrics_trie.c), which visits each directory
+			 * above the commit's files once, without splitting a
+			 * single path string.
+			 */
+			while (j < c->rc_nfiles) {
+				file.ge_u = NODE_KEY(NK_FILE, files[j]);
+				ilm_connect(GR_FILE2COMMIT, file, commit);
+				ilm_connect(GR_FILE2AUTHOR, file, author);
+				deg_add_file(c->rc_author, files[j]);
+				trie_stamp_dirs(trie_file(files[j]), stamp,
+				    dir_edges_cb, &de);
+				j++;
+			}
+		}
+		repo_walk_end(r, 1);
+		i++;
+	}
+	return (zincr);
+}
+
+/*
+ * Once a snapshot has been saved, the tips of every completed walk become
+ * that repository's high-water marks. If `zsave` isn't set, there is no
+ * snapshot, and the tips are dropped.
+ */
+selem_t
+repo_marks_foldr(selem_t zsave, selem_t *e, uint64_t sz)
+{
+	uint64_t i = 0;
+	while (i < sz) {
+		repo_t *r = e[i].sle_p;
+		if (r->rp_ntips > 0 && zsave.sle_u) {
+			repo_hwm_save(r);
+		}
+		hwm_destroy(r->rp_tips, r->rp_ntips);
+		r->rp_tips = NULL;
+		r->rp_ntips = 0;
+		i++;
+	}
+	return (zsave);
+}
+
+/*
+ * The snapshot holds the graphs of every commit in every repository. If the
+ * graphs are restricted to a repository, a subtree, or a date range, we build
+ * them from scratch, and don't touch the snapshot.
+ */
+int
+snap_wanted()
+{
+	return (constraints.cn_repo == NULL && constraints.cn_subtree == NULL &&
+	    constraints.cn_start_date == INT64_MIN &&
+	    constraints.cn_end_date == INT64_MAX);
+}
+
+/*
+ * Builds the graphs. If there is a snapshot, queries just load it, and `pull`
+ * loads it and walks the commits that are newer than it. Whenever we walk,
+ * we save a new snapshot.
+ */
+void
+construct_graphs()
+{
+#ifdef LIBGRAPH
+	int g = 0;
+	while (g < GR_NGRAPHS) {
+		graph_lg[g] = lg_create_digraph();
+		g++;
+	}
+#endif
+	ilm_vec_init(&subtree_files, sizeof (ilm_id_t));
+	int persist = snap_wanted();
+	int loaded = persist && snap_load() == 0;
+	if (loaded && constraints.cn_arg != PULL) {
+		return;
+	}
+	if (constraints.cn_subtree != NULL) {
+		subtree_node = trie_insert(constraints.cn_subtree);
+	}
+	selem_t zincr;
+	zincr.sle_u = loaded;
+	slablist_foldr(repos, build_graphs_foldr, zincr);
+	cset_report();
+	if (persist) {
+		snap_save();
+	}
+	selem_t zsave;
+	zsave.sle_u = persist;
+	slablist_foldr(repos, repo_marks_foldr, zsave);
+}
+
+/*
+ * Counts a commit against a directory that it touched.
+ */
+void
+hist_count_cb(uint32_t dir, void *arg)
+{
+	uint64_t *ncommits = arg;
+	ncommits[dir]++;
+}
+
+/*
+ * Prints a histogram of the work done below `-f` (or below the top of the
+ * repositories), with one bucket per subdirectory. If `-a` was given, only
+ * that author's commits are counted. For each bucket we print the number of
+ * distinct commits that touched it, and the number of file modifications in
+ * it. The former is counted by stamping the trie, the latter by rolling the
+ * per-file counts up the trie.
+ */
+void
+print_dir_histogram()
+{
+	uint32_t nnodes = trie_nnodes();
+	uint64_t *ncommits = ilm_mk_zbuf(sizeof (uint64_t) * nnodes);
+	uint64_t *nmods = ilm_mk_zbuf(sizeof (uint64_t) * nnodes);
+	ilm_id_t aid = 0;
+	if (constraints.cn_author != NULL) {
+		aid = ilm_intern_lookup(constraints.cn_author);
+		if (aid == 0) {
+			fprintf(stderr, "No commits by %s.\n",
+			    constraints.cn_author);
+			exit(-1);
+		}
+	}
+	uint32_t i = 0;
+	while (i < cstore_count()) {
+		repo_commit_t *c = cstore_get(i);
+		i++;
+		if (aid != 0 && c->rc_author != aid && c->rc_email != aid) {
+			continue;
+		}
+		ilm_id_t *files = cstore_files(c);
+		uint32_t stamp = trie_new_stamp();
+		uint32_t j = 0;
 		while (j < c->rc_nfiles) {
-			file.ge_p = c->rc_files[j];
-			lg_connect(file2commit, file, commit);
-			lg_connect(file2author, file, author);
+			uint32_t leaf = trie_file(files[j]);
+			ncommits[leaf]++;
+			nmods[leaf]++;
+			trie_stamp_dirs(leaf, stamp, hist_count_cb, ncommits);
 			j++;
 		}
-		/* We add a file-mod -> author edge */
+	}
+	trie_rollup(nmods);
+
+	uint64_t max = 1;
+	uint32_t ch = trie_node(subtree_node)->pn_child;
+	while (ch != 0) {
+		if (nmods[ch] > max) {
+			max = nmods[ch];
+		}
+		ch = trie_node(ch)->pn_sibling;
+	}
+	char path[PATH_MAX];
+	trie_path(subtree_node, path);
+	printf("%s/\n", path);
+	ch = trie_node(subtree_node)->pn_child;
+	while (ch != 0) {
+		if (nmods[ch] > 0) {
+			int bar = (int)((nmods[ch] * 40) / max);
+			printf("  %-32s %8llu %8llu  %.*s\n",
+			    ilm_id_str(trie_node(ch)->pn_name),
+			    (unsigned long long)ncommits[ch],
+			    (unsigned long long)nmods[ch], bar,
+			    "########################################");
+		}
+		ch = trie_node(ch)->pn_sibling;
+	}
+	ilm_rm_buf(ncommits, sizeof (uint64_t) * nnodes);
+	ilm_rm_buf(nmods, sizeof (uint64_t) * nnodes);
+}
+
+
+/*
+ * Work. The `author` and `repository` verbs measure work in the quantum given
+ * by `-w`: commits, file modifications, or lines added plus lines removed.
+ * Line counts come from the numstat cache (see illumetrics_numstat.c), which
+ * is filled in first, for the commits that we are going to look at.
+ */
+typedef struct work {
+	uint64_t	wk_commits;
+	uint64_t	wk_files;
+	uint64_t	wk_added;
+	uint64_t	wk_removed;
+	ilm_id_t	wk_author;
+} work_t;
+
+void
+work_add(work_t *w, repo_commit_t *c)
+{
+	w->wk_commits++;
+	w->wk_files += c->rc_nfiles;
+	if (constraints.cn_qwork == QW_LINE) {
+		(void) numstat_lines(c, &w->wk_added, &w->wk_removed);
+	}
+}
+
+uint64_t
+work_value(const work_t *w)
+{
+	switch (constraints.cn_qwork) {
+	case QW_FILE:
+		return (w->wk_files);
+	case QW_LINE:
+		return (w->wk_added + w->wk_removed);
+	default:
+		return (w->wk_commits);
+	}
+}
+
+int
+work_cmp(const void *a, const void *b)
+{
+	uint64_t va = work_value(a);
+	uint64_t vb = work_value(b);
+	if (va != vb) {
+		return (va > vb ? -1 : 1);
+	}
+	ilm_id_t aa = ((const work_t *)a)->wk_author;
+	ilm_id_t ab = ((const work_t *)b)->wk_author;
+	return (aa < ab ? -1 : aa > ab);
+}
+
+int
+work_in_range(repo_commit_t *c)
+{
+	return (c->rc_time >= constraints.cn_start_date &&
+	    c->rc_time <= constraints.cn_end_date);
+}
+
+/*
+ * Prints the work done by the `-a` author.
+ */
+void
+author_work()
+{
+	ilm_id_t aid = ilm_intern_lookup(constraints.cn_author);
+	if (aid == 0) {
+		fprintf(stderr, "No commits by %s.\n", constraints.cn_author);
+		exit(-1);
+	}
+	if (constraints.cn_qwork == QW_LINE) {
+		numstat_prepare(aid);
+	}
+	work_t w;
+	bzero(&w, sizeof (work_t));
+	uint32_t i = 0;
+	while (i < cstore_count()) {
+		repo_commit_t *c = cstore_get(i);
+		i++;
+		if ((c->rc_author == aid || c->rc_email == aid) &&
+		    work_in_range(c)) {
+			work_add(&w, c);
+		}
+	}
+	printf("%s: %llu commits, %llu file modifications",
+	    constraints.cn_author, (unsigned long long)w.wk_commits,
+	    (unsigned long long)w.wk_files);
+	if (constraints.cn_qwork == QW_LINE) {
+		printf(", %llu lines added, %llu lines removed",
+		    (unsigned long long)w.wk_added,
+		    (unsigned long long)w.wk_removed);
+	}
+	printf("\n");
+}
+
+/*
+ * Prints the `-n` authors who did the most work in the repositories (or just
+ * in the `-r` repository).
+ */
+void
+repository_work()
+{
+	if (constraints.cn_qwork == QW_LINE) {
+		numstat_prepare(0);
+	}
+	uint32_t nids = ilm_intern_count() + 1; /* ID 0 included */
+	work_t *w = ilm_mk_zbuf(sizeof (work_t) * nids);
+	uint32_t i = 0;
+	while (i < cstore_count()) {
+		repo_commit_t *c = cstore_get(i);
+		i++;
+		if (work_in_range(c)) {
+			work_add(&w[c->rc_author], c);
+		}
+	}
+	/* pack the authors with work to the front */
+	uint32_t n = 0;
+	i = 0;
+	while (i < nids) {
+		if (w[i].wk_commits > 0) {
+			w[n] = w[i];
+			w[n].wk_author = i;
+			n++;
+		}
+		i++;
+	}
+	if (n > 0) {
+		qsort(w, n, sizeof (work_t), work_cmp);
+	}
+	uint32_t top = constraints.cn_num;
+	if (top == 0 || top > n) {
+		top = n;
+	}
+	i = 0;
+	while (i < top) {
+		printf("%6u %12llu  %s", i + 1,
+		    (unsigned long long)work_value(&w[i]),
+		    ilm_id_str(w[i].wk_author));
+		if (constraints.cn_qwork == QW_LINE) {
+			printf(" (+%llu -%llu)",
+			    (unsigned long long)w[i].wk_added,
+			    (unsigned long long)w[i].wk_removed);
+		}
+		printf("\n");
 		i++;
 	}
-	return (ignored);
+	ilm_rm_buf(w, sizeof (work_t) * nids);
 }
 
+/*
+ * Lists the repositories. A commit is in every repository whose history has
+ * it, but it's only counted toward work and centrality in the first one it
+ * was seen in, which is the first one in the lists that has it.
+ */
 void
-construct_graphs()
+repository_list()
 {
-	email2author = lg_create_digraph();
-	author2commit = lg_create_digraph();
-	file2author= lg_create_digraph();
-	file2commit = lg_create_digraph();
-	selem_t ignored;
-	slablist_foldr(repos, build_graphs_foldr, ignored);
+	uint64_t *ncommits = ilm_mk_zbuf(sizeof (uint64_t) * (nrepos + 1));
+	uint64_t *nfirst = ilm_mk_zbuf(sizeof (uint64_t) * (nrepos + 1));
+	uint64_t *nshared = ilm_mk_zbuf(sizeof (uint64_t) * (nrepos + 1));
+	cset_repo_counts(ncommits, nfirst, nshared);
+	printf("%10s %10s %10s  %s\n", "COMMITS", "FIRST", "SHARED",
+	    "REPOSITORY");
+	uint32_t i = 0;
+	while (i < nrepos) {
+		repo_t *r = repo_table[i];
+		printf("%10llu %10llu %10llu  %s/%s\n",
+		    (unsigned long long)ncommits[i],
+		    (unsigned long long)nfirst[i],
+		    (unsigned long long)nshared[i], r->rp_owner, r->rp_name);
+		i++;
+	}
+	ilm_rm_buf(ncommits, sizeof (uint64_t) * (nrepos + 1));
+	ilm_rm_buf(nfirst, sizeof (uint64_t) * (nrepos + 1));
+	ilm_rm_buf(nshared, sizeof (uint64_t) * (nrepos + 1));
 }
 
+/*
+ * Centrality. Centrality is computed on the author <-> author projection of
+ * the file -> author graph (see illumetrics_proj.c). We report the hub files
+ * that were left out of the projection, so that `-H` can be tuned. With `-W`,
+ * it's computed on the graph of modifications that are close in time instead
+ * (see illumetrics_window.c), which leaves out the same hubs.
+ */
+#define	HUB_REPORT_SZ	10
+
+/*
+ * Returns the vertex of the author named by `-a` in an author graph, which may
+ * be given by name or by email.
+ */
+uint32_t
+author_vertex(csr_t *g, char *who)
+{
+	ilm_id_t id = ilm_intern_lookup(who);
+	if (id == 0) {
+		return (CSR_NONE);
+	}
+	uint32_t v = csr_vertex(g, NODE_KEY(NK_AUTHOR, id));
+	if (v != CSR_NONE) {
+		return (v);
+	}
+	/* the log is sorted by source, so find the email's first edge */
+	uint64_t key = NODE_KEY(NK_EMAIL, id);
+	uint64_t n;
+	uint32_t *wt;
+	ilm_edge_t *e = graph_edges(GR_EMAIL2AUTHOR, &n, &wt);
+	uint64_t lo = 0;
+	uint64_t hi = n;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (e[mid].ed_src < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == n || e[lo].ed_src != key) {
+		return (CSR_NONE);
+	}
+	return (csr_vertex(g, e[lo].ed_dst));
+}
+
+/*
+ * Lists the authors within `-d` hops of the `-a` author in `g`, with their
+ * distance and the weight of the heaviest shortest path to each. The weights of
+ * `g` are in units of 1 / `scale`.
+ */
+void
+neighborhood(csr_t *g, uint32_t scale)
+{
+	uint32_t v = author_vertex(g, constraints.cn_author);
+	if (v == CSR_NONE) {
+		fprintf(stderr, "%s shares no files with anyone.\n",
+		    constraints.cn_author);
+		exit(-1);
+	}
+	hood_t *hd = hood_create(g);
+	(void) hood_query(hd, v, (uint32_t)constraints.cn_dist);
+	hood_print(hd, constraints.cn_num, scale);
+	hood_destroy(hd);
+}
+
+void
+centrality()
+{
+	int hood = constraints.cn_author != NULL && constraints.cn_dist > 0;
+	/* activity is counted during ingestion, and needs no projection */
+	if (!hood && constraints.cn_cent == CENT_ACTIVITY) {
+		if (constraints.cn_qwork == QW_LINE) {
+			fprintf(stderr, "Activity is counted in commits or "
+			    "files, not lines.\n");
+			exit(-1);
+		}
+		if (constraints.cn_window > 0) {
+			fprintf(stderr, "Activity doesn't depend on the "
+			    "time between modifications (-W).\n");
+			exit(-1);
+		}
+		deg_print_top(constraints.cn_num, constraints.cn_qwork);
+		return;
+	}
+	proj_t *pj = NULL;
+	csr_t *g;
+	if (constraints.cn_window > 0) {
+		g = win_authors(constraints.cn_window, constraints.cn_hubcap);
+	} else {
+		pj = proj_get(constraints.cn_hubcap);
+		proj_print_hubs(pj, HUB_REPORT_SZ);
+		g = pj->pj_graph;
+	}
+	double *score = ilm_mk_zbuf(sizeof (double) * (g->cs_nverts + 1));
+	double eps;
+	cent_t cent = hood ? CENT_WTF : constraints.cn_cent;
+	ILLUMETRICS_CENT_START(cent, g->cs_nverts);
+	switch (cent) {
+	case CENT_DEGREE:
+	case CENT_STRENGTH:
+		cent_degree(g, cent == CENT_STRENGTH,
+		    constraints.cn_window > 0 ? WIN_SCALE : 1, score);
+		cent_print_top(g, score, constraints.cn_num);
+		break;
+	case CENT_BETWEENESS:
+		eps = cent_betweenness(g, constraints.cn_samples, score);
+		if (eps > 0) {
+			printf("Sampled %lld of %u authors, scores are within "
+			    "+/- %.4f with 95%% confidence.\n",
+			    (long long)constraints.cn_samples, g->cs_nverts,
+			    eps);
+		}
+		cent_print_top(g, score, constraints.cn_num);
+		break;
+	case CENT_CLOSENESS:
+		cent_closeness(g, score);
+		cent_print_top(g, score, constraints.cn_num);
+		break;
+	default:
+		neighborhood(g, constraints.cn_window > 0 ? WIN_SCALE : 1);
+		break;
+	}
+	ILLUMETRICS_CENT_DONE(cent, g->cs_nverts);
+	ilm_rm_buf(score, sizeof (double) * (g->cs_nverts + 1));
+	if (pj != NULL) {
+		proj_destroy(pj);
+	} else {
+		csr_destroy(g);
+	}
+}
+
+/*
+ * Returns the ID of the commit named by `-X` in the commit set.
+ */
+uint32_t
+xpol_commit_id(char *str)
+{
+	git_oid oid;
+	sha1_t sha1;
+	if (strlen(str) != GIT_OID_HEXSZ ||
+	    git_oid_fromstrn(&oid, str, GIT_OID_HEXSZ) < 0) {
+		fprintf(stderr, "%s is not a full commit sha1.\n", str);
+		exit(-1);
+	}
+	sha1_from_oid(&sha1, &oid);
+	uint32_t id = cset_lookup(&sha1);
+	if (id == 0) {
+		fprintf(stderr, "%s is not in any repository.\n", str);
+		exit(-1);
+	}
+	return (id);
+}
 
 /*
  * Cross-polination. We want to calculate crosspolination between repos. This
- * involves mapping merges to commits in other repos. We'll need to specify what's
- * related to what.
- *
- * We also want to calculate where certain commits originated from (Joyent,
- * Nexenta, Delphix).
+ * involves mapping merges to commits in other repos, and finding where
+ * commits originated from (Joyent, Nexenta, Delphix). It's computed on the
+ * commit set (see illumetrics_xpol.c), from the mainline of each repository,
+ * which starts at the saved high-water mark of its master branch (or of its
+ * first branch, if it has no master).
  */
 void
 cross_polination()
 {
-
+	sha1_t **tips = ilm_mk_zbuf(sizeof (sha1_t *) * (nrepos + 1));
+	uint32_t i = 0;
+	while (i < nrepos) {
+		repo_t *r = repo_table[i];
+		repo_hwm_load(r);
+		int j = 0;
+		while (j < r->rp_nhwm) {
+			size_t len = strlen(r->rp_hwm[j].rh_ref);
+			if (len >= 7 && strcmp(r->rp_hwm[j].rh_ref + len - 7,
+			    "/master") == 0) {
+				tips[i] = &r->rp_hwm[j].rh_sha1;
+			}
+			j++;
+		}
+		if (tips[i] == NULL && r->rp_nhwm > 0) {
+			tips[i] = &r->rp_hwm[0].rh_sha1;
+		}
+		i++;
+	}
+	xpol_t *xp = xpol_create(tips);
+	if (constraints.cn_xpol_commit != NULL) {
+		xpol_print_commit(xp, xpol_commit_id(
+		    constraints.cn_xpol_commit));
+	} else {
+		xpol_print(xp);
+	}
+	xpol_destroy(xp);
+	ilm_rm_buf(tips, sizeof (sha1_t *) * (nrepos + 1));
 }
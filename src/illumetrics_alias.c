@@ -0,0 +1,515 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Aliases
+ * =======
+ *
+ * The same person shows up under more than one author name: with and without
+ * a middle initial, in different case, as "Last, First", and so on. The
+ * `aliases` verb groups such names into clusters, in two passes, both of
+ * which merge clusters in a union-find over interned IDs:
+ *
+ *  - Only one author can own an email, so every name is merged with every
+ *  email it committed under. This is the email -> author graph, restricted
+ *  to the commits in the `-D` range. Names that share an email end up in one
+ *  cluster, with full confidence.
+ *
+ *  - The remaining variants are found by comparing names. Comparing every name
+ *  with every other name is quadratic, so names are first put into blocks by
+ *  their normalized surname and first initial, and only names in the same
+ *  block are compared. Two names are merged if they are the same once
+ *  normalized (case and punctuation), if they only differ in the middle
+ *  (first and last tokens match), or if their edit distance is small
+ *  compared to their length.
+ *
+ * The edit distance is Myers' bit-parallel algorithm: the DP column of a name
+ * of up to 64 characters is kept as bit vectors in two words, so a whole
+ * column is updated with a handful of word operations per character of the
+ * other name. The match masks of a name are built once and reused for every
+ * name in its block. Longer names are compared on their first 64 characters.
+ *
+ * Every merge has a confidence, and the confidence of a cluster is that of its
+ * weakest merge.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include <ctype.h>
+#include "illumetrics_impl.h"
+
+#define	ALIAS_MAXLEN		64
+#define	ALIAS_CONF_EMAIL	1.0
+#define	ALIAS_CONF_NORM		0.95 /* same name, up to case and punctuation */
+#define	ALIAS_CONF_CORE		0.9 /* same first and last names */
+#define	ALIAS_MIN_SIM		0.8 /* least 1 - distance / length to merge */
+
+typedef struct alias_name {
+	uint64_t	an_block; /* hash of the surname and first initial */
+	ilm_id_t	an_author;
+	uint32_t	an_norm; /* offset of the normalized name */
+	uint32_t	an_len;
+	uint32_t	an_core; /* offset of the first and last tokens */
+	uint32_t	an_corelen;
+} alias_name_t;
+
+typedef struct alias_member {
+	uint32_t	am_root;
+	int		am_email; /* bool */
+	uint32_t	am_commits;
+	ilm_id_t	am_id;
+} alias_member_t;
+
+typedef struct alias_cluster {
+	uint64_t	ac_first; /* index of its first member */
+	uint32_t	ac_nnames;
+	uint32_t	ac_nemails;
+	uint64_t	ac_commits;
+	double		ac_conf;
+} alias_cluster_t;
+
+typedef struct alias_uf {
+	uint32_t	*au_parent;
+	uint32_t	*au_size;
+	double		*au_conf; /* valid at roots */
+} alias_uf_t;
+
+uint32_t
+alias_find(alias_uf_t *uf, uint32_t x)
+{
+	while (uf->au_parent[x] != x) {
+		/* path halving */
+		uf->au_parent[x] = uf->au_parent[uf->au_parent[x]];
+		x = uf->au_parent[x];
+	}
+	return (x);
+}
+
+void
+alias_union(alias_uf_t *uf, uint32_t a, uint32_t b, double conf)
+{
+	a = alias_find(uf, a);
+	b = alias_find(uf, b);
+	if (a == b) {
+		return;
+	}
+	if (uf->au_size[a] < uf->au_size[b]) {
+		uint32_t t = a;
+		a = b;
+		b = t;
+	}
+	uf->au_parent[b] = a;
+	uf->au_size[a] += uf->au_size[b];
+	if (uf->au_conf[b] < uf->au_conf[a]) {
+		uf->au_conf[a] = uf->au_conf[b];
+	}
+	if (conf < uf->au_conf[a]) {
+		uf->au_conf[a] = conf;
+	}
+}
+
+/*
+ * FNV-1a, for the blocking keys.
+ */
+uint64_t
+alias_hash(const char *s, uint32_t len, uint64_t h)
+{
+	uint32_t i = 0;
+	while (i < len) {
+		h ^= (unsigned char)s[i];
+		h *= 0x100000001b3ULL;
+		i++;
+	}
+	return (h);
+}
+
+/*
+ * Appends the alphanumeric tokens of [p, end) to the `len` bytes in `buf`,
+ * lowercased and separated by single spaces. Returns the new length.
+ */
+uint32_t
+alias_tokens(const char *p, const char *end, char *buf, uint32_t len)
+{
+	int gap = len > 0;
+	while (p < end && len < ALIAS_MAXLEN) {
+		if (isalnum((unsigned char)*p)) {
+			if (gap) {
+				buf[len++] = ' ';
+				gap = 0;
+				if (len == ALIAS_MAXLEN) {
+					break;
+				}
+			}
+			buf[len++] = tolower((unsigned char)*p);
+		} else {
+			gap = len > 0;
+		}
+		p++;
+	}
+	return (len);
+}
+
+/*
+ * Normalizes `name` into `buf` (of ALIAS_MAXLEN bytes), turning "Last, First"
+ * into "first last". Returns the length.
+ */
+uint32_t
+alias_normalize(const char *name, char *buf)
+{
+	const char *end = name + strlen(name);
+	const char *comma = strchr(name, ',');
+	uint32_t len;
+	if (comma == NULL) {
+		len = alias_tokens(name, end, buf, 0);
+	} else {
+		len = alias_tokens(comma + 1, end, buf, 0);
+		len = alias_tokens(name, comma, buf, len);
+	}
+	while (len > 0 && buf[len - 1] == ' ') {
+		len--;
+	}
+	return (len);
+}
+
+/*
+ * Builds the match masks of `a` (of length m <= 64) for alias_edit_dist().
+ */
+void
+alias_peq_set(uint64_t *peq, const char *a, uint32_t m)
+{
+	uint32_t i = 0;
+	while (i < m) {
+		peq[(unsigned char)a[i]] |= 1ULL << i;
+		i++;
+	}
+}
+
+void
+alias_peq_clear(uint64_t *peq, const char *a, uint32_t m)
+{
+	uint32_t i = 0;
+	while (i < m) {
+		peq[(unsigned char)a[i]] = 0;
+		i++;
+	}
+}
+
+/*
+ * Returns the Levenshtein distance between the string whose match masks are
+ * in `peq` (of length m <= 64), and `b`.
+ */
+uint32_t
+alias_edit_dist(uint64_t *peq, uint32_t m, const char *b, uint32_t n)
+{
+	if (m == 0) {
+		return (n);
+	}
+	uint64_t hi = 1ULL << (m - 1);
+	uint64_t pv = ~0ULL;
+	uint64_t mv = 0;
+	uint32_t score = m;
+	uint32_t j = 0;
+	while (j < n) {
+		uint64_t eq = peq[(unsigned char)b[j]];
+		uint64_t xv = eq | mv;
+		uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+		uint64_t ph = mv | ~(xh | pv);
+		uint64_t mh = pv & xh;
+		if (ph & hi) {
+			score++;
+		} else if (mh & hi) {
+			score--;
+		}
+		/* the top row of the DP grows by one per column */
+		ph = (ph << 1) | 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+		j++;
+	}
+	return (score);
+}
+
+int
+alias_name_cmp(const void *a, const void *b)
+{
+	const alias_name_t *na = a;
+	const alias_name_t *nb = b;
+	if (na->an_block != nb->an_block) {
+		return (na->an_block < nb->an_block ? -1 : 1);
+	}
+	return (na->an_author < nb->an_author ? -1 :
+	    na->an_author > nb->an_author);
+}
+
+/*
+ * Returns the confidence that `a` and `b` are the same person, or 0.
+ */
+double
+alias_compare(uint64_t *peq, char *buf, alias_name_t *a, alias_name_t *b)
+{
+	char *sa = buf + a->an_norm;
+	char *sb = buf + b->an_norm;
+	if (a->an_len == b->an_len && bcmp(sa, sb, a->an_len) == 0) {
+		return (ALIAS_CONF_NORM);
+	}
+	if (a->an_corelen == b->an_corelen && bcmp(buf + a->an_core,
+	    buf + b->an_core, a->an_corelen) == 0) {
+		return (ALIAS_CONF_CORE);
+	}
+	uint32_t d = alias_edit_dist(peq, a->an_len, sb, b->an_len);
+	uint32_t len = a->an_len > b->an_len ? a->an_len : b->an_len;
+	double sim = 1.0 - (double)d / len;
+	return (sim >= ALIAS_MIN_SIM ? sim * ALIAS_CONF_CORE : 0);
+}
+
+/*
+ * Normalizes the names of the authors in `in` and puts them into blocks.
+ */
+void
+alias_block_names(uint8_t *in, uint32_t nids, ilm_vec_t *names,
+    ilm_vec_t *buf)
+{
+	char norm[ALIAS_MAXLEN];
+	uint32_t id = 1;
+	while (id < nids) {
+		if (!(in[id] & 1)) {
+			id++;
+			continue;
+		}
+		uint32_t len = alias_normalize(ilm_id_str(id), norm);
+		if (len == 0) {
+			id++;
+			continue;
+		}
+		alias_name_t *an = ilm_vec_append(names, 1);
+		an->an_author = id;
+		an->an_norm = buf->v_len;
+		an->an_len = len;
+		bcopy(norm, ilm_vec_append(buf, len), len);
+		/* the first and last tokens, and the blocking key */
+		char *first_end = memchr(norm, ' ', len);
+		char *last = norm + len;
+		while (last > norm && last[-1] != ' ') {
+			last--;
+		}
+		uint32_t flen = first_end == NULL ? len : first_end - norm;
+		uint32_t llen = norm + len - last;
+		an->an_core = buf->v_len;
+		bcopy(norm, ilm_vec_append(buf, flen), flen);
+		if (last != norm) {
+			*(char *)ilm_vec_append(buf, 1) = ' ';
+			bcopy(last, ilm_vec_append(buf, llen), llen);
+		}
+		an->an_corelen = buf->v_len - an->an_core;
+		an->an_block = alias_hash(norm, 1,
+		    alias_hash(last, llen, 0xcbf29ce484222325ULL));
+		id++;
+	}
+	if (names->v_len > 0) {
+		qsort(names->v_buf, names->v_len, sizeof (alias_name_t),
+		    alias_name_cmp);
+	}
+}
+
+/*
+ * Compares every pair of names within each block, merging the likely aliases.
+ */
+void
+alias_match_names(alias_uf_t *uf, ilm_vec_t *names, char *buf)
+{
+	uint64_t *peq = ilm_mk_zbuf_as(sizeof (uint64_t) * 256, AC_SCRATCH);
+	alias_name_t *an = names->v_buf;
+	uint64_t n = names->v_len;
+	uint64_t i = 0;
+	while (i < n) {
+		alias_peq_set(peq, buf + an[i].an_norm, an[i].an_len);
+		uint64_t j = i + 1;
+		while (j < n && an[j].an_block == an[i].an_block) {
+			double conf = alias_compare(peq, buf, &an[i], &an[j]);
+			if (conf > 0) {
+				alias_union(uf, an[i].an_author,
+				    an[j].an_author, conf);
+			}
+			j++;
+		}
+		alias_peq_clear(peq, buf + an[i].an_norm, an[i].an_len);
+		i++;
+	}
+	ilm_rm_buf(peq, sizeof (uint64_t) * 256);
+}
+
+int
+alias_member_cmp(const void *a, const void *b)
+{
+	const alias_member_t *ma = a;
+	const alias_member_t *mb = b;
+	if (ma->am_root != mb->am_root) {
+		return (ma->am_root < mb->am_root ? -1 : 1);
+	}
+	if (ma->am_email != mb->am_email) {
+		return (ma->am_email - mb->am_email);
+	}
+	if (ma->am_commits != mb->am_commits) {
+		return (ma->am_commits > mb->am_commits ? -1 : 1);
+	}
+	return (ma->am_id < mb->am_id ? -1 : ma->am_id > mb->am_id);
+}
+
+int
+alias_cluster_cmp(const void *a, const void *b)
+{
+	const alias_cluster_t *ca = a;
+	const alias_cluster_t *cb = b;
+	if (ca->ac_conf != cb->ac_conf) {
+		return (ca->ac_conf > cb->ac_conf ? -1 : 1);
+	}
+	if (ca->ac_commits != cb->ac_commits) {
+		return (ca->ac_commits > cb->ac_commits ? -1 : 1);
+	}
+	return (ca->ac_first < cb->ac_first ? -1 : 1);
+}
+
+/*
+ * Prints the clusters that have more than one author name, most confident
+ * first. Each cluster starts with the name with the most commits. At most
+ * `top` clusters are printed, or all of them if `top` is 0.
+ */
+void
+alias_print(alias_uf_t *uf, uint8_t *in, uint32_t *ncommits, uint32_t nids,
+    uint32_t top)
+{
+	ilm_vec_t members;
+	ilm_vec_init(&members, sizeof (alias_member_t));
+	uint32_t id = 1;
+	while (id < nids) {
+		uint32_t r = alias_find(uf, id);
+		if (in[id] != 0 && uf->au_size[r] > 1) {
+			alias_member_t *m = ilm_vec_append(&members, 1);
+			m->am_root = r;
+			m->am_email = !(in[id] & 1);
+			m->am_commits = ncommits[id];
+			m->am_id = id;
+		}
+		id++;
+	}
+	alias_member_t *m = members.v_buf;
+	uint64_t nm = members.v_len;
+	if (nm > 0) {
+		qsort(m, nm, sizeof (alias_member_t), alias_member_cmp);
+	}
+
+	ilm_vec_t clusters;
+	ilm_vec_init(&clusters, sizeof (alias_cluster_t));
+	uint64_t i = 0;
+	while (i < nm) {
+		alias_cluster_t c;
+		bzero(&c, sizeof (alias_cluster_t));
+		c.ac_first = i;
+		c.ac_conf = uf->au_conf[m[i].am_root];
+		uint64_t j = i;
+		while (j < nm && m[j].am_root == m[i].am_root) {
+			if (m[j].am_email) {
+				c.ac_nemails++;
+			} else {
+				c.ac_nnames++;
+				c.ac_commits += m[j].am_commits;
+			}
+			j++;
+		}
+		if (c.ac_nnames > 1) {
+			*(alias_cluster_t *)ilm_vec_append(&clusters, 1) = c;
+		}
+		i = j;
+	}
+	alias_cluster_t *c = clusters.v_buf;
+	uint64_t nc = clusters.v_len;
+	if (nc > 0) {
+		qsort(c, nc, sizeof (alias_cluster_t), alias_cluster_cmp);
+	}
+	if (top == 0 || top > nc) {
+		top = nc;
+	}
+	i = 0;
+	while (i < top) {
+		alias_member_t *cm = &m[c[i].ac_first];
+		printf("%.2f  %s (%u names, %u emails, %llu commits)\n",
+		    c[i].ac_conf, ilm_id_str(cm->am_id), c[i].ac_nnames,
+		    c[i].ac_nemails, (unsigned long long)c[i].ac_commits);
+		uint32_t k = 1;
+		while (k < c[i].ac_nnames + c[i].ac_nemails) {
+			printf("\t%s\n", ilm_id_str(cm[k].am_id));
+			k++;
+		}
+		i++;
+	}
+	ilm_vec_fini(&clusters);
+	ilm_vec_fini(&members);
+}
+
+/*
+ * Finds and prints the clusters of author names that likely belong to one
+ * person, using the commits within the `-D` range.
+ */
+void
+alias_report(uint32_t top)
+{
+	uint32_t nids = ilm_intern_count() + 1; /* ID 0 included */
+	alias_uf_t uf;
+	uf.au_parent = ilm_mk_buf_as(sizeof (uint32_t) * nids, AC_SCRATCH);
+	uf.au_size = ilm_mk_buf_as(sizeof (uint32_t) * nids, AC_SCRATCH);
+	uf.au_conf = ilm_mk_buf_as(sizeof (double) * nids, AC_SCRATCH);
+	/* bit 0: is an author name, bit 1: is an email */
+	uint8_t *in = ilm_mk_zbuf_as(nids, AC_SCRATCH);
+	uint32_t *ncommits = ilm_mk_zbuf_as(sizeof (uint32_t) * nids,
+	    AC_SCRATCH);
+	uint32_t id = 0;
+	while (id < nids) {
+		uf.au_parent[id] = id;
+		uf.au_size[id] = 1;
+		uf.au_conf[id] = ALIAS_CONF_EMAIL;
+		id++;
+	}
+
+	uint32_t i = 0;
+	while (i < cstore_count()) {
+		repo_commit_t *c = cstore_get(i);
+		i++;
+		if (c->rc_time < constraints.cn_start_date ||
+		    c->rc_time > constraints.cn_end_date) {
+			continue;
+		}
+		if (c->rc_author == 0 || c->rc_email == 0) {
+			continue;
+		}
+		in[c->rc_author] |= 1;
+		in[c->rc_email] |= 2;
+		ncommits[c->rc_author]++;
+		alias_union(&uf, c->rc_author, c->rc_email, ALIAS_CONF_EMAIL);
+	}
+
+	ilm_vec_t names;
+	ilm_vec_t buf;
+	ilm_vec_init(&names, sizeof (alias_name_t));
+	ilm_vec_init(&buf, sizeof (char));
+	alias_block_names(in, nids, &names, &buf);
+	alias_match_names(&uf, &names, buf.v_buf);
+	alias_print(&uf, in, ncommits, nids, top);
+
+	ilm_vec_fini(&names);
+	ilm_vec_fini(&buf);
+	ilm_rm_buf(uf.au_parent, sizeof (uint32_t) * nids);
+	ilm_rm_buf(uf.au_size, sizeof (uint32_t) * nids);
+	ilm_rm_buf(uf.au_conf, sizeof (double) * nids);
+	ilm_rm_buf(in, nids);
+	ilm_rm_buf(ncommits, sizeof (uint32_t) * nids);
+}
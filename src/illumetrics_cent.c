@@ -0,0 +1,494 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Centrality
+ * ==========
+ *
+ * The centrality measures described in illumetrics_impl.h, computed on a
+ * frozen, undirected graph (in practice, the author projection). Distances are
+ * hop counts; the edge weights aren't used.
+ *
+ * Degree is the number of other authors that an author is connected to, which
+ * is the length of the author's row. Strength is the sum of the weights in
+ * the row: the files shared with each co-author in the projection, or the
+ * full-strength co-modifications in a windowed graph.
+ *
+ * Betweenness uses Brandes' algorithm. A breadth-first search from a source s
+ * counts the shortest paths from s to every vertex, and a pass over the
+ * visited vertices in reverse order accumulates the dependency of s on every
+ * vertex. The betweenness of a vertex is the sum of its dependencies over all
+ * sources. The passes are independent, so the sources are spread across
+ * threads, and each thread adds into its own array of scores. The arrays are
+ * summed at the end. Instead of keeping lists of predecessors, the reverse
+ * pass looks for neighbors one hop further from the source, which saves
+ * memory and keeps the scans sequential.
+ *
+ * An exact run does one pass per vertex, which is too slow for large graphs.
+ * With `-s K`, we pick K sources at random, and scale the result up. By
+ * Hoeffding's inequality, with K samples the normalized score of every vertex
+ * is within
+ *
+ *	eps = R * sqrt(ln(2 * n / CENT_DELTA) / (2 * K))
+ *
+ * of the exact one, with probability at least 1 - CENT_DELTA, where R is the
+ * largest contribution a single source can make to a normalized score (about
+ * 1). The bound is reported with the scores.
+ *
+ * Closeness is harmonic closeness: the sum of 1 / d(v, u) over every other
+ * vertex u, divided by n - 1. Unreachable vertices contribute 0 instead of
+ * making the distance infinite, so closeness is meaningful when the graph
+ * falls apart into components (and the author graph always does). It takes
+ * a breadth-first search from every vertex, but in a small-world graph those
+ * searches all sweep over the same vertices at nearly the same levels. So we
+ * run 64 of them at once (a multi-source BFS): every vertex has a 64-bit word
+ * per state, with one bit per search, and one scan of a vertex's neighbors
+ * advances all 64 searches by or-ing words together. Batches of 64 sources
+ * are spread across threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <math.h>
+#include "illumetrics_impl.h"
+
+/* sources a thread grabs at a time */
+#define	CENT_CHUNK	16
+/* the sampling error bound holds with probability 1 - CENT_DELTA */
+#define	CENT_DELTA	0.05
+/* fixed, so that sampled runs are repeatable */
+#define	CENT_SEED	0x9e3779b97f4a7c15ULL
+
+typedef struct bc_ctx {
+	csr_t		*bx_g;
+	uint32_t	*bx_src; /* the sources */
+	uint32_t	bx_nsrc;
+	uint32_t	bx_next; /* next source to hand out */
+	pthread_mutex_t	bx_lock;
+} bc_ctx_t;
+
+typedef struct bc_worker {
+	bc_ctx_t	*bw_ctx;
+	double		*bw_bc; /* this thread's scores */
+	int32_t		*bw_dist;
+	double		*bw_sigma;
+	double		*bw_delta;
+	uint32_t	*bw_order; /* vertices in BFS order */
+} bc_worker_t;
+
+/*
+ * xorshift64*, seeded by the caller.
+ */
+uint64_t
+cent_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return (x * 0x2545f4914f6cdd1dULL);
+}
+
+int
+bc_next_chunk(bc_ctx_t *bx, uint32_t *start, uint32_t *end)
+{
+	(void) pthread_mutex_lock(&bx->bx_lock);
+	*start = bx->bx_next;
+	*end = *start + CENT_CHUNK;
+	if (*end > bx->bx_nsrc) {
+		*end = bx->bx_nsrc;
+	}
+	bx->bx_next = *end;
+	(void) pthread_mutex_unlock(&bx->bx_lock);
+	return (*start < *end);
+}
+
+/*
+ * One pass of Brandes' algorithm, from `s`.
+ */
+void
+bc_pass(bc_worker_t *bw, csr_t *g, uint32_t s)
+{
+	int32_t *dist = bw->bw_dist;
+	double *sigma = bw->bw_sigma;
+	double *delta = bw->bw_delta;
+	uint32_t *order = bw->bw_order;
+	uint32_t head = 0;
+	uint32_t tail = 0;
+	dist[s] = 0;
+	sigma[s] = 1;
+	order[tail++] = s;
+	while (head < tail) {
+		uint32_t v = order[head++];
+		uint64_t i = g->cs_off[v];
+		while (i < g->cs_off[v + 1]) {
+			uint32_t w = g->cs_adj[i];
+			i++;
+			if (dist[w] < 0) {
+				dist[w] = dist[v] + 1;
+				order[tail++] = w;
+			}
+			if (dist[w] == dist[v] + 1) {
+				sigma[w] += sigma[v];
+			}
+		}
+	}
+	/* the BFS order, reversed, visits every vertex after its successors */
+	while (tail > 0) {
+		uint32_t v = order[--tail];
+		uint64_t i = g->cs_off[v];
+		while (i < g->cs_off[v + 1]) {
+			uint32_t w = g->cs_adj[i];
+			i++;
+			if (dist[w] == dist[v] + 1) {
+				delta[v] += sigma[v] / sigma[w] *
+				    (1 + delta[w]);
+			}
+		}
+		if (v != s) {
+			bw->bw_bc[v] += delta[v];
+		}
+	}
+	/* reset what we touched, so that the next pass starts clean */
+	while (head > 0) {
+		uint32_t v = order[--head];
+		dist[v] = -1;
+		sigma[v] = 0;
+		delta[v] = 0;
+	}
+}
+
+void *
+bc_worker(void *arg)
+{
+	bc_worker_t *bw = arg;
+	bc_ctx_t *bx = bw->bw_ctx;
+	uint32_t start;
+	uint32_t end;
+	while (bc_next_chunk(bx, &start, &end)) {
+		while (start < end) {
+			bc_pass(bw, bx->bx_g, bx->bx_src[start]);
+			start++;
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Computes the betweenness of every vertex of `g` into `bc`, normalized to
+ * [0, 1]. If `nsamples` is non-zero and less than the number of vertices, only
+ * that many random sources are used, and the error bound is returned.
+ * Otherwise the result is exact, and 0 is returned.
+ */
+double
+cent_betweenness(csr_t *g, uint32_t nsamples, double *bc)
+{
+	uint32_t n = g->cs_nverts;
+	bzero(bc, sizeof (double) * n);
+	if (n < 3) {
+		return (0);
+	}
+	bc_ctx_t bx;
+	bzero(&bx, sizeof (bc_ctx_t));
+	bx.bx_g = g;
+	bx.bx_src = ilm_mk_buf_as(sizeof (uint32_t) * n, AC_SCRATCH);
+	uint32_t v = 0;
+	while (v < n) {
+		bx.bx_src[v] = v;
+		v++;
+	}
+	bx.bx_nsrc = n;
+	if (nsamples > 0 && nsamples < n) {
+		/* the first nsamples of a partial Fisher-Yates shuffle */
+		uint64_t seed = CENT_SEED;
+		v = 0;
+		while (v < nsamples) {
+			uint32_t r = v + cent_rand(&seed) % (n - v);
+			uint32_t t = bx.bx_src[v];
+			bx.bx_src[v] = bx.bx_src[r];
+			bx.bx_src[r] = t;
+			v++;
+		}
+		bx.bx_nsrc = nsamples;
+	}
+	(void) pthread_mutex_init(&bx.bx_lock, NULL);
+
+	int nw = ilm_nthreads();
+	bc_worker_t *bw = ilm_mk_zbuf_as(sizeof (bc_worker_t) * nw, AC_SCRATCH);
+	int i = 0;
+	while (i < nw) {
+		bw[i].bw_ctx = &bx;
+		bw[i].bw_bc = ilm_mk_zbuf_as(sizeof (double) * n, AC_SCRATCH);
+		bw[i].bw_dist = ilm_mk_buf_as(sizeof (int32_t) * n, AC_SCRATCH);
+		bw[i].bw_sigma = ilm_mk_zbuf_as(sizeof (double) * n,
+		    AC_SCRATCH);
+		bw[i].bw_delta = ilm_mk_zbuf_as(sizeof (double) * n,
+		    AC_SCRATCH);
+		bw[i].bw_order = ilm_mk_buf_as(sizeof (uint32_t) * n,
+		    AC_SCRATCH);
+		v = 0;
+		while (v < n) {
+			bw[i].bw_dist[v] = -1;
+			v++;
+		}
+		i++;
+	}
+	ilm_run_threads(bc_worker, bw, sizeof (bc_worker_t), nw);
+
+	/*
+	 * Every pair is counted from both of its ends, and sampled sources
+	 * stand in for n / nsrc sources each.
+	 */
+	double scale = (double)n / bx.bx_nsrc / ((double)(n - 1) * (n - 2));
+	i = 0;
+	while (i < nw) {
+		v = 0;
+		while (v < n) {
+			bc[v] += bw[i].bw_bc[v] * scale;
+			v++;
+		}
+		ilm_rm_buf(bw[i].bw_bc, sizeof (double) * n);
+		ilm_rm_buf(bw[i].bw_dist, sizeof (int32_t) * n);
+		ilm_rm_buf(bw[i].bw_sigma, sizeof (double) * n);
+		ilm_rm_buf(bw[i].bw_delta, sizeof (double) * n);
+		ilm_rm_buf(bw[i].bw_order, sizeof (uint32_t) * n);
+		i++;
+	}
+	double eps = 0;
+	if (bx.bx_nsrc < n) {
+		double range = (double)n / (n - 1);
+		eps = range * sqrt(log(2.0 * n / CENT_DELTA) /
+		    (2.0 * bx.bx_nsrc));
+	}
+	ilm_rm_buf(bw, sizeof (bc_worker_t) * nw);
+	ilm_rm_buf(bx.bx_src, sizeof (uint32_t) * n);
+	(void) pthread_mutex_destroy(&bx.bx_lock);
+	return (eps);
+}
+
+typedef struct cc_ctx {
+	csr_t		*cx_g;
+	double		*cx_cc;
+	uint32_t	cx_nbatch; /* batches of 64 sources */
+	uint32_t	cx_next; /* next batch to hand out */
+	pthread_mutex_t	cx_lock;
+} cc_ctx_t;
+
+typedef struct cc_worker {
+	cc_ctx_t	*cw_ctx;
+	uint64_t	*cw_seen; /* searches that have reached the vertex */
+	uint64_t	*cw_visit; /* searches at the vertex on this level */
+	uint64_t	*cw_next; /* searches at the vertex on the next level */
+} cc_worker_t;
+
+/*
+ * Runs the 64 searches of batch `b`. Each source's score only depends on its
+ * own search, so the batch writes its sources' scores without locking.
+ */
+void
+cc_batch(cc_worker_t *cw, uint32_t b)
+{
+	csr_t *g = cw->cw_ctx->cx_g;
+	uint32_t n = g->cs_nverts;
+	uint32_t first = b * 64;
+	uint32_t nsrc = n - first < 64 ? n - first : 64;
+	uint64_t *seen = cw->cw_seen;
+	uint64_t *visit = cw->cw_visit;
+	uint64_t *next = cw->cw_next;
+	uint64_t cnt[64];
+	double sum[64];
+	bzero(seen, sizeof (uint64_t) * n);
+	bzero(visit, sizeof (uint64_t) * n);
+	bzero(next, sizeof (uint64_t) * n);
+	bzero(sum, sizeof (sum));
+	uint32_t i = 0;
+	while (i < nsrc) {
+		seen[first + i] = 1ULL << i;
+		visit[first + i] = 1ULL << i;
+		i++;
+	}
+	uint32_t d = 1;
+	int active = 1;
+	while (active) {
+		active = 0;
+		uint32_t v = 0;
+		while (v < n) {
+			if (visit[v] != 0) {
+				uint64_t j = g->cs_off[v];
+				while (j < g->cs_off[v + 1]) {
+					next[g->cs_adj[j]] |= visit[v];
+					j++;
+				}
+			}
+			v++;
+		}
+		bzero(cnt, sizeof (cnt));
+		v = 0;
+		while (v < n) {
+			uint64_t nb = next[v] & ~seen[v];
+			next[v] = 0;
+			visit[v] = nb;
+			if (nb != 0) {
+				seen[v] |= nb;
+				active = 1;
+				while (nb != 0) {
+					cnt[__builtin_ctzll(nb)]++;
+					nb &= nb - 1;
+				}
+			}
+			v++;
+		}
+		i = 0;
+		while (i < nsrc) {
+			sum[i] += (double)cnt[i] / d;
+			i++;
+		}
+		d++;
+	}
+	i = 0;
+	while (i < nsrc) {
+		cw->cw_ctx->cx_cc[first + i] = sum[i] / (n - 1);
+		i++;
+	}
+}
+
+void *
+cc_worker(void *arg)
+{
+	cc_worker_t *cw = arg;
+	cc_ctx_t *cx = cw->cw_ctx;
+	while (1) {
+		(void) pthread_mutex_lock(&cx->cx_lock);
+		uint32_t b = cx->cx_next;
+		if (b < cx->cx_nbatch) {
+			cx->cx_next++;
+		}
+		(void) pthread_mutex_unlock(&cx->cx_lock);
+		if (b >= cx->cx_nbatch) {
+			break;
+		}
+		cc_batch(cw, b);
+	}
+	return (NULL);
+}
+
+/*
+ * Computes the harmonic closeness of every vertex of `g` into `cc`.
+ */
+void
+cent_closeness(csr_t *g, double *cc)
+{
+	uint32_t n = g->cs_nverts;
+	bzero(cc, sizeof (double) * n);
+	if (n < 2) {
+		return;
+	}
+	cc_ctx_t cx;
+	bzero(&cx, sizeof (cc_ctx_t));
+	cx.cx_g = g;
+	cx.cx_cc = cc;
+	cx.cx_nbatch = (n + 63) / 64;
+	(void) pthread_mutex_init(&cx.cx_lock, NULL);
+	int nw = ilm_nthreads();
+	if ((uint32_t)nw > cx.cx_nbatch) {
+		nw = cx.cx_nbatch;
+	}
+	cc_worker_t *cw = ilm_mk_zbuf_as(sizeof (cc_worker_t) * nw, AC_SCRATCH);
+	int i = 0;
+	while (i < nw) {
+		cw[i].cw_ctx = &cx;
+		cw[i].cw_seen = ilm_mk_buf_as(sizeof (uint64_t) * n,
+		    AC_SCRATCH);
+		cw[i].cw_visit = ilm_mk_buf_as(sizeof (uint64_t) * n,
+		    AC_SCRATCH);
+		cw[i].cw_next = ilm_mk_buf_as(sizeof (uint64_t) * n,
+		    AC_SCRATCH);
+		i++;
+	}
+	ilm_run_threads(cc_worker, cw, sizeof (cc_worker_t), nw);
+	i = 0;
+	while (i < nw) {
+		ilm_rm_buf(cw[i].cw_seen, sizeof (uint64_t) * n);
+		ilm_rm_buf(cw[i].cw_visit, sizeof (uint64_t) * n);
+		ilm_rm_buf(cw[i].cw_next, sizeof (uint64_t) * n);
+		i++;
+	}
+	ilm_rm_buf(cw, sizeof (cc_worker_t) * nw);
+	(void) pthread_mutex_destroy(&cx.cx_lock);
+}
+
+/*
+ * Scores every vertex of `g` by its degree, or by its strength if `weighted`.
+ * The weights of `g` are in units of 1 / `scale`.
+ */
+void
+cent_degree(csr_t *g, int weighted, uint32_t scale, double *score)
+{
+	uint32_t v = 0;
+	while (v < g->cs_nverts) {
+		uint64_t i = g->cs_off[v];
+		if (weighted) {
+			while (i < g->cs_off[v + 1]) {
+				score[v] += (double)g->cs_wt[i] / scale;
+				i++;
+			}
+		} else {
+			score[v] = (double)(g->cs_off[v + 1] - i);
+		}
+		v++;
+	}
+}
+
+typedef struct cent_rank {
+	double		cr_score;
+	uint32_t	cr_v;
+} cent_rank_t;
+
+int
+cent_rank_cmp(const void *a, const void *b)
+{
+	const cent_rank_t *ra = a;
+	const cent_rank_t *rb = b;
+	if (ra->cr_score != rb->cr_score) {
+		return (ra->cr_score < rb->cr_score ? 1 : -1);
+	}
+	return (ra->cr_v < rb->cr_v ? -1 : ra->cr_v > rb->cr_v);
+}
+
+/*
+ * Prints the `top` highest scoring vertices (all of them if `top` is 0),
+ * with the names of the authors they stand for.
+ */
+void
+cent_print_top(csr_t *g, double *score, uint32_t top)
+{
+	uint32_t n = g->cs_nverts;
+	if (top == 0 || top > n) {
+		top = n;
+	}
+	cent_rank_t *r = ilm_mk_buf_as(sizeof (cent_rank_t) * (n + 1),
+	    AC_SCRATCH);
+	uint32_t v = 0;
+	while (v < n) {
+		r[v].cr_score = score[v];
+		r[v].cr_v = v;
+		v++;
+	}
+	qsort(r, n, sizeof (cent_rank_t), cent_rank_cmp);
+	v = 0;
+	while (v < top) {
+		printf("%6u %12.6f  %s\n", v + 1, r[v].cr_score,
+		    ilm_id_str(NODE_ID(g->cs_keys[r[v].cr_v])));
+		v++;
+	}
+	ilm_rm_buf(r, sizeof (cent_rank_t) * (n + 1));
+}
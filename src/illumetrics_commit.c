@@ -0,0 +1,100 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Commit Store
+ * ============
+ *
+ * Every commit that we ingest ends up here, as a packed 48-byte repo_commit_t
+ * (see illumetrics_impl.h). A commit is identified by its index in the store,
+ * which is also what the commit nodes of the graphs are keyed by. The IDs of
+ * the files that each commit touched are appended to a single array that is
+ * shared by all commits, and each commit refers to its run of that array by
+ * offset and length. So a commit costs 48 bytes, plus 4 bytes per file that
+ * it touched, and not a single pointer. A commit that is in several forks is
+ * only stored once (see illumetrics_cset.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "illumetrics_impl.h"
+
+ilm_vec_t cstore_commits;
+ilm_vec_t cstore_fids;
+
+void
+cstore_init()
+{
+	ilm_vec_init(&cstore_commits, sizeof (repo_commit_t));
+	ilm_vec_init(&cstore_fids, sizeof (ilm_id_t));
+}
+
+/*
+ * Copies the commit and its files into the store, and returns the commit's
+ * index. The record's rc_foff is filled in by the store.
+ */
+uint32_t
+cstore_add(repo_commit_t *c, ilm_id_t *files)
+{
+	if (cstore_commits.v_len == UINT32_MAX ||
+	    cstore_fids.v_len + c->rc_nfiles > UINT32_MAX) {
+		fprintf(stderr, "The commit store is full.\n");
+		exit(-1);
+	}
+	uint32_t idx = cstore_commits.v_len;
+	uint32_t foff = cstore_fids.v_len;
+	if (c->rc_nfiles > 0) {
+		ilm_id_t *f = ilm_vec_append(&cstore_fids, c->rc_nfiles);
+		bcopy(files, f, sizeof (ilm_id_t) * c->rc_nfiles);
+	}
+	repo_commit_t *sc = ilm_vec_append(&cstore_commits, 1);
+	*sc = *c;
+	sc->rc_foff = foff;
+	return (idx);
+}
+
+/*
+ * The returned pointer is only good until the next cstore_add().
+ */
+repo_commit_t *
+cstore_get(uint32_t idx)
+{
+	return (ILM_VEC_GET(&cstore_commits, repo_commit_t, idx));
+}
+
+ilm_id_t *
+cstore_files(repo_commit_t *c)
+{
+	return (ILM_VEC_GET(&cstore_fids, ilm_id_t, c->rc_foff));
+}
+
+uint32_t
+cstore_count()
+{
+	return (cstore_commits.v_len);
+}
+
+void
+cstore_snap_write(snap_writer_t *sw)
+{
+	snap_vec_write(sw, SK_COMMITS, &cstore_commits);
+	snap_vec_write(sw, SK_FIDS, &cstore_fids);
+}
+
+int
+cstore_snap_load(snap_t *s)
+{
+	if (snap_vec_load(s, SK_COMMITS, &cstore_commits) != 0 ||
+	    snap_vec_load(s, SK_FIDS, &cstore_fids) != 0) {
+		return (-1);
+	}
+	return (0);
+}
@@ -0,0 +1,491 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Commit Set
+ * ==========
+ *
+ * Unless we're restricted to a single repository with `-r`, all of the
+ * repositories are treated as one giant repository. A category like
+ * `config/lists/kernel` is mostly forks of one repository, which share most
+ * of their history, and a commit that is in six forks has to count once, not
+ * six times. The commit set holds the SHA-1 of every commit that has been
+ * ingested. The graph builder only ingests a commit the first time it's
+ * added to the set, and the diff workers don't bother diffing a commit that
+ * is already in the set. So a category of forks costs about as much as the
+ * union of their histories, which is not much more than one of them. The set
+ * also makes it harmless to walk a commit twice, which happens when a walk
+ * fails after ingesting part of a repository, and is retried on the next
+ * pull from the old high-water marks.
+ *
+ * Note that this is not a cache of diffs keyed by SHA-1. A fork never needs
+ * the files of a commit that another fork already ingested, because it doesn't
+ * ingest that commit again, so the diff is skipped instead of being stored
+ * and reused. That's why the diff workers report skipped and done diffs (and
+ * fire the commit-dedup and commit-diffed probes), not cache hits and misses.
+ *
+ * For each commit, the set records the repository it was first seen in, the
+ * set of repositories it is in, and its parents. With the parents, the set is
+ * the deduplicated commit graph of all of the repositories, which is what
+ * cross-polination is computed on (see illumetrics_xpol.c). There are few
+ * distinct sets of repositories (about one per group of forks), so the sets
+ * themselves are kept once, as bitmaps of `nrepos` bits, and each commit
+ * refers to its set by a 32-bit ID. Set 0 is the empty set. Adding a
+ * repository to a set is a lookup in a small table of transitions, from a set
+ * and a repository to the set that has both.
+ *
+ * The set has to hold tens of millions of commits, so it's laid out like the
+ * string table (see illumetrics_intern.c). The entries are appended to pages
+ * that are never moved, and are referred to by a 32-bit ID. An entry costs 32
+ * bytes, and its parents' SHA-1s, which are appended to an array that is
+ * shared by all entries, cost 20 bytes each. The index is an open-addressing
+ * table of 64-bit buckets, each of which packs a 32-bit fingerprint of the
+ * SHA-1 (taken from a different part of the SHA-1 than the bucket index) next
+ * to the entry's ID. Probing only touches an entry when its fingerprint
+ * matches, which almost always means that it's the one we're looking for. The
+ * table is kept between 3/8 and 3/4 full, so it costs 11 to 22 bytes per
+ * commit. All of it is saved to snapshots as it is, and a loaded snapshot is
+ * used in place.
+ *
+ * The set is safe to use from several threads. Lookups and inserts take the
+ * lock, which is only held for a probe, so it's hardly ever contended.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "illumetrics_impl.h"
+
+#define	CSET_PAGE_SHIFT		16
+#define	CSET_PAGE_SZ		(1 << CSET_PAGE_SHIFT) /* entries per page */
+#define	CSET_MAX_PAGES		(1 << 16)
+#define	CSET_HT_MIN_SZ		(1 << 16)
+#define	CSET_TR_MIN_SZ		(1 << 8)
+
+/* adding `ct_repo` to set `ct_from` makes set `ct_to`, 0 if empty */
+typedef struct cset_tr {
+	uint32_t	ct_from;
+	uint32_t	ct_repo;
+	uint32_t	ct_to;
+} cset_tr_t;
+
+typedef struct cset {
+	pthread_mutex_t	cs_lock;
+	cset_ent_t	**cs_pages; /* CSET_MAX_PAGES */
+	uint32_t	cs_nents; /* including the reserved entry 0 */
+	ilm_vec_t	cs_parents; /* sha1_t */
+	uint64_t	*cs_ht; /* (fingerprint << 32) | entry, 0 if empty */
+	uint64_t	cs_htsz; /* power of 2 */
+	int		cs_ht_mapped; /* bool, cs_ht is in a snapshot */
+	ilm_vec_t	cs_sets; /* uint64_t, cs_setw words per set */
+	uint32_t	cs_setw;
+	uint32_t	cs_nsets;
+	uint64_t	*cs_scratch; /* cs_setw words */
+	cset_tr_t	*cs_tr;
+	uint64_t	cs_trsz; /* power of 2 */
+	uint64_t	cs_ntr;
+	uint64_t	cs_dups; /* adds of commits that were in the set */
+	uint64_t	cs_skipped; /* diffs skipped */
+	uint64_t	cs_diffed; /* diffs done */
+} cset_t;
+
+static cset_t cs;
+
+#define	CSET_ENT(id)	\
+	(&cs.cs_pages[(id) >> CSET_PAGE_SHIFT][(id) & (CSET_PAGE_SZ - 1)])
+#define	CSET_SET(s)	\
+	ILM_VEC_GET(&cs.cs_sets, uint64_t, (uint64_t)(s) * cs.cs_setw)
+
+/*
+ * Must be called once the repositories are loaded, since the sets of
+ * repositories are `nrepos` bits wide.
+ */
+void
+cset_init()
+{
+	(void) pthread_mutex_init(&cs.cs_lock, NULL);
+	cs.cs_pages = ilm_mk_zbuf_as(sizeof (cset_ent_t *) * CSET_MAX_PAGES,
+	    AC_CSET);
+	cs.cs_pages[0] = ilm_mk_zbuf_as(sizeof (cset_ent_t) * CSET_PAGE_SZ,
+	    AC_CSET);
+	cs.cs_nents = 1;
+	ilm_vec_init(&cs.cs_parents, sizeof (sha1_t));
+	cs.cs_htsz = CSET_HT_MIN_SZ;
+	cs.cs_ht = ilm_mk_zbuf_as(sizeof (uint64_t) * cs.cs_htsz, AC_CSET);
+	cs.cs_setw = (nrepos + 63) / 64;
+	if (cs.cs_setw == 0) {
+		cs.cs_setw = 1;
+	}
+	ilm_vec_init(&cs.cs_sets, sizeof (uint64_t));
+	bzero(ilm_vec_append(&cs.cs_sets, cs.cs_setw),
+	    sizeof (uint64_t) * cs.cs_setw);
+	cs.cs_nsets = 1;
+	cs.cs_scratch = ilm_mk_buf_as(sizeof (uint64_t) * cs.cs_setw, AC_CSET);
+	cs.cs_trsz = CSET_TR_MIN_SZ;
+	cs.cs_tr = ilm_mk_zbuf_as(sizeof (cset_tr_t) * cs.cs_trsz, AC_CSET);
+}
+
+/*
+ * Returns the bucket that holds `sha1`, or the empty bucket where it belongs.
+ * Must be called with the lock held.
+ */
+uint64_t *
+cset_probe(sha1_t *sha1)
+{
+	uint64_t mask = cs.cs_htsz - 1;
+	uint64_t b = sha1->sha1_val[0] & mask;
+	uint32_t fp = sha1->sha1_val[1];
+	while (cs.cs_ht[b] != 0) {
+		uint64_t e = cs.cs_ht[b];
+		if ((uint32_t)(e >> 32) == fp && bcmp(&CSET_ENT((uint32_t)e)->
+		    ce_sha1, sha1, sizeof (sha1_t)) == 0) {
+			break;
+		}
+		b = (b + 1) & mask;
+	}
+	return (&cs.cs_ht[b]);
+}
+
+/*
+ * Doubles the table. The bucket index isn't in the bucket, so we go over the
+ * entries instead, which are in pages, in order.
+ */
+void
+cset_grow()
+{
+	uint64_t osz = cs.cs_htsz;
+	if (!cs.cs_ht_mapped) {
+		ilm_rm_buf(cs.cs_ht, sizeof (uint64_t) * osz);
+	}
+	cs.cs_ht_mapped = 0;
+	cs.cs_htsz = osz * 2;
+	cs.cs_ht = ilm_mk_zbuf_as(sizeof (uint64_t) * cs.cs_htsz, AC_CSET);
+	uint64_t mask = cs.cs_htsz - 1;
+	uint32_t id = 1;
+	while (id < cs.cs_nents) {
+		sha1_t *sha1 = &CSET_ENT(id)->ce_sha1;
+		uint64_t b = sha1->sha1_val[0] & mask;
+		while (cs.cs_ht[b] != 0) {
+			b = (b + 1) & mask;
+		}
+		cs.cs_ht[b] = ((uint64_t)sha1->sha1_val[1] << 32) | id;
+		id++;
+	}
+}
+
+cset_tr_t *
+cset_tr_probe(cset_tr_t *t, uint64_t sz, uint32_t from, uint32_t repo)
+{
+	uint64_t mask = sz - 1;
+	uint64_t b = (((uint64_t)from * 0x9e3779b97f4a7c15ULL) ^ repo) & mask;
+	while (t[b].ct_to != 0 &&
+	    (t[b].ct_from != from || t[b].ct_repo != repo)) {
+		b = (b + 1) & mask;
+	}
+	return (&t[b]);
+}
+
+/*
+ * Returns the ID of the set that has the repositories of set `from`, and
+ * `repo`. Must be called with the lock held.
+ */
+uint32_t
+cset_set_add(uint32_t from, uint32_t repo)
+{
+	uint64_t *s = CSET_SET(from);
+	if ((s[repo >> 6] >> (repo & 63)) & 1) {
+		return (from);
+	}
+	cset_tr_t *t = cset_tr_probe(cs.cs_tr, cs.cs_trsz, from, repo);
+	if (t->ct_to != 0) {
+		return (t->ct_to);
+	}
+	/* a new transition, which is rare, so we look for its set by hand */
+	bcopy(s, cs.cs_scratch, sizeof (uint64_t) * cs.cs_setw);
+	cs.cs_scratch[repo >> 6] |= 1ULL << (repo & 63);
+	uint32_t to = 1;
+	while (to < cs.cs_nsets && bcmp(CSET_SET(to), cs.cs_scratch,
+	    sizeof (uint64_t) * cs.cs_setw) != 0) {
+		to++;
+	}
+	if (to == cs.cs_nsets) {
+		bcopy(cs.cs_scratch, ilm_vec_append(&cs.cs_sets, cs.cs_setw),
+		    sizeof (uint64_t) * cs.cs_setw);
+		cs.cs_nsets++;
+	}
+	t->ct_from = from;
+	t->ct_repo = repo;
+	t->ct_to = to;
+	cs.cs_ntr++;
+	/* keep the load factor under 3/4 */
+	if (cs.cs_ntr * 4 > cs.cs_trsz * 3) {
+		uint64_t osz = cs.cs_trsz;
+		cset_tr_t *ot = cs.cs_tr;
+		cs.cs_trsz = osz * 2;
+		cs.cs_tr = ilm_mk_zbuf_as(sizeof (cset_tr_t) * cs.cs_trsz,
+		    AC_CSET);
+		uint64_t i = 0;
+		while (i < osz) {
+			if (ot[i].ct_to != 0) {
+				*cset_tr_probe(cs.cs_tr, cs.cs_trsz,
+				    ot[i].ct_from, ot[i].ct_repo) = ot[i];
+			}
+			i++;
+		}
+		ilm_rm_buf(ot, sizeof (cset_tr_t) * osz);
+	}
+	return (to);
+}
+
+/*
+ * Adds the commit, with its `np` parents, as seen in repository `repo`.
+ * Returns non-zero if it's new, and zero if it was already in the set, in
+ * which case only `repo` is added to its repositories. Safe to call from
+ * multiple threads.
+ */
+int
+cset_add(sha1_t *sha1, uint32_t repo, sha1_t *parents, uint32_t np)
+{
+	(void) pthread_mutex_lock(&cs.cs_lock);
+	uint64_t *b = cset_probe(sha1);
+	if (*b != 0) {
+		cset_ent_t *ce = CSET_ENT((uint32_t)*b);
+		ce->ce_repos = cset_set_add(ce->ce_repos, repo);
+		cs.cs_dups++;
+		(void) pthread_mutex_unlock(&cs.cs_lock);
+		return (0);
+	}
+	uint32_t id = cs.cs_nents;
+	if (id == UINT32_MAX || cs.cs_parents.v_len + np > UINT32_MAX) {
+		fprintf(stderr, "Added more than 2^32 commits to the set.\n");
+		exit(-1);
+	}
+	if (cs.cs_pages[id >> CSET_PAGE_SHIFT] == NULL) {
+		cs.cs_pages[id >> CSET_PAGE_SHIFT] =
+		    ilm_mk_buf_as(sizeof (cset_ent_t) * CSET_PAGE_SZ, AC_CSET);
+	}
+	cset_ent_t *ce = CSET_ENT(id);
+	ce->ce_sha1 = *sha1;
+	ce->ce_repo = repo;
+	ce->ce_repos = cset_set_add(0, repo);
+	ce->ce_poff = cs.cs_parents.v_len;
+	if (np > 0) {
+		bcopy(parents, ilm_vec_append(&cs.cs_parents, np),
+		    sizeof (sha1_t) * np);
+	}
+	*b = ((uint64_t)sha1->sha1_val[1] << 32) | id;
+	cs.cs_nents++;
+	/* keep the load factor under 3/4 */
+	if ((uint64_t)cs.cs_nents * 4 > cs.cs_htsz * 3) {
+		cset_grow();
+	}
+	(void) pthread_mutex_unlock(&cs.cs_lock);
+	return (1);
+}
+
+/*
+ * Returns the ID of the commit's entry, or 0 if the commit isn't in the set.
+ * Safe to call from multiple threads.
+ */
+uint32_t
+cset_lookup(sha1_t *sha1)
+{
+	(void) pthread_mutex_lock(&cs.cs_lock);
+	uint32_t id = (uint32_t)*cset_probe(sha1);
+	(void) pthread_mutex_unlock(&cs.cs_lock);
+	return (id);
+}
+
+int
+cset_has(sha1_t *sha1)
+{
+	return (cset_lookup(sha1) != 0);
+}
+
+/*
+ * Entries are numbered from 1 to cset_count(). The returned pointer is good
+ * until the snapshot is unmapped.
+ */
+cset_ent_t *
+cset_get(uint32_t id)
+{
+	return (CSET_ENT(id));
+}
+
+/*
+ * Returns the parents of the entry, and their number through `np`. The
+ * returned pointer is only good until the next cset_add().
+ */
+sha1_t *
+cset_parents(uint32_t id, uint32_t *np)
+{
+	cset_ent_t *ce = CSET_ENT(id);
+	uint64_t end = id + 1 < cs.cs_nents ? CSET_ENT(id + 1)->ce_poff :
+	    cs.cs_parents.v_len;
+	*np = end - ce->ce_poff;
+	return (ILM_VEC_GET(&cs.cs_parents, sha1_t, ce->ce_poff));
+}
+
+/*
+ * Returns the bitmap of a set of repositories, which is cset_set_words()
+ * 64-bit words long.
+ */
+uint64_t *
+cset_repo_set(uint32_t s)
+{
+	return (CSET_SET(s));
+}
+
+uint32_t
+cset_set_words()
+{
+	return (cs.cs_setw);
+}
+
+uint32_t
+cset_count()
+{
+	return (cs.cs_nents - 1);
+}
+
+/*
+ * Counts the diffs that were skipped, and done, by a batch of diff workers.
+ */
+void
+cset_count_diffs(uint64_t skipped, uint64_t diffed)
+{
+	cs.cs_skipped += skipped;
+	cs.cs_diffed += diffed;
+}
+
+/*
+ * Reports how much work the set saved during a walk.
+ */
+void
+cset_report()
+{
+	if (cs.cs_skipped + cs.cs_diffed > 0) {
+		fprintf(stderr, "Diffs: %llu skipped as duplicates, %llu "
+		    "done.\n",
+		    (unsigned long long)cs.cs_skipped,
+		    (unsigned long long)cs.cs_diffed);
+	}
+	if (cs.cs_dups > 0) {
+		fprintf(stderr, "Skipped %llu commits that were already "
+		    "ingested.\n", (unsigned long long)cs.cs_dups);
+	}
+	cs.cs_skipped = 0;
+	cs.cs_diffed = 0;
+	cs.cs_dups = 0;
+}
+
+/*
+ * Fills in, for every repository, the number of commits that are in it, the
+ * number of those that were first seen in it, and the number of those that
+ * are also in other repositories. The arrays are `nrepos` long, and zeroed.
+ */
+void
+cset_repo_counts(uint64_t *ncommits, uint64_t *nfirst, uint64_t *nshared)
+{
+	uint64_t *per_set = ilm_mk_zbuf_as(sizeof (uint64_t) * cs.cs_nsets,
+	    AC_SCRATCH);
+	uint32_t id = 1;
+	while (id < cs.cs_nents) {
+		cset_ent_t *ce = CSET_ENT(id);
+		per_set[ce->ce_repos]++;
+		nfirst[ce->ce_repo]++;
+		id++;
+	}
+	uint32_t s = 1;
+	while (s < cs.cs_nsets) {
+		uint64_t *set = CSET_SET(s);
+		uint32_t nbits = 0;
+		uint32_t w = 0;
+		while (w < cs.cs_setw) {
+			nbits += __builtin_popcountll(set[w]);
+			w++;
+		}
+		uint32_t r = 0;
+		while (r < nrepos) {
+			if ((set[r >> 6] >> (r & 63)) & 1) {
+				ncommits[r] += per_set[s];
+				if (nbits > 1) {
+					nshared[r] += per_set[s];
+				}
+			}
+			r++;
+		}
+		s++;
+	}
+	ilm_rm_buf(per_set, sizeof (uint64_t) * cs.cs_nsets);
+}
+
+void
+cset_snap_write(snap_writer_t *sw)
+{
+	snap_sect_begin(sw, SK_CSET_ENTS, cs.cs_nents);
+	uint64_t p = 0;
+	while (((uint64_t)p << CSET_PAGE_SHIFT) < cs.cs_nents) {
+		snap_sect_write(sw, cs.cs_pages[p],
+		    sizeof (cset_ent_t) * CSET_PAGE_SZ);
+		p++;
+	}
+	snap_sect_end(sw);
+
+	snap_sect_begin(sw, SK_CSET_HT, cs.cs_htsz);
+	snap_sect_write(sw, cs.cs_ht, sizeof (uint64_t) * cs.cs_htsz);
+	snap_sect_end(sw);
+
+	snap_vec_write(sw, SK_CSET_REPOS, &cs.cs_sets);
+	snap_vec_write(sw, SK_CSET_PARENTS, &cs.cs_parents);
+}
+
+/*
+ * Points the set at a snapshot's commits. Nothing may have been added yet.
+ * The transitions between sets of repositories aren't saved, they're just
+ * found again as needed.
+ */
+int
+cset_snap_load(snap_t *s)
+{
+	uint64_t elen;
+	uint64_t hlen;
+	uint64_t nents;
+	uint64_t htsz;
+	cset_ent_t *ents = snap_sect(s, SK_CSET_ENTS, &elen, &nents);
+	uint64_t *ht = snap_sect(s, SK_CSET_HT, &hlen, &htsz);
+	uint64_t npages = (nents + CSET_PAGE_SZ - 1) >> CSET_PAGE_SHIFT;
+	if (nents == 0 || nents > UINT32_MAX || npages > CSET_MAX_PAGES ||
+	    elen != sizeof (cset_ent_t) * CSET_PAGE_SZ * npages ||
+	    htsz < CSET_HT_MIN_SZ || (htsz & (htsz - 1)) != 0 ||
+	    hlen != sizeof (uint64_t) * htsz ||
+	    snap_vec_load(s, SK_CSET_REPOS, &cs.cs_sets) != 0 ||
+	    cs.cs_sets.v_len == 0 || cs.cs_sets.v_len % cs.cs_setw != 0 ||
+	    snap_vec_load(s, SK_CSET_PARENTS, &cs.cs_parents) != 0) {
+		return (-1);
+	}
+	if (cs.cs_nents != 1) {
+		fprintf(stderr, "Loading a snapshot after adding commits.\n");
+		exit(-1);
+	}
+	ilm_rm_buf(cs.cs_pages[0], sizeof (cset_ent_t) * CSET_PAGE_SZ);
+	ilm_rm_buf(cs.cs_ht, sizeof (uint64_t) * cs.cs_htsz);
+	uint64_t i = 0;
+	while (i < npages) {
+		cs.cs_pages[i] = ents + (i << CSET_PAGE_SHIFT);
+		i++;
+	}
+	cs.cs_nents = nents;
+	cs.cs_ht = ht;
+	cs.cs_htsz = htsz;
+	cs.cs_ht_mapped = 1;
+	cs.cs_nsets = cs.cs_sets.v_len / cs.cs_setw;
+	return (0);
+}
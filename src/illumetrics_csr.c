@@ -0,0 +1,255 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Frozen Graphs
+ * =============
+ *
+ * The libgraph graphs are made for inserting edges one at a time. But the
+ * analyses (centrality, neighborhoods, and so on) never insert anything; they
+ * traverse the same graph over and over, and chasing pointers through slab
+ * lists on every step is what they would spend their time on. So before we
+ * analyze a graph, we freeze it into compressed sparse row (CSR) form:
+ *
+ *	cs_off	one offset per vertex, plus one at the end
+ *	cs_adj	the neighbors of vertex v are cs_adj[cs_off[v]..cs_off[v+1])
+ *	cs_wt	the weight of each of those edges
+ *
+ * Vertices are renumbered with dense IDs, 0 to cs_nverts - 1, so that the
+ * analyses can keep their per-vertex state in plain arrays. cs_keys maps a
+ * dense ID back to its NODE_KEY(). The keys are sorted, so the vertices of a
+ * kind are contiguous (i.e. all of the authors come before all of the
+ * commits), and a key is turned into a dense ID by binary search.
+ *
+ * A graph is frozen from an edge log (see illumetrics_graph.c), or from any
+ * other array of edges, such as a projection. Duplicate edges are merged, and
+ * their weights are added up. Every neighbor list is sorted, so scanning a
+ * vertex's neighbors is a sequential read of two arrays.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "illumetrics_impl.h"
+
+int
+csr_key_cmp(const void *a, const void *b)
+{
+	uint64_t ka = *(const uint64_t *)a;
+	uint64_t kb = *(const uint64_t *)b;
+	return (ka < kb ? -1 : ka > kb);
+}
+
+/*
+ * Returns the dense ID of the first vertex whose key is at least `key`, or
+ * cs_nverts if there is none. Since the keys are sorted by kind first, this
+ * finds where the vertices of a kind begin and end.
+ */
+uint32_t
+csr_vertex_ge(csr_t *cs, uint64_t key)
+{
+	uint64_t lo = 0;
+	uint64_t hi = cs->cs_nverts;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (cs->cs_keys[mid] < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return ((uint32_t)lo);
+}
+
+/*
+ * Returns the dense ID of the vertex with key `key`, or CSR_NONE if the graph
+ * doesn't have it.
+ */
+uint32_t
+csr_vertex(csr_t *cs, uint64_t key)
+{
+	uint32_t v = csr_vertex_ge(cs, key);
+	if (v < cs->cs_nverts && cs->cs_keys[v] == key) {
+		return (v);
+	}
+	return (CSR_NONE);
+}
+
+/*
+ * Collects the distinct endpoints of the edges, in ascending order.
+ */
+void
+csr_collect_keys(csr_t *cs, const ilm_edge_t *e, uint64_t n)
+{
+	uint64_t *keys = ilm_mk_buf_as(sizeof (uint64_t) * (2 * n + 1), AC_CSR);
+	uint64_t i = 0;
+	while (i < n) {
+		keys[2 * i] = e[i].ed_src;
+		keys[2 * i + 1] = e[i].ed_dst;
+		i++;
+	}
+	qsort(keys, 2 * n, sizeof (uint64_t), csr_key_cmp);
+	uint64_t nv = 0;
+	i = 0;
+	while (i < 2 * n) {
+		if (nv == 0 || keys[nv - 1] != keys[i]) {
+			keys[nv] = keys[i];
+			nv++;
+		}
+		i++;
+	}
+	if (nv >= CSR_NONE) {
+		fprintf(stderr, "Can't freeze a graph with %llu vertices.\n",
+		    (unsigned long long)nv);
+		exit(-1);
+	}
+	cs->cs_nverts = nv;
+	cs->cs_keys = ilm_mk_buf_as(sizeof (uint64_t) * (nv + 1), AC_CSR);
+	i = 0;
+	while (i < nv) {
+		cs->cs_keys[i] = keys[i];
+		i++;
+	}
+	ilm_rm_buf(keys, sizeof (uint64_t) * (2 * n + 1));
+}
+
+/*
+ * Freezes `n` edges. If `w` isn't NULL, it holds the weight of each edge,
+ * otherwise each edge weighs 1. With CSR_UNDIRECTED in `flags`, every edge is
+ * stored in both directions.
+ */
+csr_t *
+csr_build(const ilm_edge_t *e, uint64_t n, const uint32_t *w, int flags)
+{
+	csr_t *cs = ilm_mk_zbuf_as(sizeof (csr_t), AC_CSR);
+	cs->cs_flags = flags;
+	csr_collect_keys(cs, e, n);
+	uint32_t nv = cs->cs_nverts;
+	int undir = (flags & CSR_UNDIRECTED) != 0;
+
+	/*
+	 * Translate the endpoints to dense IDs, and count the out-degree of
+	 * each vertex (with duplicates, for now).
+	 */
+	uint32_t *ends = ilm_mk_buf_as(sizeof (uint32_t) * (2 * n + 1), AC_CSR);
+	uint64_t *off = ilm_mk_zbuf_as(sizeof (uint64_t) * (nv + 1), AC_CSR);
+	uint64_t i = 0;
+	while (i < n) {
+		uint32_t s = csr_vertex(cs, e[i].ed_src);
+		uint32_t d = csr_vertex(cs, e[i].ed_dst);
+		ends[2 * i] = s;
+		ends[2 * i + 1] = d;
+		off[s + 1]++;
+		if (undir && s != d) {
+			off[d + 1]++;
+		}
+		i++;
+	}
+	uint32_t v = 0;
+	while (v < nv) {
+		off[v + 1] += off[v];
+		v++;
+	}
+
+	/*
+	 * Scatter the edges into their rows. Each entry packs the neighbor
+	 * into the top half and the weight into the bottom half, so that a row
+	 * can be sorted by neighbor with a plain integer sort.
+	 */
+	uint64_t m = off[nv];
+	uint64_t *row = ilm_mk_buf_as(sizeof (uint64_t) * (m + 1), AC_CSR);
+	uint64_t *cur = ilm_mk_buf_as(sizeof (uint64_t) * (nv + 1), AC_CSR);
+	v = 0;
+	while (v < nv) {
+		cur[v] = off[v];
+		v++;
+	}
+	i = 0;
+	while (i < n) {
+		uint32_t s = ends[2 * i];
+		uint32_t d = ends[2 * i + 1];
+		uint64_t wt = w == NULL ? 1 : w[i];
+		row[cur[s]] = ((uint64_t)d << 32) | wt;
+		cur[s]++;
+		if (undir && s != d) {
+			row[cur[d]] = ((uint64_t)s << 32) | wt;
+			cur[d]++;
+		}
+		i++;
+	}
+	ilm_rm_buf(cur, sizeof (uint64_t) * (nv + 1));
+	ilm_rm_buf(ends, sizeof (uint32_t) * (2 * n + 1));
+
+	/*
+	 * Sort each row, and merge the duplicates in place. The rows only ever
+	 * shrink, so the compacted rows never overrun the ones after them.
+	 */
+	uint64_t out = 0;
+	uint64_t start = 0;
+	v = 0;
+	while (v < nv) {
+		uint64_t end = off[v + 1];
+		qsort(&row[start], end - start, sizeof (uint64_t),
+		    csr_key_cmp);
+		off[v] = out;
+		uint64_t j = start;
+		while (j < end) {
+			uint64_t nbr = row[j] >> 32;
+			uint64_t wt = row[j] & UINT32_MAX;
+			j++;
+			while (j < end && (row[j] >> 32) == nbr) {
+				wt += row[j] & UINT32_MAX;
+				j++;
+			}
+			if (wt > UINT32_MAX) {
+				wt = UINT32_MAX;
+			}
+			row[out] = (nbr << 32) | wt;
+			out++;
+		}
+		start = end;
+		v++;
+	}
+	off[nv] = out;
+
+	cs->cs_nedges = out;
+	cs->cs_off = off;
+	cs->cs_adj = ilm_mk_buf_as(sizeof (uint32_t) * (out + 1), AC_CSR);
+	cs->cs_wt = ilm_mk_buf_as(sizeof (uint32_t) * (out + 1), AC_CSR);
+	i = 0;
+	while (i < out) {
+		cs->cs_adj[i] = row[i] >> 32;
+		cs->cs_wt[i] = row[i] & UINT32_MAX;
+		i++;
+	}
+	ilm_rm_buf(row, sizeof (uint64_t) * (m + 1));
+	return (cs);
+}
+
+/*
+ * Freezes one of the global graphs, from its edge log.
+ */
+csr_t *
+csr_freeze(graph_id_t g, int flags)
+{
+	uint64_t n;
+	uint32_t *wt;
+	ilm_edge_t *e = graph_edges(g, &n, &wt);
+	return (csr_build(e, n, wt, flags));
+}
+
+void
+csr_destroy(csr_t *cs)
+{
+	ilm_rm_buf(cs->cs_keys, sizeof (uint64_t) * (cs->cs_nverts + 1));
+	ilm_rm_buf(cs->cs_off, sizeof (uint64_t) * (cs->cs_nverts + 1));
+	ilm_rm_buf(cs->cs_adj, sizeof (uint32_t) * (cs->cs_nedges + 1));
+	ilm_rm_buf(cs->cs_wt, sizeof (uint32_t) * (cs->cs_nedges + 1));
+	ilm_rm_buf(cs, sizeof (csr_t));
+}
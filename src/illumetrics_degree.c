@@ -0,0 +1,279 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Activity Counters
+ * =================
+ *
+ * `-c activity` ranks authors by how many commits, or how many distinct
+ * files, they have. These are the authors' degrees in the bipartite graphs,
+ * not their degrees in the author graph (that's `-c degree`, the number of
+ * co-authors, see illumetrics_cent.c), so they say how much an author does,
+ * not how many others an author works with. They don't need the graphs at
+ * all, just a count per author.
+ *
+ * So we count as we ingest: every commit bumps its author's commit count (the
+ * author's degree in author2commit), and every file that an author touches
+ * for the first time bumps the author's file count (the author's degree in
+ * file2author, which has an edge per modification, not per file). Whether an
+ * author has touched a file before is answered by a set of (author, file)
+ * pairs.
+ *
+ * The counters are indexed by the author's interned ID, and both the counters
+ * and the set are saved in snapshots, so after an incremental pull the counts
+ * are up to date without touching the graphs.
+ *
+ * The top N authors are found with a min-heap of size N over the counters:
+ * an author only goes into the heap if it beats the smallest count in there.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "illumetrics_impl.h"
+
+#define	DEG_SET_MIN_SZ	(1 << 16)
+
+ilm_vec_t deg_counts; /* author_deg_t, indexed by the author's ilm_id_t */
+uint64_t *deg_set; /* (author << 32) | file, 0 if empty */
+uint64_t deg_set_sz; /* power of 2 */
+uint64_t deg_set_n;
+int deg_set_mapped; /* bool, deg_set is in a snapshot */
+
+void
+deg_init()
+{
+	ilm_vec_init(&deg_counts, sizeof (author_deg_t));
+	deg_set_sz = DEG_SET_MIN_SZ;
+	deg_set = ilm_mk_zbuf(sizeof (uint64_t) * deg_set_sz);
+}
+
+/*
+ * Returns the author's counters, growing the array if needed.
+ */
+author_deg_t *
+deg_get(ilm_id_t author)
+{
+	if (author >= deg_counts.v_len) {
+		uint64_t old = deg_counts.v_len;
+		author_deg_t *d = ilm_vec_append(&deg_counts, author + 1 - old);
+		bzero(d, sizeof (author_deg_t) * (author + 1 - old));
+	}
+	return (ILM_VEC_GET(&deg_counts, author_deg_t, author));
+}
+
+uint64_t
+deg_hash(uint64_t key)
+{
+	/* the finalizer of MurmurHash3 */
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return (key);
+}
+
+void
+deg_set_grow()
+{
+	uint64_t osz = deg_set_sz;
+	uint64_t *oset = deg_set;
+	deg_set_sz = osz * 2;
+	deg_set = ilm_mk_zbuf(sizeof (uint64_t) * deg_set_sz);
+	uint64_t mask = deg_set_sz - 1;
+	uint64_t i = 0;
+	while (i < osz) {
+		if (oset[i] != 0) {
+			uint64_t b = deg_hash(oset[i]) & mask;
+			while (deg_set[b] != 0) {
+				b = (b + 1) & mask;
+			}
+			deg_set[b] = oset[i];
+		}
+		i++;
+	}
+	if (!deg_set_mapped) {
+		ilm_rm_buf(oset, sizeof (uint64_t) * osz);
+	}
+	deg_set_mapped = 0;
+}
+
+void
+deg_add_commit(ilm_id_t author)
+{
+	deg_get(author)->ad_commits++;
+}
+
+void
+deg_add_file(ilm_id_t author, ilm_id_t file)
+{
+	uint64_t key = ((uint64_t)author << 32) | file;
+	uint64_t mask = deg_set_sz - 1;
+	uint64_t b = deg_hash(key) & mask;
+	while (deg_set[b] != 0) {
+		if (deg_set[b] == key) {
+			return;
+		}
+		b = (b + 1) & mask;
+	}
+	deg_set[b] = key;
+	deg_set_n++;
+	deg_get(author)->ad_files++;
+	/* keep the load factor under 3/4 */
+	if (deg_set_n * 4 > deg_set_sz * 3) {
+		deg_set_grow();
+	}
+}
+
+uint32_t
+deg_value(author_deg_t *d, qwork_t qw)
+{
+	return (qw == QW_FILE ? d->ad_files : d->ad_commits);
+}
+
+typedef struct deg_rank {
+	uint32_t	dr_deg;
+	ilm_id_t	dr_author;
+} deg_rank_t;
+
+/*
+ * Orders the heap: a smaller degree is "less", and on ties the later author is,
+ * so that the output doesn't depend on the order of the counters.
+ */
+int
+deg_less(deg_rank_t *a, deg_rank_t *b)
+{
+	if (a->dr_deg != b->dr_deg) {
+		return (a->dr_deg < b->dr_deg);
+	}
+	return (a->dr_author > b->dr_author);
+}
+
+void
+deg_sift_down(deg_rank_t *h, uint32_t n, uint32_t i)
+{
+	while (1) {
+		uint32_t m = i;
+		uint32_t l = 2 * i + 1;
+		uint32_t r = 2 * i + 2;
+		if (l < n && deg_less(&h[l], &h[m])) {
+			m = l;
+		}
+		if (r < n && deg_less(&h[r], &h[m])) {
+			m = r;
+		}
+		if (m == i) {
+			return;
+		}
+		deg_rank_t t = h[i];
+		h[i] = h[m];
+		h[m] = t;
+		i = m;
+	}
+}
+
+void
+deg_sift_up(deg_rank_t *h, uint32_t i)
+{
+	while (i > 0) {
+		uint32_t p = (i - 1) / 2;
+		if (!deg_less(&h[i], &h[p])) {
+			return;
+		}
+		deg_rank_t t = h[i];
+		h[i] = h[p];
+		h[p] = t;
+		i = p;
+	}
+}
+
+/*
+ * Prints the `top` authors with the highest degree, measured in commits or in
+ * distinct files depending on `qw`. A `top` of 0 prints every author.
+ */
+void
+deg_print_top(uint32_t top, qwork_t qw)
+{
+	uint32_t nauthors = 0;
+	uint64_t a = 0;
+	while (a < deg_counts.v_len) {
+		author_deg_t *d = ILM_VEC_GET(&deg_counts, author_deg_t, a);
+		nauthors += d->ad_commits > 0;
+		a++;
+	}
+	if (top == 0 || top > nauthors) {
+		top = nauthors;
+	}
+	deg_rank_t *h = ilm_mk_buf(sizeof (deg_rank_t) * (top + 1));
+	uint32_t n = 0;
+	a = 0;
+	while (a < deg_counts.v_len && top > 0) {
+		author_deg_t *d = ILM_VEC_GET(&deg_counts, author_deg_t, a);
+		deg_rank_t r;
+		r.dr_deg = deg_value(d, qw);
+		r.dr_author = a;
+		a++;
+		if (d->ad_commits == 0) {
+			continue;
+		}
+		if (n < top) {
+			h[n] = r;
+			deg_sift_up(h, n);
+			n++;
+		} else if (deg_less(&h[0], &r)) {
+			h[0] = r;
+			deg_sift_down(h, n, 0);
+		}
+	}
+	/* pop the heap from the back, which leaves it sorted biggest first */
+	while (n > 1) {
+		deg_rank_t t = h[0];
+		h[0] = h[n - 1];
+		h[n - 1] = t;
+		n--;
+		deg_sift_down(h, n, 0);
+	}
+	uint32_t i = 0;
+	while (i < top) {
+		printf("%6u %12u  %s\n", i + 1, h[i].dr_deg,
+		    ilm_id_str(h[i].dr_author));
+		i++;
+	}
+	ilm_rm_buf(h, sizeof (deg_rank_t) * (top + 1));
+}
+
+void
+deg_snap_write(snap_writer_t *sw)
+{
+	snap_vec_write(sw, SK_DEG_COUNTS, &deg_counts);
+	snap_sect_begin(sw, SK_DEG_SET, deg_set_n);
+	snap_sect_write(sw, deg_set, sizeof (uint64_t) * deg_set_sz);
+	snap_sect_end(sw);
+}
+
+int
+deg_snap_load(snap_t *s)
+{
+	uint64_t len;
+	uint64_t n;
+	uint64_t *set = snap_sect(s, SK_DEG_SET, &len, &n);
+	uint64_t sz = len / sizeof (uint64_t);
+	if (sz < DEG_SET_MIN_SZ || (sz & (sz - 1)) != 0 || n * 4 > sz * 3 ||
+	    snap_vec_load(s, SK_DEG_COUNTS, &deg_counts) != 0) {
+		return (-1);
+	}
+	ilm_rm_buf(deg_set, sizeof (uint64_t) * deg_set_sz);
+	deg_set = set;
+	deg_set_sz = sz;
+	deg_set_n = n;
+	deg_set_mapped = 1;
+	return (0);
+}
@@ -0,0 +1,412 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Parallel Tree Diffs
+ * ===================
+ *
+ * Walking the history of a repository is cheap. Diffing each commit's tree
+ * against its parent's tree, to find out which files it touched, is not. On a
+ * repository like illumos-gate it is where nearly all of the time goes. So
+ * repo_get_next_commit() walks ahead, and collects a batch of commits into
+ * the slots of a diff_batch_t. The slots are split into chunks, and a pool of
+ * threads diffs the chunks in parallel. Once the whole batch has been diffed,
+ * repo_get_next_commit() hands the slots out in the order in which they were
+ * walked. So the graphs come out exactly as they would from a serial run.
+ *
+ * Each thread owns a deque of chunks. It pops chunks off the bottom of its own
+ * deque, and when that runs dry it steals chunks off the top of another
+ * thread's deque. Some commits touch thousands of files while others touch
+ * one, so chunks vary wildly in cost, and stealing is what keeps all of the
+ * threads busy until the end of the batch.
+ *
+ * libgit2 objects can't be shared between threads, so every thread opens its
+ * own handle on the repository, which it keeps for the lifetime of the batch.
+ *
+ * A commit that was already ingested from another repository isn't diffed
+ * again, since the graph builder is going to skip it anyway (see
+ * illumetrics_cset.c).
+ *
+ * The files of the slots are allocated from an arena per thread, and the
+ * parents from the walker's arena. All of them are freed at once when the
+ * batch is drained, so a batch costs a handful of allocations, however many
+ * commits and files are in it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include "illumetrics_impl.h"
+
+/* number of commits we walk ahead of the graph builder */
+#define	DIFF_BATCH_SZ		4096
+/* number of chunks per thread, more chunks means finer-grained stealing */
+#define	DIFF_CHUNKS_PER_THR	8
+/* size of the blocks of the arenas */
+#define	DIFF_ARENA_BLKSZ	(64 * 1024)
+
+typedef struct diff_chunk {
+	uint32_t	dc_start;
+	uint32_t	dc_end; /* exclusive */
+} diff_chunk_t;
+
+typedef struct diff_deque {
+	pthread_mutex_t	dq_lock;
+	diff_chunk_t	*dq_chunks;
+	uint32_t	dq_top; /* thieves take from here */
+	uint32_t	dq_bot; /* the owner takes from here */
+} diff_deque_t;
+
+typedef struct diff_worker {
+	struct diff_batch	*dw_batch;
+	int			dw_id;
+	git_repository		*dw_git;
+	diff_deque_t		dw_deque;
+	pthread_t		dw_thread;
+	ilm_arena_t		dw_arena; /* the files of the slots it diffed */
+	uint64_t		dw_skipped; /* already in the commit set */
+	uint64_t		dw_diffed;
+} diff_worker_t;
+
+struct diff_batch {
+	diff_slot_t	*db_slots;
+	uint32_t	db_n; /* slots filled by the walker */
+	uint32_t	db_next; /* next slot to hand out */
+	int		db_nworkers;
+	int		db_wcap; /* workers allocated */
+	diff_worker_t	*db_workers;
+	ilm_arena_t	db_arena; /* the parents of the slots */
+};
+
+diff_batch_t *
+diff_batch_create(char *repo_path)
+{
+	diff_batch_t *db = ilm_mk_zbuf(sizeof (diff_batch_t));
+	db->db_slots = ilm_mk_zbuf(sizeof (diff_slot_t) * DIFF_BATCH_SZ);
+	db->db_nworkers = ilm_nthreads();
+	db->db_wcap = db->db_nworkers;
+	db->db_workers = ilm_mk_zbuf(sizeof (diff_worker_t) * db->db_wcap);
+	ilm_arena_init(&db->db_arena, DIFF_ARENA_BLKSZ);
+	int i = 0;
+	while (i < db->db_nworkers) {
+		diff_worker_t *dw = &db->db_workers[i];
+		dw->dw_batch = db;
+		dw->dw_id = i;
+		int error = git_repository_open(&dw->dw_git, repo_path);
+		if (error < 0) {
+			db->db_nworkers = i;
+			diff_batch_destroy(db);
+			return (NULL);
+		}
+		dw->dw_deque.dq_chunks = ilm_mk_zbuf(sizeof (diff_chunk_t) *
+		    DIFF_CHUNKS_PER_THR);
+		(void) pthread_mutex_init(&dw->dw_deque.dq_lock, NULL);
+		ilm_arena_init(&dw->dw_arena, DIFF_ARENA_BLKSZ);
+		i++;
+	}
+	return (db);
+}
+
+void
+diff_batch_destroy(diff_batch_t *db)
+{
+	int i = 0;
+	while (i < db->db_nworkers) {
+		diff_worker_t *dw = &db->db_workers[i];
+		git_repository_free(dw->dw_git);
+		ilm_rm_buf(dw->dw_deque.dq_chunks, sizeof (diff_chunk_t) *
+		    DIFF_CHUNKS_PER_THR);
+		(void) pthread_mutex_destroy(&dw->dw_deque.dq_lock);
+		ilm_arena_fini(&dw->dw_arena);
+		i++;
+	}
+	ilm_arena_fini(&db->db_arena);
+	ilm_rm_buf(db->db_workers, sizeof (diff_worker_t) * db->db_wcap);
+	ilm_rm_buf(db->db_slots, sizeof (diff_slot_t) * DIFF_BATCH_SZ);
+	ilm_rm_buf(db, sizeof (diff_batch_t));
+}
+
+/*
+ * Returns the next empty slot, or NULL if the batch is full. The walker fills
+ * in everything except for the files.
+ */
+diff_slot_t *
+diff_batch_slot(diff_batch_t *db)
+{
+	if (db->db_n == DIFF_BATCH_SZ) {
+		return (NULL);
+	}
+	diff_slot_t *ds = &db->db_slots[db->db_n];
+	db->db_n++;
+	return (ds);
+}
+
+/*
+ * Gives back the slot most recently returned by diff_batch_slot(), because the
+ * walker decided not to use it after all.
+ */
+void
+diff_batch_unslot(diff_batch_t *db)
+{
+	db->db_n--;
+}
+
+/*
+ * Returns room for the `np` parents of slot `ds`.
+ */
+sha1_t *
+diff_slot_parents(diff_batch_t *db, diff_slot_t *ds, int np)
+{
+	ds->ds_parents = ilm_arena_alloc(&db->db_arena, sizeof (sha1_t) * np);
+	ds->ds_nparents = np;
+	return (ds->ds_parents);
+}
+
+/*
+ * Returns the next diffed slot, in walk order, or NULL once the batch has
+ * been drained. Draining the batch empties it, and frees the files and
+ * parents of all of its slots.
+ */
+diff_slot_t *
+diff_batch_next(diff_batch_t *db)
+{
+	if (db->db_next == db->db_n) {
+		db->db_next = 0;
+		db->db_n = 0;
+		ilm_arena_reset(&db->db_arena);
+		int i = 0;
+		while (i < db->db_nworkers) {
+			ilm_arena_reset(&db->db_workers[i].dw_arena);
+			i++;
+		}
+		return (NULL);
+	}
+	diff_slot_t *ds = &db->db_slots[db->db_next];
+	db->db_next++;
+	return (ds);
+}
+
+/*
+ * Diffs the tree of commit `sha1` against its parent's tree. A root commit is
+ * diffed against the empty tree. Merge commits aren't diffed at all, and get
+ * a NULL diff: the changes they bring in are already attributed to the
+ * commits that were merged, just like in the default output of
+ * `git log --stat`.
+ */
+int
+diff_commit(git_repository *g, sha1_t *sha1, git_diff **diffp)
+{
+	git_commit *gc = NULL;
+	git_tree *tree = NULL;
+	git_tree *ptree = NULL;
+	git_commit *parent = NULL;
+	git_oid oid;
+	*diffp = NULL;
+	sha1_to_oid(&oid, sha1);
+	int error = git_commit_lookup(&gc, g, &oid);
+	if (error < 0) {
+		goto out;
+	}
+	unsigned int nparents = git_commit_parentcount(gc);
+	if (nparents > 1) {
+		goto out;
+	}
+	error = git_commit_tree(&tree, gc);
+	if (error < 0) {
+		goto out;
+	}
+	if (nparents == 1) {
+		error = git_commit_parent(&parent, gc, 0);
+		if (error < 0) {
+			goto out;
+		}
+		error = git_commit_tree(&ptree, parent);
+		if (error < 0) {
+			goto out;
+		}
+	}
+	error = git_diff_tree_to_tree(diffp, g, ptree, tree, NULL);
+
+out:
+	git_tree_free(ptree);
+	git_commit_free(parent);
+	git_tree_free(tree);
+	git_commit_free(gc);
+	return (error);
+}
+
+/*
+ * Fills in the slot's files with the paths that its commit touched. The files
+ * are allocated from the worker's arena.
+ */
+int
+diff_slot_files(diff_worker_t *dw, diff_slot_t *ds)
+{
+	git_diff *diff;
+	repo_commit_t *c = &ds->ds_commit;
+	c->rc_nfiles = 0;
+	ds->ds_files = NULL;
+	int error = diff_commit(dw->dw_git, &c->rc_sha1, &diff);
+	if (error < 0 || diff == NULL) {
+		git_diff_free(diff);
+		return (error);
+	}
+	int ndeltas = git_diff_num_deltas(diff);
+	ds->ds_files = ilm_arena_alloc(&dw->dw_arena,
+	    sizeof (ilm_id_t) * ndeltas);
+	int i = 0;
+	while (i < ndeltas) {
+		const git_diff_delta *d = git_diff_get_delta(diff, i);
+		ds->ds_files[i] = ilm_intern_str(d->new_file.path);
+		i++;
+	}
+	c->rc_nfiles = ndeltas;
+	git_diff_free(diff);
+	return (0);
+}
+
+/*
+ * The owner takes chunks from the bottom of its deque...
+ */
+int
+deque_pop(diff_deque_t *dq, diff_chunk_t *dc)
+{
+	int got = 0;
+	(void) pthread_mutex_lock(&dq->dq_lock);
+	if (dq->dq_bot > dq->dq_top) {
+		dq->dq_bot--;
+		*dc = dq->dq_chunks[dq->dq_bot];
+		got = 1;
+	}
+	(void) pthread_mutex_unlock(&dq->dq_lock);
+	return (got);
+}
+
+/*
+ * ...and thieves take them from the top. So the owner and the thieves only
+ * ever contend for the last chunk.
+ */
+int
+deque_steal(diff_deque_t *dq, diff_chunk_t *dc)
+{
+	int got = 0;
+	(void) pthread_mutex_lock(&dq->dq_lock);
+	if (dq->dq_bot > dq->dq_top) {
+		*dc = dq->dq_chunks[dq->dq_top];
+		dq->dq_top++;
+		got = 1;
+	}
+	(void) pthread_mutex_unlock(&dq->dq_lock);
+	return (got);
+}
+
+void *
+diff_worker(void *arg)
+{
+	diff_worker_t *dw = arg;
+	diff_batch_t *db = dw->dw_batch;
+	diff_chunk_t dc;
+	while (1) {
+		int got = deque_pop(&dw->dw_deque, &dc);
+		int v = 1;
+		while (!got && v < db->db_nworkers) {
+			diff_worker_t *victim =
+			    &db->db_workers[(dw->dw_id + v) % db->db_nworkers];
+			got = deque_steal(&victim->dw_deque, &dc);
+			v++;
+		}
+		if (!got) {
+			/* chunks are never added mid-batch, so we're done */
+			break;
+		}
+		uint32_t i = dc.dc_start;
+		while (i < dc.dc_end) {
+			diff_slot_t *ds = &db->db_slots[i];
+			if (cset_has(&ds->ds_commit.rc_sha1)) {
+				ds->ds_commit.rc_nfiles = 0;
+				ds->ds_files = NULL;
+				ds->ds_error = 0;
+				dw->dw_skipped++;
+				ILLUMETRICS_COMMIT_DEDUP(ds->ds_commit.rc_repo,
+				    (uint8_t *)&ds->ds_commit.rc_sha1);
+			} else {
+				ds->ds_error = diff_slot_files(dw, ds);
+				dw->dw_diffed++;
+				ILLUMETRICS_COMMIT_DIFFED(ds->ds_commit.rc_repo,
+				    (uint8_t *)&ds->ds_commit.rc_sha1,
+				    ds->ds_commit.rc_nfiles);
+			}
+			i++;
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Diffs every slot in the batch. The slots are cut into equally sized chunks,
+ * which are dealt out round-robin, so that every thread starts out with
+ * commits from across the whole batch.
+ */
+void
+diff_batch_run(diff_batch_t *db)
+{
+	if (db->db_n == 0) {
+		return;
+	}
+	int nw = db->db_nworkers;
+	uint32_t nchunks = nw * DIFF_CHUNKS_PER_THR;
+	uint32_t csz = (db->db_n + nchunks - 1) / nchunks;
+	uint32_t start = 0;
+	uint32_t c = 0;
+	while (start < db->db_n) {
+		diff_deque_t *dq = &db->db_workers[c % nw].dw_deque;
+		uint32_t end = start + csz;
+		if (end > db->db_n) {
+			end = db->db_n;
+		}
+		dq->dq_chunks[dq->dq_bot].dc_start = start;
+		dq->dq_chunks[dq->dq_bot].dc_end = end;
+		dq->dq_bot++;
+		start = end;
+		c++;
+	}
+	if (nw == 1) {
+		(void) diff_worker(&db->db_workers[0]);
+	} else {
+		int i = 0;
+		while (i < nw) {
+			int pc = pthread_create(&db->db_workers[i].dw_thread,
+			    NULL, diff_worker, &db->db_workers[i]);
+			if (pc != 0) {
+				fprintf(stderr,
+				    "diff_batch_run:pthread_create: %s\n",
+				    strerror(pc));
+				exit(-1);
+			}
+			i++;
+		}
+		i = 0;
+		while (i < nw) {
+			(void) pthread_join(db->db_workers[i].dw_thread, NULL);
+			i++;
+		}
+	}
+	int i = 0;
+	while (i < nw) {
+		diff_worker_t *dw = &db->db_workers[i];
+		dw->dw_deque.dq_top = 0;
+		dw->dw_deque.dq_bot = 0;
+		cset_count_diffs(dw->dw_skipped, dw->dw_diffed);
+		dw->dw_skipped = 0;
+		dw->dw_diffed = 0;
+		i++;
+	}
+}
@@ -0,0 +1,170 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Edge Logs
+ * =========
+ *
+ * Every edge that build_graphs_foldr() adds to one of the global graphs is
+ * appended to that graph's edge log, as a pair of node keys (see NODE_KEY()).
+ * The log is a flat array, so it can be saved in a snapshot and mapped back in
+ * as-is (see illumetrics_snap.c). The edge logs are the only record of the
+ * graphs that the analyses read.
+ *
+ * An edge is logged every time it is added, so the logs can contain the same
+ * edge many times (i.e. an author that touches a file in 10 commits adds 10
+ * file -> author edges, and every commit adds an edge from each of its
+ * directories). Before a log is read or saved, it is sorted, and the copies of
+ * each edge are merged into one edge, whose weight is the number of copies.
+ * That's the weight that csr_freeze() gives the edge, so nothing is lost, and
+ * the snapshot only holds each edge once. Since the merged log is sorted, the
+ * edges out of a node can be found by binary search.
+ *
+ * Edges that are logged after a merge (e.g. by a `pull` on top of a snapshot)
+ * are merged in the next time the log is read or saved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "illumetrics_impl.h"
+
+ilm_vec_t graph_elog[GR_NGRAPHS]; /* ilm_edge_t */
+ilm_vec_t graph_ewt[GR_NGRAPHS]; /* uint32_t, the weight of each edge */
+uint64_t graph_merged[GR_NGRAPHS]; /* the log is merged if it's this long */
+
+typedef struct graph_wedge {
+	ilm_edge_t	gw_edge;
+	uint64_t	gw_wt;
+} graph_wedge_t;
+
+void
+graph_init()
+{
+	int g = 0;
+	while (g < GR_NGRAPHS) {
+		ilm_vec_init(&graph_elog[g], sizeof (ilm_edge_t));
+		ilm_vec_init(&graph_ewt[g], sizeof (uint32_t));
+		g++;
+	}
+}
+
+void
+graph_log_edge(graph_id_t g, uint64_t src, uint64_t dst)
+{
+	ilm_edge_t *e = ilm_vec_append(&graph_elog[g], 1);
+	e->ed_src = src;
+	e->ed_dst = dst;
+	*(uint32_t *)ilm_vec_append(&graph_ewt[g], 1) = 1;
+}
+
+int
+graph_edge_cmp(const void *a, const void *b)
+{
+	const ilm_edge_t *ea = a;
+	const ilm_edge_t *eb = b;
+	if (ea->ed_src != eb->ed_src) {
+		return (ea->ed_src < eb->ed_src ? -1 : 1);
+	}
+	return (ea->ed_dst < eb->ed_dst ? -1 : ea->ed_dst > eb->ed_dst);
+}
+
+/*
+ * Sorts the log, and merges the copies of each edge.
+ */
+void
+graph_merge(graph_id_t g)
+{
+	ilm_vec_t *el = &graph_elog[g];
+	ilm_vec_t *ew = &graph_ewt[g];
+	uint64_t n = el->v_len;
+	if (n == graph_merged[g]) {
+		return;
+	}
+	ilm_edge_t *e = el->v_buf;
+	uint32_t *w = ew->v_buf;
+	graph_wedge_t *we = ilm_mk_buf_as(sizeof (graph_wedge_t) * n,
+	    AC_SCRATCH);
+	uint64_t i = 0;
+	while (i < n) {
+		we[i].gw_edge = e[i];
+		we[i].gw_wt = w[i];
+		i++;
+	}
+	qsort(we, n, sizeof (graph_wedge_t), graph_edge_cmp);
+
+	ilm_vec_t nel;
+	ilm_vec_t nwt;
+	ilm_vec_init(&nel, sizeof (ilm_edge_t));
+	ilm_vec_init(&nwt, sizeof (uint32_t));
+	i = 0;
+	while (i < n) {
+		ilm_edge_t ed = we[i].gw_edge;
+		uint64_t wt = we[i].gw_wt;
+		i++;
+		while (i < n && we[i].gw_edge.ed_src == ed.ed_src &&
+		    we[i].gw_edge.ed_dst == ed.ed_dst) {
+			wt += we[i].gw_wt;
+			i++;
+		}
+		if (wt > UINT32_MAX) {
+			wt = UINT32_MAX;
+		}
+		*(ilm_edge_t *)ilm_vec_append(&nel, 1) = ed;
+		*(uint32_t *)ilm_vec_append(&nwt, 1) = wt;
+	}
+	ilm_rm_buf(we, sizeof (graph_wedge_t) * n);
+	ilm_vec_fini(el);
+	ilm_vec_fini(ew);
+	*el = nel;
+	*ew = nwt;
+	graph_merged[g] = el->v_len;
+}
+
+/*
+ * Returns the merged edge log of the graph, stores its length in `*n`, and
+ * the weight of each edge in `*wt`. The edges are sorted by source, then by
+ * destination.
+ */
+ilm_edge_t *
+graph_edges(graph_id_t g, uint64_t *n, uint32_t **wt)
+{
+	graph_merge(g);
+	*n = graph_elog[g].v_len;
+	*wt = graph_ewt[g].v_buf;
+	return (graph_elog[g].v_buf);
+}
+
+void
+graph_snap_write(snap_writer_t *sw)
+{
+	int g = 0;
+	while (g < GR_NGRAPHS) {
+		graph_merge(g);
+		snap_vec_write(sw, SK_EDGES + g, &graph_elog[g]);
+		snap_vec_write(sw, SK_EDGE_WTS + g, &graph_ewt[g]);
+		g++;
+	}
+}
+
+int
+graph_snap_load(snap_t *s)
+{
+	int g = 0;
+	while (g < GR_NGRAPHS) {
+		if (snap_vec_load(s, SK_EDGES + g, &graph_elog[g]) != 0 ||
+		    snap_vec_load(s, SK_EDGE_WTS + g, &graph_ewt[g]) != 0 ||
+		    graph_elog[g].v_len != graph_ewt[g].v_len) {
+			return (-1);
+		}
+		graph_merged[g] = graph_elog[g].v_len;
+		g++;
+	}
+	return (0);
+}
@@ -0,0 +1,287 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Neighborhoods
+ * =============
+ *
+ * `centrality -a X -d N` lists the authors that are at most N hops away from
+ * X in a frozen, undirected graph, with the hop distance of each, and the
+ * weight of the heaviest shortest path to each (the sum of the edge weights
+ * along it, which for the author projection is the number of shared files).
+ *
+ * This is a breadth-first search that stops after N levels, and it's run
+ * interactively, so we care about the latency of a single search:
+ *
+ *  - The search is direction-optimizing. A level is normally expanded top
+ *  down: every vertex in the frontier looks at its neighbors. But in a
+ *  small-world graph the frontier soon covers a good part of the graph, and
+ *  then most of those neighbors have been visited already. So once the
+ *  frontier has more edges than the unvisited vertices (scaled by
+ *  HOOD_ALPHA), we expand bottom up: every unvisited vertex looks for a
+ *  neighbor in the frontier, and stops at the first one it finds. When the
+ *  frontier shrinks below n / HOOD_BETA vertices, we switch back.
+ *
+ *  - All of the per-vertex state lives in a hood_t, which is made once per
+ *  graph and reused by every search. A search only clears what it touched, so
+ *  a search that reaches a handful of authors costs a handful of steps, no
+ *  matter how big the graph is.
+ *
+ * Bottom-up steps stop at the first parent, so they can't find the heaviest
+ * path. The weights are filled in after the search, by a pass over the
+ * visited vertices in BFS order that looks at the neighbors one level up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "illumetrics_impl.h"
+
+#define	HOOD_ALPHA	14
+#define	HOOD_BETA	24
+
+#define	BIT_TEST(bm, v)	(((bm)[(v) >> 6] >> ((v) & 63)) & 1)
+#define	BIT_SET(bm, v)	((bm)[(v) >> 6] |= 1ULL << ((v) & 63))
+#define	BIT_CLR(bm, v)	((bm)[(v) >> 6] &= ~(1ULL << ((v) & 63)))
+
+hood_t *
+hood_create(csr_t *g)
+{
+	hood_t *hd = ilm_mk_zbuf_as(sizeof (hood_t), AC_SCRATCH);
+	uint32_t n = g->cs_nverts;
+	hd->hd_g = g;
+	hd->hd_nwords = (n + 63) / 64;
+	hd->hd_visited = ilm_mk_zbuf_as(sizeof (uint64_t) * (hd->hd_nwords + 1),
+	    AC_SCRATCH);
+	hd->hd_front = ilm_mk_zbuf_as(sizeof (uint64_t) * (hd->hd_nwords + 1),
+	    AC_SCRATCH);
+	hd->hd_queue = ilm_mk_buf_as(sizeof (uint32_t) * (n + 1), AC_SCRATCH);
+	hd->hd_dist = ilm_mk_buf_as(sizeof (uint32_t) * (n + 1), AC_SCRATCH);
+	hd->hd_weight = ilm_mk_buf_as(sizeof (uint64_t) * (n + 1), AC_SCRATCH);
+	return (hd);
+}
+
+void
+hood_destroy(hood_t *hd)
+{
+	uint32_t n = hd->hd_g->cs_nverts;
+	ilm_rm_buf(hd->hd_visited, sizeof (uint64_t) * (hd->hd_nwords + 1));
+	ilm_rm_buf(hd->hd_front, sizeof (uint64_t) * (hd->hd_nwords + 1));
+	ilm_rm_buf(hd->hd_queue, sizeof (uint32_t) * (n + 1));
+	ilm_rm_buf(hd->hd_dist, sizeof (uint32_t) * (n + 1));
+	ilm_rm_buf(hd->hd_weight, sizeof (uint64_t) * (n + 1));
+	ilm_rm_buf(hd, sizeof (hood_t));
+}
+
+/*
+ * Visits `v` at distance `d`.
+ */
+void
+hood_visit(hood_t *hd, uint32_t v, uint32_t d)
+{
+	BIT_SET(hd->hd_visited, v);
+	hd->hd_dist[v] = d;
+	hd->hd_queue[hd->hd_nvisited++] = v;
+}
+
+/*
+ * Expands the frontier, queue[fs..fe), top down. Returns the number of edges
+ * of the new frontier.
+ */
+uint64_t
+hood_top_down(hood_t *hd, uint32_t fs, uint32_t fe, uint32_t d)
+{
+	csr_t *g = hd->hd_g;
+	uint64_t mf = 0;
+	while (fs < fe) {
+		uint32_t v = hd->hd_queue[fs++];
+		uint64_t i = g->cs_off[v];
+		while (i < g->cs_off[v + 1]) {
+			uint32_t w = g->cs_adj[i++];
+			if (!BIT_TEST(hd->hd_visited, w)) {
+				hood_visit(hd, w, d);
+				mf += CSR_DEG(g, w);
+			}
+		}
+	}
+	return (mf);
+}
+
+/*
+ * Expands the frontier, queue[fs..fe), bottom up. Returns the number of edges
+ * of the new frontier.
+ */
+uint64_t
+hood_bottom_up(hood_t *hd, uint32_t fs, uint32_t fe, uint32_t d)
+{
+	csr_t *g = hd->hd_g;
+	uint64_t mf = 0;
+	uint32_t i = fs;
+	while (i < fe) {
+		BIT_SET(hd->hd_front, hd->hd_queue[i]);
+		i++;
+	}
+	uint64_t wd = 0;
+	while (wd < hd->hd_nwords) {
+		/* 64 unvisited vertices at a time */
+		uint64_t unv = ~hd->hd_visited[wd];
+		while (unv != 0) {
+			uint32_t v = wd * 64 + __builtin_ctzll(unv);
+			unv &= unv - 1;
+			if (v >= g->cs_nverts) {
+				break;
+			}
+			uint64_t j = g->cs_off[v];
+			while (j < g->cs_off[v + 1]) {
+				if (BIT_TEST(hd->hd_front, g->cs_adj[j])) {
+					hood_visit(hd, v, d);
+					mf += CSR_DEG(g, v);
+					break;
+				}
+				j++;
+			}
+		}
+		wd++;
+	}
+	i = fs;
+	while (i < fe) {
+		BIT_CLR(hd->hd_front, hd->hd_queue[i]);
+		i++;
+	}
+	return (mf);
+}
+
+/*
+ * Finds the vertices within `maxd` hops of `src`. Returns how many there are
+ * (`src` included). They are in hd_queue, in order of distance, and their
+ * distances and path weights are in hd_dist and hd_weight.
+ */
+uint32_t
+hood_query(hood_t *hd, uint32_t src, uint32_t maxd)
+{
+	csr_t *g = hd->hd_g;
+	uint32_t n = g->cs_nverts;
+
+	/* clean up after the previous search */
+	uint32_t i = 0;
+	while (i < hd->hd_nvisited) {
+		BIT_CLR(hd->hd_visited, hd->hd_queue[i]);
+		i++;
+	}
+	hd->hd_nvisited = 0;
+
+	hood_visit(hd, src, 0);
+	uint64_t mf = CSR_DEG(g, src);
+	uint64_t mu = g->cs_nedges - mf;
+	uint32_t fs = 0;
+	uint32_t fe = 1;
+	uint32_t d = 1;
+	int bottom_up = 0;
+	while (d <= maxd && fs < fe) {
+		uint32_t nf = fe - fs;
+		if (!bottom_up && mf > mu / HOOD_ALPHA) {
+			bottom_up = 1;
+		} else if (bottom_up && nf < n / HOOD_BETA) {
+			bottom_up = 0;
+		}
+		if (bottom_up) {
+			mf = hood_bottom_up(hd, fs, fe, d);
+		} else {
+			mf = hood_top_down(hd, fs, fe, d);
+		}
+		mu -= mf < mu ? mf : mu;
+		fs = fe;
+		fe = hd->hd_nvisited;
+		d++;
+	}
+
+	/* the heaviest shortest path to v extends one to a parent of v */
+	hd->hd_weight[src] = 0;
+	i = 1;
+	while (i < hd->hd_nvisited) {
+		uint32_t v = hd->hd_queue[i];
+		uint64_t best = 0;
+		uint64_t j = g->cs_off[v];
+		while (j < g->cs_off[v + 1]) {
+			uint32_t u = g->cs_adj[j];
+			if (BIT_TEST(hd->hd_visited, u) &&
+			    hd->hd_dist[u] + 1 == hd->hd_dist[v] &&
+			    hd->hd_weight[u] + g->cs_wt[j] > best) {
+				best = hd->hd_weight[u] + g->cs_wt[j];
+			}
+			j++;
+		}
+		hd->hd_weight[v] = best;
+		i++;
+	}
+	return (hd->hd_nvisited);
+}
+
+typedef struct hood_rank {
+	uint32_t	hr_dist;
+	uint32_t	hr_v;
+	uint64_t	hr_weight;
+} hood_rank_t;
+
+int
+hood_rank_cmp(const void *a, const void *b)
+{
+	const hood_rank_t *ra = a;
+	const hood_rank_t *rb = b;
+	if (ra->hr_dist != rb->hr_dist) {
+		return (ra->hr_dist < rb->hr_dist ? -1 : 1);
+	}
+	if (ra->hr_weight != rb->hr_weight) {
+		return (ra->hr_weight > rb->hr_weight ? -1 : 1);
+	}
+	return (ra->hr_v < rb->hr_v ? -1 : ra->hr_v > rb->hr_v);
+}
+
+/*
+ * Prints the result of the last search, nearest first and heaviest first
+ * within a distance, leaving out the source. At most `top` neighbors are
+ * printed, or all of them if `top` is 0. The weights are divided by `scale`,
+ * for graphs whose weights are in fixed point.
+ */
+void
+hood_print(hood_t *hd, uint32_t top, uint32_t scale)
+{
+	uint32_t n = hd->hd_nvisited - 1;
+	if (top == 0 || top > n) {
+		top = n;
+	}
+	hood_rank_t *r = ilm_mk_buf_as(sizeof (hood_rank_t) * (n + 1),
+	    AC_SCRATCH);
+	uint32_t i = 0;
+	while (i < n) {
+		uint32_t v = hd->hd_queue[i + 1];
+		r[i].hr_dist = hd->hd_dist[v];
+		r[i].hr_v = v;
+		r[i].hr_weight = hd->hd_weight[v];
+		i++;
+	}
+	if (n > 0) {
+		qsort(r, n, sizeof (hood_rank_t), hood_rank_cmp);
+	}
+	i = 0;
+	while (i < top) {
+		const char *who =
+		    ilm_id_str(NODE_ID(hd->hd_g->cs_keys[r[i].hr_v]));
+		if (scale > 1) {
+			printf("%6u %4u %12.3f  %s\n", i + 1, r[i].hr_dist,
+			    (double)r[i].hr_weight / scale, who);
+		} else {
+			printf("%6u %4u %12llu  %s\n", i + 1, r[i].hr_dist,
+			    (unsigned long long)r[i].hr_weight, who);
+		}
+		i++;
+	}
+	ilm_rm_buf(r, sizeof (hood_rank_t) * (n + 1));
+}
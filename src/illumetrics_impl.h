@@ -123,12 +123,18 @@
  * common directory, and coalescing all of the commit logs.
  */
 
+/* the probes of illumetrics_provider.d, see illumetrics_sdt.h */
+#ifdef	__linux__
+#include "illumetrics_sdt.h"
+#else
 #include "illumetrics_provider.h"
+#endif
 #include <git2.h>
 #include <graph.h>
 #include <slablist.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
 
 /*
  * This is how we classify various repositories. All of these categories
@@ -161,6 +167,49 @@ typedef enum vcs {
 	SCCS
 } vcs_t;
 
+typedef struct tm tm_t;
+typedef struct git_repository git_repository_t;
+typedef struct git_remote git_remote_t;
+typedef struct git_revwalk git_revwalk_t;
+
+typedef struct sha1 {
+	uint32_t sha1_val[5];
+} sha1_t;
+
+/*
+ * The ID of an interned string. See illumetrics_intern.c.
+ */
+typedef uint32_t ilm_id_t;
+
+/*
+ * Graph nodes are keyed by interned IDs. Since an email and an author name
+ * could in principle be the same string, the kind of a node is stored in the
+ * upper half of its key, right above the ID.
+ */
+typedef enum node_kind {
+	NK_AUTHOR = 1,
+	NK_EMAIL,
+	NK_FILE,
+	NK_COMMIT,
+	NK_DIR /* keyed by path trie node, not by interned ID */
+} node_kind_t;
+
+#define	NODE_KEY(kind, id)	(((uint64_t)(kind) << 32) | (uint64_t)(id))
+#define	NODE_KIND(key)		((node_kind_t)((key) >> 32))
+#define	NODE_ID(key)		((uint32_t)(key))
+
+/*
+ * A high-water mark records the last commit that we ingested from a single
+ * ref. We keep one of these per ref, per repository, in a small state file in
+ * the repository's storage directory. The next ingestion run hides the saved
+ * commits from the history walk, so that it only visits commits that arrived
+ * since.
+ */
+typedef struct repo_hwm {
+	char	*rh_ref; /* i.e. refs/remotes/origin/master */
+	sha1_t	rh_sha1;
+} repo_hwm_t;
+
 /*
  * The repository structure used by Illumetrics is essentially metadata. It
  * contains a link to the git repository, and a type that classifies the
@@ -168,39 +217,231 @@ typedef enum vcs {
  * internet.
  */
 typedef struct repo {
+	uint32_t rp_id; /* index into repo_table */
 	char *rp_url;
 	char *rp_owner; /* the username of the patron (i.e. joyent, omniti) */
 	char *rp_name;
 	rep_type_t rp_type;
 	vcs_t rp_vcs;
-	int rp_curcom; /* current commit */
+	char *rp_upname; /* declared upstream, <owner>/<name>, or NULL */
+	struct repo *rp_upstream; /* lends us its objects, or NULL */
+	repo_hwm_t *rp_hwm; /* saved high-water marks */
+	int rp_nhwm;
+	repo_hwm_t *rp_tips; /* ref tips at the start of the last walk */
+	int rp_ntips;
+	int rp_incremental; /* bool, current walk hides rp_hwm */
+	int rp_walkerr; /* bool, the current walk hit an error */
+	git_repository_t *rp_git; /* open while walking the history */
+	git_revwalk_t *rp_walk;
+	struct diff_batch *rp_batch; /* walked, but not yet handed out */
+	int rp_walkdone; /* bool, nothing left to walk */
 } repo_t;
 
-typedef struct tm tm_t;
-typedef struct git_repository git_repository_t;
-typedef struct git_remote git_remote_t;
 /*
  * This is an abstract representation of a commit. Allows us to support
  * multiple repository formats and multiple backends (we can replace libgit2 if
- * something better comes along). Currently doesn't contain the number of
- * insertions and deletions corresponding to the files, but that metric doesn't
- * appear too important anyway. Furthermore, we don't include the commit
- * message. This could be useful in the future, but at the moment is not
- * needed. Besides, we want to use as little memory per commit as possible.
+ * something better comes along). Doesn't contain the number of insertions
+ * and deletions corresponding to the files, since only `-w line` needs them;
+ * those live in the numstat cache instead (see illumetrics_numstat.c).
+ * Furthermore, we don't include the commit message. This could be useful in
+ * the future, but at the moment is not needed. Besides, we want to use as
+ * little memory per commit as possible.
+ *
+ * Several million of these are resident at once, so the layout is packed by
+ * hand: no pointers, no padding, 48 bytes per commit.
+ *
+ *	offset	size	field
+ *	0	20	rc_sha1
+ *	20	4	rc_repo
+ *	24	8	rc_time
+ *	32	4	rc_author
+ *	36	4	rc_email
+ *	40	4	rc_foff
+ *	44	4	rc_nfiles
+ *
+ * The files touched by the commit are not in the record. They are a run of
+ * `rc_nfiles` interned IDs starting at `rc_foff` in an array that is shared by
+ * every commit in the commit store (see illumetrics_commit.c).
  */
-typedef struct sha1 {
-	uint32_t sha1_val[5];
-} sha1_t;
 typedef struct repo_commit {
-	repo_t	*rc_repo; /* bptr to repo */
-	sha1_t	*rc_sha1; /* the commit's sha1 */
-	char	*rc_author;
-	char	*rc_email;
-	char	**rc_files; /* files touched by commit */
-	int	rc_nfiles;
-	tm_t	rc_time; /* exact time of commit */
+	sha1_t		rc_sha1; /* the commit's sha1 */
+	uint32_t	rc_repo; /* repo_table index */
+	int64_t		rc_time; /* commit time, seconds since the epoch */
+	ilm_id_t	rc_author; /* interned */
+	ilm_id_t	rc_email; /* interned */
+	uint32_t	rc_foff; /* first file ID in the shared array */
+	uint32_t	rc_nfiles;
 } repo_commit_t;
 
+#define	REPO_COMMIT_SZ	48
+/* fails to compile if the layout above ever grows */
+typedef char repo_commit_sz_check[sizeof (repo_commit_t) == REPO_COMMIT_SZ ?
+    1 : -1];
+
+/*
+ * A commit of the commit set, which is the commit graph of all of the
+ * repositories, with each commit in it once. See illumetrics_cset.c.
+ */
+typedef struct cset_ent {
+	sha1_t		ce_sha1;
+	uint32_t	ce_repo; /* the repository it was first seen in */
+	uint32_t	ce_repos; /* the set of repositories it's in */
+	uint32_t	ce_poff; /* first parent in the shared array */
+} cset_ent_t;
+
+/*
+ * A commit that has been walked, but whose files are diffed by a worker
+ * thread. See illumetrics_diff.c.
+ */
+typedef struct diff_slot {
+	repo_commit_t	ds_commit;
+	ilm_id_t	*ds_files; /* in the diffing thread's arena */
+	int		ds_error; /* libgit2 error from the diff */
+	sha1_t		*ds_parents; /* in the walker's arena */
+	int		ds_nparents;
+} diff_slot_t;
+
+typedef struct diff_batch diff_batch_t;
+
+/*
+ * The graphs that we build. Every edge that is added to one of them is
+ * appended to that graph's edge log, which is what the analyses read and what
+ * gets saved in snapshots. See illumetrics_graph.c.
+ */
+typedef enum graph_id {
+	GR_EMAIL2AUTHOR,
+	GR_AUTHOR2COMMIT,
+	GR_FILE2AUTHOR,
+	GR_FILE2COMMIT,
+	GR_DIR2AUTHOR,
+	GR_DIR2COMMIT,
+	GR_NGRAPHS
+} graph_id_t;
+
+typedef struct ilm_edge {
+	uint64_t	ed_src; /* NODE_KEY() */
+	uint64_t	ed_dst;
+} ilm_edge_t;
+
+/*
+ * A graph frozen into compressed sparse row form. See illumetrics_csr.c.
+ */
+#define	CSR_NONE	UINT32_MAX /* not a vertex */
+#define	CSR_UNDIRECTED	0x1 /* store every edge in both directions */
+
+typedef struct csr {
+	uint32_t	cs_nverts;
+	int		cs_flags;
+	uint64_t	cs_nedges;
+	uint64_t	*cs_keys; /* dense ID -> NODE_KEY(), ascending */
+	uint64_t	*cs_off; /* cs_nverts + 1 offsets into cs_adj */
+	uint32_t	*cs_adj; /* neighbors, as dense IDs */
+	uint32_t	*cs_wt; /* edge weights */
+} csr_t;
+
+#define	CSR_DEG(cs, v)	((cs)->cs_off[(v) + 1] - (cs)->cs_off[(v)])
+
+/*
+ * The author <-> author projection of the file -> author graph, and the hub
+ * files that were left out of it. See illumetrics_proj.c.
+ */
+typedef struct proj_hub {
+	ilm_id_t	ph_file;
+	uint32_t	ph_nauthors;
+	uint64_t	ph_pairs; /* author pairs it would have added */
+} proj_hub_t;
+
+typedef struct proj {
+	csr_t		*pj_graph; /* weight = number of shared files */
+	proj_hub_t	*pj_hubs; /* biggest first */
+	uint32_t	pj_nhubs;
+	uint32_t	pj_hubcap;
+	uint64_t	pj_pairs; /* author pairs counted */
+	uint64_t	pj_skipped; /* author pairs in hubs */
+} proj_t;
+
+#define	PROJ_DEFAULT_HUBCAP	256
+
+/*
+ * The lines added and removed in one file by one commit. See
+ * illumetrics_numstat.c.
+ */
+typedef struct numstat_file {
+	uint32_t	nf_path; /* hash of the path */
+	uint32_t	nf_added;
+	uint32_t	nf_removed;
+} numstat_file_t;
+
+/*
+ * The reusable state of bounded-hop neighborhood searches over a frozen,
+ * undirected graph. See illumetrics_hood.c.
+ */
+typedef struct hood {
+	csr_t		*hd_g;
+	uint64_t	hd_nwords; /* words per bitmap */
+	uint64_t	*hd_visited; /* bitmap */
+	uint64_t	*hd_front; /* bitmap, the frontier of a bottom-up step */
+	uint32_t	*hd_queue; /* visited vertices, in order of distance */
+	uint32_t	hd_nvisited;
+	uint32_t	*hd_dist; /* hops, valid if visited */
+	uint64_t	*hd_weight; /* heaviest shortest path, valid if visited */
+} hood_t;
+
+/*
+ * Snapshots are made of sections, each of which belongs to one subsystem.
+ * See illumetrics_snap.c.
+ */
+typedef enum snap_kind {
+	SK_REPOS = 1,
+	SK_STR_ARENA,
+	SK_STR_PAGES,
+	SK_STR_HT,
+	SK_COMMITS,
+	SK_FIDS,
+	SK_TRIE_NODES,
+	SK_TRIE_LEAVES,
+	SK_TRIE_STAMP,
+	SK_DEG_COUNTS,
+	SK_DEG_SET,
+	SK_CSET_ENTS,
+	SK_CSET_HT,
+	SK_CSET_REPOS,
+	SK_CSET_PARENTS,
+	SK_PROJ_INFO,
+	SK_PROJ_KEYS,
+	SK_PROJ_OFF,
+	SK_PROJ_ADJ,
+	SK_PROJ_WT,
+	SK_PROJ_HUBS,
+	SK_EDGES, /* one per graph, SK_EDGES + graph_id_t */
+	SK_EDGE_WTS = SK_EDGES + GR_NGRAPHS, /* SK_EDGE_WTS + graph_id_t */
+	SK_NKINDS = SK_EDGE_WTS + GR_NGRAPHS
+} snap_kind_t;
+
+typedef struct snap snap_t;
+typedef struct snap_writer snap_writer_t;
+
+/*
+ * Per-author activity counters, kept up to date during ingestion. See
+ * illumetrics_degree.c.
+ */
+typedef struct author_deg {
+	uint32_t	ad_commits; /* degree in author2commit */
+	uint32_t	ad_files; /* distinct files, degree in file2author */
+} author_deg_t;
+
+/*
+ * A node of the path trie. See illumetrics_trie.c.
+ */
+typedef struct path_node {
+	ilm_id_t	pn_name; /* interned path component */
+	uint32_t	pn_parent;
+	uint32_t	pn_child; /* first child, 0 if none */
+	uint32_t	pn_sibling; /* next sibling, 0 if none */
+	uint32_t	pn_depth; /* the root is 0 */
+	uint32_t	pn_stamp; /* last commit to reach this node */
+} path_node_t;
+
 typedef enum arg {
 	PULL,
 	AUTHOR,
@@ -225,8 +466,10 @@ typedef enum qwork {
  */
 typedef enum cent {
 	CENT_DEGREE,
+	CENT_STRENGTH,
 	CENT_CLOSENESS,
 	CENT_BETWEENESS,
+	CENT_ACTIVITY, /* commits or files, not a centrality, but cheap */
 	CENT_WTF
 } cent_t;
 
@@ -241,14 +484,74 @@ typedef struct constraints {
 	char	*cn_subtree;
 	int64_t	cn_num;
 	int64_t	cn_dist; /* limiting distance */
-	tm_t	cn_start_date;
-	tm_t	cn_end_date;
+	int64_t	cn_start_date; /* seconds since the epoch */
+	int64_t	cn_end_date;
 	qwork_t	cn_qwork;
 	cent_t	cn_cent;
 	int	cn_list; /* bool */
+	int	cn_xpol; /* bool, for cross-polination */
+	char	*cn_xpol_commit; /* trace only this commit, if non-NULL */
 	int	cn_hist; /* bool, for histogram */
+	int64_t	cn_jobs; /* number of parallel workers */
+	int64_t	cn_hubcap; /* files with more authors are left out */
+	int64_t	cn_samples; /* sources to sample for betweenness, 0 is all */
+	int64_t	cn_window; /* seconds, 0 is no temporal window */
+	int	cn_stats; /* bool, report run statistics */
+	char	*cn_stats_file; /* write them here as JSON, if non-NULL */
+	int	cn_snap_verify; /* bool, checksum all of the snapshot */
 } constraints_t;
 
+extern constraints_t constraints;
+
+/*
+ * The outcome of pulling a single repository. Each pull worker fills one of
+ * these in per repository, and we print all of them once every worker is
+ * done. We don't exit on a failed pull, because one unreachable repository
+ * shouldn't abort the pulls that are running next to it.
+ */
+typedef enum pull_status {
+	PS_CLONED,
+	PS_FETCHED,
+	PS_SKIPPED,
+	PS_FAILED
+} pull_status_t;
+
+typedef struct pull_result {
+	repo_t		*pr_repo;
+	pull_status_t	pr_status;
+	int		pr_error; /* libgit2 error, if PS_FAILED */
+	char		pr_msg[128];
+	uint64_t	pr_objects; /* objects received */
+	uint64_t	pr_bytes; /* bytes received */
+	int64_t		pr_nsec; /* wall time spent on this repo */
+} pull_result_t;
+
+
+/*
+ * The phases of a run, and the allocation caches, that `--stats` reports on
+ * (see illumetrics_stats.c).
+ */
+typedef enum stat_phase {
+	SP_LOAD,
+	SP_PULL,
+	SP_GRAPHS,
+	SP_WALK,
+	SP_DIFF,
+	SP_CENT,
+	SP_NPHASES
+} stat_phase_t;
+
+typedef enum alloc_cache {
+	AC_REPO, /* the repo_t cache */
+	AC_BUF, /* buffers that aren't any of the below */
+	AC_ARENA, /* arena blocks, i.e. the files of diffed commits */
+	AC_VEC, /* ilm_vec_t's: the commit store, edge logs, and so on */
+	AC_STR, /* the string table */
+	AC_CSET, /* the commit set */
+	AC_CSR, /* frozen graphs */
+	AC_SCRATCH, /* the working memory of the analyses */
+	AC_NCACHES
+} alloc_cache_t;
 
 /*
  * Allocation function declarations.
@@ -257,5 +560,245 @@ repo_t *ilm_mk_repo();
 void ilm_rm_repo(repo_t *);
 void *ilm_mk_zbuf(size_t);
 void *ilm_mk_buf(size_t);
+void *ilm_mk_zbuf_as(size_t, alloc_cache_t);
+void *ilm_mk_buf_as(size_t, alloc_cache_t);
 void ilm_rm_buf(void *, size_t);
+char *ilm_mk_str(const char *);
+void ilm_rm_str(char *);
+
+typedef struct ilm_cache ilm_cache_t;
+ilm_cache_t *ilm_cache_create(char *, size_t, alloc_cache_t);
+void *ilm_cache_alloc(ilm_cache_t *);
+void ilm_cache_free(ilm_cache_t *, void *);
+
+/*
+ * A bump arena (see illumetrics_umem.c).
+ */
+typedef struct ilm_arena_blk ilm_arena_blk_t;
+typedef struct ilm_arena {
+	ilm_arena_blk_t	*ia_head;
+	ilm_arena_blk_t	*ia_cur; /* block we allocate from, NULL if none */
+	size_t		ia_off; /* bytes used in ia_cur */
+	size_t		ia_blksz;
+} ilm_arena_t;
+
+void ilm_arena_init(ilm_arena_t *, size_t);
+void *ilm_arena_alloc(ilm_arena_t *, size_t);
+void ilm_arena_reset(ilm_arena_t *);
+void ilm_arena_fini(ilm_arena_t *);
+
+/*
+ * A growable array. Elements may move when the array grows, so pointers into
+ * it are only good until the next append. An array can also be mapped onto
+ * memory that it doesn't own (i.e. a section of a snapshot), in which case the
+ * first append copies it out.
+ */
+typedef struct ilm_vec {
+	void	*v_buf;
+	uint64_t v_len; /* in elements */
+	uint64_t v_cap; /* in elements */
+	size_t	v_esz; /* element size */
+	int	v_mapped; /* bool, v_buf isn't ours to free */
+} ilm_vec_t;
+
+#define	ILM_VEC_GET(v, type, i)	(&((type *)(v)->v_buf)[i])
+
+void ilm_vec_init(ilm_vec_t *, size_t);
+void *ilm_vec_append(ilm_vec_t *, uint64_t);
+void ilm_vec_map(ilm_vec_t *, void *, uint64_t);
+void ilm_vec_fini(ilm_vec_t *);
 int illumetrics_umem_init();
+
+/*
+ * String interning declarations.
+ */
+void ilm_intern_init();
+ilm_id_t ilm_intern(const char *, size_t);
+ilm_id_t ilm_intern_str(const char *);
+ilm_id_t ilm_intern_lookup(const char *);
+const char *ilm_id_str(ilm_id_t);
+uint32_t ilm_intern_count();
+void ilm_intern_snap_write(snap_writer_t *);
+int ilm_intern_snap_load(snap_t *);
+
+/*
+ * Repository declarations.
+ */
+extern int stor_fd;
+extern repo_t **repo_table;
+extern uint32_t nrepos;
+void repo_get_path(repo_t *, char *);
+void atomic_write(int, void *, size_t);
+void sha1_from_oid(sha1_t *, const git_oid *);
+void sha1_to_oid(git_oid *, sha1_t *);
+
+/*
+ * Commit store declarations.
+ */
+void cstore_init();
+uint32_t cstore_add(repo_commit_t *, ilm_id_t *);
+repo_commit_t *cstore_get(uint32_t);
+ilm_id_t *cstore_files(repo_commit_t *);
+uint32_t cstore_count();
+void cstore_snap_write(snap_writer_t *);
+int cstore_snap_load(snap_t *);
+
+/*
+ * Path trie declarations.
+ */
+void trie_init();
+path_node_t *trie_node(uint32_t);
+uint32_t trie_nnodes();
+uint32_t trie_insert(const char *);
+uint32_t trie_file(ilm_id_t);
+int trie_is_under(uint32_t, uint32_t);
+uint32_t trie_new_stamp();
+void trie_stamp_dirs(uint32_t, uint32_t, void (*)(uint32_t, void *), void *);
+void trie_path(uint32_t, char *);
+void trie_rollup(uint64_t *);
+void trie_snap_write(snap_writer_t *);
+int trie_snap_load(snap_t *);
+
+/*
+ * Edge log declarations.
+ */
+void graph_init();
+void graph_log_edge(graph_id_t, uint64_t, uint64_t);
+ilm_edge_t *graph_edges(graph_id_t, uint64_t *, uint32_t **);
+void graph_snap_write(snap_writer_t *);
+int graph_snap_load(snap_t *);
+
+/*
+ * Frozen graph declarations.
+ */
+csr_t *csr_build(const ilm_edge_t *, uint64_t, const uint32_t *, int);
+csr_t *csr_freeze(graph_id_t, int);
+uint32_t csr_vertex(csr_t *, uint64_t);
+uint32_t csr_vertex_ge(csr_t *, uint64_t);
+void csr_destroy(csr_t *);
+
+/*
+ * Projection declarations.
+ */
+proj_t *proj_authors(uint32_t);
+proj_t *proj_get(uint32_t);
+void proj_destroy(proj_t *);
+void proj_print_hubs(proj_t *, uint32_t);
+void proj_snap_write(snap_writer_t *);
+int proj_snap_load(snap_t *);
+
+/*
+ * Degree counter declarations.
+ */
+void deg_init();
+void deg_add_commit(ilm_id_t);
+void deg_add_file(ilm_id_t, ilm_id_t);
+void deg_print_top(uint32_t, qwork_t);
+void deg_snap_write(snap_writer_t *);
+int deg_snap_load(snap_t *);
+
+/*
+ * Centrality declarations.
+ */
+void cent_degree(csr_t *, int, uint32_t, double *);
+double cent_betweenness(csr_t *, uint32_t, double *);
+void cent_closeness(csr_t *, double *);
+void cent_print_top(csr_t *, double *, uint32_t);
+
+/*
+ * Alias declarations.
+ */
+void alias_report(uint32_t);
+
+/*
+ * Temporal window declarations. Windowed edge weights are in fixed point, with
+ * WIN_SCALE per full-strength co-modification.
+ */
+#define	WIN_SCALE	1000
+
+csr_t *win_authors(int64_t, uint32_t);
+
+/*
+ * Neighborhood declarations.
+ */
+hood_t *hood_create(csr_t *);
+uint32_t hood_query(hood_t *, uint32_t, uint32_t);
+void hood_print(hood_t *, uint32_t, uint32_t);
+void hood_destroy(hood_t *);
+
+/*
+ * Worker thread declarations.
+ */
+int ilm_nthreads();
+void ilm_run_threads(void *(*)(void *), void *, size_t, int);
+
+/*
+ * Snapshot declarations.
+ */
+int snap_load();
+void snap_save();
+void *snap_sect(snap_t *, snap_kind_t, uint64_t *, uint64_t *);
+void snap_sect_begin(snap_writer_t *, snap_kind_t, uint64_t);
+void snap_sect_write(snap_writer_t *, const void *, uint64_t);
+void snap_sect_zero(snap_writer_t *, uint64_t);
+void snap_sect_end(snap_writer_t *);
+void snap_vec_write(snap_writer_t *, snap_kind_t, ilm_vec_t *);
+int snap_vec_load(snap_t *, snap_kind_t, ilm_vec_t *);
+void snap_sum(const char *, uint64_t, uint64_t *, uint64_t *);
+
+/*
+ * Numstat cache declarations.
+ */
+void numstat_init();
+void numstat_prepare(ilm_id_t);
+numstat_file_t *numstat_get(sha1_t *, uint32_t *);
+int numstat_lines(repo_commit_t *, uint64_t *, uint64_t *);
+
+/*
+ * Commit set declarations.
+ */
+void cset_init();
+int cset_add(sha1_t *, uint32_t, sha1_t *, uint32_t);
+uint32_t cset_lookup(sha1_t *);
+int cset_has(sha1_t *);
+cset_ent_t *cset_get(uint32_t);
+sha1_t *cset_parents(uint32_t, uint32_t *);
+uint64_t *cset_repo_set(uint32_t);
+uint32_t cset_set_words();
+uint32_t cset_count();
+void cset_count_diffs(uint64_t, uint64_t);
+void cset_report();
+void cset_repo_counts(uint64_t *, uint64_t *, uint64_t *);
+void cset_snap_write(snap_writer_t *);
+int cset_snap_load(snap_t *);
+
+/*
+ * Cross-polination declarations.
+ */
+typedef struct xpol xpol_t;
+xpol_t *xpol_create(sha1_t **);
+void xpol_destroy(xpol_t *);
+void xpol_print(xpol_t *);
+void xpol_print_commit(xpol_t *, uint32_t);
+
+/*
+ * Parallel diff declarations.
+ */
+int diff_commit(git_repository *, sha1_t *, git_diff **);
+diff_batch_t *diff_batch_create(char *);
+void diff_batch_destroy(diff_batch_t *);
+diff_slot_t *diff_batch_slot(diff_batch_t *);
+void diff_batch_unslot(diff_batch_t *);
+diff_slot_t *diff_batch_next(diff_batch_t *);
+sha1_t *diff_slot_parents(diff_batch_t *, diff_slot_t *, int);
+void diff_batch_run(diff_batch_t *);
+
+/*
+ * Run statistics declarations.
+ */
+int64_t ilm_gethrtime();
+void stats_alloc(alloc_cache_t, size_t);
+void stats_begin(stat_phase_t);
+void stats_end(stat_phase_t);
+void stats_count(stat_phase_t, uint64_t, uint64_t);
+void stats_report(char *);
@@ -0,0 +1,376 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * String Interning
+ * ================
+ *
+ * Authors, emails, and file paths repeat endlessly across commits. A file in
+ * illumos-gate can be touched by thousands of commits, and an author can make
+ * thousands of commits. Instead of allocating a string per occurrence, we
+ * intern each distinct string exactly once, and refer to it by a 32-bit ID
+ * from then on. Two IDs are equal if and only if their strings are equal, so
+ * graph nodes keyed by ID can be compared with a plain integer compare.
+ *
+ * The strings themselves are packed back-to-back (NUL-terminated) into large
+ * arena blocks, which are never freed or moved. An ID is mapped to its string
+ * through a two-level table of byte offsets into the arena. The table's pages
+ * are never moved either, so the string of an existing ID can be looked up
+ * without taking the lock, even while other threads are interning.
+ *
+ * The reverse mapping, from a string to its ID, is an open-addressing hash
+ * table. Each bucket packs the string's 32-bit hash next to its ID, so that
+ * probing and growing the table rarely have to touch the strings.
+ *
+ * Every diff worker interns every path of every commit it diffs, and nearly
+ * all of them have been interned before. So a string is first looked up
+ * without the lock, and the lock is only taken to insert it. A bucket is
+ * published, with a release store, only once its string and its ID's table
+ * entry are in place, so a lookup that finds the bucket also finds the
+ * string. Growing the table publishes a complete new one the same way, and
+ * leaves the old one in place for the lookups that may still be probing it
+ * (a lookup that misses in an old table just retries under the lock). The
+ * old tables add up to less than the current one.
+ *
+ * ID 0 is never handed out, so that it can stand for "no string".
+ *
+ * Since neither the arena nor the table pages ever move, and since both are
+ * addressed by offsets, all three structures are saved to snapshots as they
+ * are, and a loaded snapshot is used in place. The arena's blocks are laid
+ * out back-to-back in the snapshot, so an arena offset finds its string in
+ * the snapshot just like it does in memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include "illumetrics_impl.h"
+
+#define	ARENA_BLOCK_SHIFT	20
+#define	ARENA_BLOCK_SZ		(1ULL << ARENA_BLOCK_SHIFT) /* 1M */
+#define	ARENA_MAX_BLOCKS	(1 << 16) /* 64G of strings */
+#define	ID_PAGE_SHIFT		16
+#define	ID_PAGE_SZ		(1 << ID_PAGE_SHIFT) /* IDs per page */
+#define	ID_MAX_PAGES		(1 << 16)
+#define	HT_MIN_SZ		(1 << 16)
+
+typedef struct intern_ht {
+	uint64_t	*ih_buckets; /* (hash << 32) | id, 0 if empty */
+	uint64_t	ih_sz; /* power of 2 */
+	struct intern_ht *ih_old; /* replaced, but lookups may still probe it */
+} intern_ht_t;
+
+typedef struct intern_tbl {
+	pthread_mutex_t	it_lock; /* serializes inserts */
+	char		**it_blocks; /* ARENA_MAX_BLOCKS */
+	uint64_t	it_arena_off; /* next free byte in the arena */
+	uint64_t	**it_pages; /* ID_MAX_PAGES, id -> arena offset */
+	uint32_t	it_nids; /* including the reserved ID 0 */
+	intern_ht_t	*it_ht; /* the current table */
+	uint64_t	it_mapped_off; /* arena bytes that are in a snapshot */
+} intern_tbl_t;
+
+static intern_tbl_t it;
+
+void
+ilm_intern_init()
+{
+	(void) pthread_mutex_init(&it.it_lock, NULL);
+	it.it_blocks = ilm_mk_zbuf_as(sizeof (char *) * ARENA_MAX_BLOCKS,
+	    AC_STR);
+	it.it_pages = ilm_mk_zbuf_as(sizeof (uint64_t *) * ID_MAX_PAGES,
+	    AC_STR);
+	it.it_ht = ilm_mk_zbuf_as(sizeof (intern_ht_t), AC_STR);
+	it.it_ht->ih_sz = HT_MIN_SZ;
+	it.it_ht->ih_buckets = ilm_mk_zbuf_as(sizeof (uint64_t) * HT_MIN_SZ,
+	    AC_STR);
+	it.it_pages[0] = ilm_mk_zbuf_as(sizeof (uint64_t) * ID_PAGE_SZ, AC_STR);
+	it.it_nids = 1;
+}
+
+/*
+ * 32-bit FNV-1a.
+ */
+uint32_t
+intern_hash(const char *s, size_t len)
+{
+	uint32_t h = 2166136261U;
+	size_t i = 0;
+	while (i < len) {
+		h ^= (unsigned char)s[i];
+		h *= 16777619U;
+		i++;
+	}
+	return (h);
+}
+
+const char *
+ilm_id_str(ilm_id_t id)
+{
+	uint64_t off = it.it_pages[id >> ID_PAGE_SHIFT][id & (ID_PAGE_SZ - 1)];
+	return (it.it_blocks[off >> ARENA_BLOCK_SHIFT] +
+	    (off & (ARENA_BLOCK_SZ - 1)));
+}
+
+uint32_t
+ilm_intern_count()
+{
+	return (it.it_nids - 1);
+}
+
+/*
+ * Returns the bucket of `ht` that holds `s`, or the empty bucket where it
+ * belongs. Buckets may be filled in by other threads while we probe.
+ */
+uint64_t *
+intern_probe(intern_ht_t *ht, const char *s, size_t len, uint32_t h)
+{
+	uint64_t mask = ht->ih_sz - 1;
+	uint64_t b = h & mask;
+	uint64_t e;
+	while ((e = __atomic_load_n(&ht->ih_buckets[b], __ATOMIC_ACQUIRE)) !=
+	    0) {
+		if ((uint32_t)(e >> 32) == h) {
+			const char *c = ilm_id_str((ilm_id_t)e);
+			if (strncmp(c, s, len) == 0 && c[len] == '\0') {
+				break;
+			}
+		}
+		b = (b + 1) & mask;
+	}
+	return (&ht->ih_buckets[b]);
+}
+
+/*
+ * Returns the ID of `s`, or 0 if it hasn't been interned (as far as we can
+ * tell without the lock).
+ */
+ilm_id_t
+intern_find(const char *s, size_t len, uint32_t h)
+{
+	intern_ht_t *ht = __atomic_load_n(&it.it_ht, __ATOMIC_ACQUIRE);
+	return ((ilm_id_t)__atomic_load_n(intern_probe(ht, s, len, h),
+	    __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Doubles the table. Must be called with the lock held.
+ */
+void
+intern_grow()
+{
+	intern_ht_t *oht = it.it_ht;
+	intern_ht_t *nht = ilm_mk_zbuf_as(sizeof (intern_ht_t), AC_STR);
+	nht->ih_sz = oht->ih_sz * 2;
+	nht->ih_buckets = ilm_mk_zbuf_as(sizeof (uint64_t) * nht->ih_sz,
+	    AC_STR);
+	nht->ih_old = oht;
+	uint64_t mask = nht->ih_sz - 1;
+	uint64_t i = 0;
+	while (i < oht->ih_sz) {
+		uint64_t e = oht->ih_buckets[i];
+		if (e != 0) {
+			uint64_t b = (e >> 32) & mask;
+			while (nht->ih_buckets[b] != 0) {
+				b = (b + 1) & mask;
+			}
+			nht->ih_buckets[b] = e;
+		}
+		i++;
+	}
+	__atomic_store_n(&it.it_ht, nht, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies the string into the arena, and returns its offset. Strings never
+ * straddle two blocks. Must be called with the lock held.
+ */
+uint64_t
+intern_arena_copy(const char *s, size_t len)
+{
+	uint64_t off = it.it_arena_off;
+	uint64_t left = ARENA_BLOCK_SZ - (off & (ARENA_BLOCK_SZ - 1));
+	if (len + 1 > ARENA_BLOCK_SZ) {
+		fprintf(stderr, "Can't intern a %llu byte string.\n",
+		    (unsigned long long)len);
+		exit(-1);
+	}
+	char *blk = it.it_blocks[off >> ARENA_BLOCK_SHIFT];
+	if (blk == NULL || len + 1 > left) {
+		if (blk != NULL) {
+			off += left;
+		}
+		if ((off >> ARENA_BLOCK_SHIFT) >= ARENA_MAX_BLOCKS) {
+			fprintf(stderr, "String arena is full.\n");
+			exit(-1);
+		}
+		it.it_blocks[off >> ARENA_BLOCK_SHIFT] =
+		    ilm_mk_buf_as(ARENA_BLOCK_SZ, AC_STR);
+	}
+	char *dst = it.it_blocks[off >> ARENA_BLOCK_SHIFT] +
+	    (off & (ARENA_BLOCK_SZ - 1));
+	bcopy(s, dst, len);
+	dst[len] = '\0';
+	it.it_arena_off = off + len + 1;
+	return (off);
+}
+
+/*
+ * Returns the ID of the first `len` bytes of `s`, interning them if we
+ * haven't seen them before. Safe to call from multiple threads.
+ */
+ilm_id_t
+ilm_intern(const char *s, size_t len)
+{
+	uint32_t h = intern_hash(s, len);
+	ilm_id_t found = intern_find(s, len, h);
+	if (found != 0) {
+		return (found);
+	}
+	(void) pthread_mutex_lock(&it.it_lock);
+	uint64_t *b = intern_probe(it.it_ht, s, len, h);
+	if (*b != 0) {
+		ilm_id_t id = (ilm_id_t)*b;
+		(void) pthread_mutex_unlock(&it.it_lock);
+		return (id);
+	}
+	ilm_id_t id = it.it_nids;
+	if (id == UINT32_MAX) {
+		fprintf(stderr, "Interned more than 2^32 strings.\n");
+		exit(-1);
+	}
+	if (it.it_pages[id >> ID_PAGE_SHIFT] == NULL) {
+		it.it_pages[id >> ID_PAGE_SHIFT] =
+		    ilm_mk_zbuf_as(sizeof (uint64_t) * ID_PAGE_SZ, AC_STR);
+	}
+	it.it_pages[id >> ID_PAGE_SHIFT][id & (ID_PAGE_SZ - 1)] =
+	    intern_arena_copy(s, len);
+	__atomic_store_n(b, ((uint64_t)h << 32) | id, __ATOMIC_RELEASE);
+	it.it_nids++;
+	/* keep the load factor under 3/4 */
+	if ((uint64_t)it.it_nids * 4 > it.it_ht->ih_sz * 3) {
+		intern_grow();
+	}
+	(void) pthread_mutex_unlock(&it.it_lock);
+	return (id);
+}
+
+ilm_id_t
+ilm_intern_str(const char *s)
+{
+	return (ilm_intern(s, strlen(s)));
+}
+
+/*
+ * Returns the ID of `s` if it has been interned, and 0 otherwise.
+ */
+ilm_id_t
+ilm_intern_lookup(const char *s)
+{
+	size_t len = strlen(s);
+	uint32_t h = intern_hash(s, len);
+	ilm_id_t id = intern_find(s, len, h);
+	if (id == 0) {
+		/* it may have been inserted while the table grew */
+		(void) pthread_mutex_lock(&it.it_lock);
+		id = (ilm_id_t)*intern_probe(it.it_ht, s, len, h);
+		(void) pthread_mutex_unlock(&it.it_lock);
+	}
+	return (id);
+}
+
+void
+ilm_intern_snap_write(snap_writer_t *sw)
+{
+	snap_sect_begin(sw, SK_STR_ARENA, 0);
+	uint64_t off = 0;
+	while (off < it.it_arena_off) {
+		uint64_t n = it.it_arena_off - off;
+		if (n > ARENA_BLOCK_SZ) {
+			n = ARENA_BLOCK_SZ;
+		}
+		char *blk = it.it_blocks[off >> ARENA_BLOCK_SHIFT];
+		/*
+		 * The last block of a loaded snapshot is only mapped up to the
+		 * end of its strings, see ilm_intern_snap_load().
+		 */
+		if (off < it.it_mapped_off && off + n > it.it_mapped_off) {
+			snap_sect_write(sw, blk, it.it_mapped_off - off);
+			snap_sect_zero(sw, off + n - it.it_mapped_off);
+		} else {
+			snap_sect_write(sw, blk, n);
+		}
+		off += n;
+	}
+	snap_sect_end(sw);
+
+	snap_sect_begin(sw, SK_STR_PAGES, it.it_nids);
+	uint64_t p = 0;
+	while ((p << ID_PAGE_SHIFT) < it.it_nids) {
+		snap_sect_write(sw, it.it_pages[p],
+		    sizeof (uint64_t) * ID_PAGE_SZ);
+		p++;
+	}
+	snap_sect_end(sw);
+
+	snap_sect_begin(sw, SK_STR_HT, it.it_ht->ih_sz);
+	snap_sect_write(sw, it.it_ht->ih_buckets,
+	    sizeof (uint64_t) * it.it_ht->ih_sz);
+	snap_sect_end(sw);
+}
+
+/*
+ * Points the table at a snapshot's strings. Nothing may have been interned
+ * yet. New strings go into a fresh arena block, because the snapshot's last
+ * block is only as long as the strings in it.
+ */
+int
+ilm_intern_snap_load(snap_t *s)
+{
+	uint64_t alen;
+	uint64_t plen;
+	uint64_t hlen;
+	uint64_t nids;
+	uint64_t htsz;
+	char *arena = snap_sect(s, SK_STR_ARENA, &alen, NULL);
+	uint64_t *pages = snap_sect(s, SK_STR_PAGES, &plen, &nids);
+	uint64_t *ht = snap_sect(s, SK_STR_HT, &hlen, &htsz);
+	uint64_t npages = (nids + ID_PAGE_SZ - 1) >> ID_PAGE_SHIFT;
+	uint64_t nblocks = (alen + ARENA_BLOCK_SZ - 1) >> ARENA_BLOCK_SHIFT;
+	if (nids == 0 || nids > UINT32_MAX || npages > ID_MAX_PAGES ||
+	    plen != sizeof (uint64_t) * ID_PAGE_SZ * npages ||
+	    htsz < HT_MIN_SZ || (htsz & (htsz - 1)) != 0 ||
+	    hlen != sizeof (uint64_t) * htsz || nblocks > ARENA_MAX_BLOCKS) {
+		return (-1);
+	}
+	if (it.it_nids != 1) {
+		fprintf(stderr, "Loading a snapshot after interning.\n");
+		exit(-1);
+	}
+	ilm_rm_buf(it.it_pages[0], sizeof (uint64_t) * ID_PAGE_SZ);
+	ilm_rm_buf(it.it_ht->ih_buckets, sizeof (uint64_t) * it.it_ht->ih_sz);
+	uint64_t i = 0;
+	while (i < nblocks) {
+		it.it_blocks[i] = arena + (i << ARENA_BLOCK_SHIFT);
+		i++;
+	}
+	i = 0;
+	while (i < npages) {
+		it.it_pages[i] = pages + (i << ID_PAGE_SHIFT);
+		i++;
+	}
+	it.it_ht->ih_buckets = ht;
+	it.it_ht->ih_sz = htsz;
+	it.it_nids = nids;
+	it.it_mapped_off = alen;
+	it.it_arena_off = nblocks << ARENA_BLOCK_SHIFT;
+	return (0);
+}
@@ -0,0 +1,553 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Numstat Cache
+ * =============
+ *
+ * `-w line` measures work in lines added and removed, like `git log
+ * --numstat`. repo_commit_t leaves those counts out, because most queries
+ * don't need them, and because they are expensive: a tree diff only compares
+ * object IDs, but a line diff has to load and diff the blobs, which is
+ * roughly ten times the cost. So line counts are computed only when a query
+ * asks for them, once per commit, and are kept in a sidecar cache,
+ * `stor/NUMSTAT_FILE`, that is keyed by commit SHA-1. Commit SHA-1's never
+ * change meaning, so the cache stays valid across pulls, snapshots, and
+ * changes to the list of repositories; it only ever grows.
+ *
+ * The file is a header, an index of commits sorted by SHA-1, and a record
+ * per file of each commit, in the order in which the tree diff lists them.
+ * Each file record has a 32-bit hash of the path, so that the counts can be
+ * matched up with a commit's file list even when `-f` has filtered it (the
+ * filtered list is a subsequence of the diff's). The file is mapped, and used
+ * in place.
+ *
+ * numstat_prepare() finds the commits that aren't in the cache, diffs them
+ * in parallel (each thread with its own handle on the repository), merges
+ * them into the index, and saves the cache. After that, numstat_lines()
+ * never touches a blob.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "illumetrics_impl.h"
+
+#define	NUMSTAT_FILE		".illumetrics_numstat"
+#define	NUMSTAT_TMP_FILE	".illumetrics_numstat.tmp"
+#define	NUMSTAT_MAGIC		"ILMNUMS"
+#define	NUMSTAT_VERSION		1
+#define	NUMSTAT_BOM		0x01020304
+/* commits a thread grabs at a time */
+#define	NUMSTAT_CHUNK		16
+/* size of the blocks of the workers' arenas */
+#define	NUMSTAT_ARENA_BLKSZ	(64 * 1024)
+#define	NUMSTAT_ROUNDUP(x)	(((x) + 7) & ~7ULL)
+
+typedef struct ns_hdr {
+	char		nh_magic[8];
+	uint32_t	nh_version;
+	uint32_t	nh_bom;
+	uint64_t	nh_ncommits;
+	uint64_t	nh_nfiles;
+	uint64_t	nh_sum1; /* checksum of everything after the header */
+	uint64_t	nh_sum2;
+} ns_hdr_t;
+
+typedef struct ns_commit {
+	sha1_t		nc_sha1;
+	uint32_t	nc_nfiles;
+	uint64_t	nc_off; /* index of its first numstat_file_t */
+} ns_commit_t;
+
+/* a commit that isn't in the cache yet */
+typedef struct ns_job {
+	uint32_t	nj_commit; /* cstore index */
+	uint32_t	nj_nfiles;
+	numstat_file_t	*nj_files;
+	int		nj_error;
+} ns_job_t;
+
+typedef struct ns_ctx {
+	ns_job_t	*nx_jobs;
+	uint32_t	nx_next;
+	uint32_t	nx_end;
+	char		*nx_path;
+	pthread_mutex_t	nx_lock;
+} ns_ctx_t;
+
+/* the files of the jobs a thread diffs are allocated from its own arena */
+typedef struct ns_worker {
+	ns_ctx_t	*nw_ctx;
+	ilm_arena_t	nw_arena;
+} ns_worker_t;
+
+ilm_vec_t ns_commits; /* ns_commit_t, sorted by SHA-1 */
+ilm_vec_t ns_files; /* numstat_file_t */
+
+/*
+ * FNV-1a.
+ */
+uint32_t
+numstat_path_hash(const char *path)
+{
+	uint32_t h = 0x811c9dc5;
+	while (*path != '\0') {
+		h ^= (unsigned char)*path;
+		h *= 0x01000193;
+		path++;
+	}
+	return (h);
+}
+
+int
+ns_sha1_cmp(const sha1_t *a, const sha1_t *b)
+{
+	return (memcmp(a, b, sizeof (sha1_t)));
+}
+
+/*
+ * Returns the index of the first commit in the cache that isn't less than
+ * `sha1`.
+ */
+uint64_t
+ns_search(sha1_t *sha1)
+{
+	ns_commit_t *nc = ns_commits.v_buf;
+	uint64_t lo = 0;
+	uint64_t hi = ns_commits.v_len;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (ns_sha1_cmp(&nc[mid].nc_sha1, sha1) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo);
+}
+
+/*
+ * Returns the file records of commit `sha1`, and their number in `n`, or NULL
+ * if the commit isn't in the cache.
+ */
+numstat_file_t *
+numstat_get(sha1_t *sha1, uint32_t *n)
+{
+	uint64_t i = ns_search(sha1);
+	if (i == ns_commits.v_len) {
+		return (NULL);
+	}
+	ns_commit_t *nc = ILM_VEC_GET(&ns_commits, ns_commit_t, i);
+	if (ns_sha1_cmp(&nc->nc_sha1, sha1) != 0) {
+		return (NULL);
+	}
+	*n = nc->nc_nfiles;
+	return (ILM_VEC_GET(&ns_files, numstat_file_t, nc->nc_off));
+}
+
+void
+numstat_init()
+{
+	ilm_vec_init(&ns_commits, sizeof (ns_commit_t));
+	ilm_vec_init(&ns_files, sizeof (numstat_file_t));
+}
+
+/*
+ * Maps the cache, if there is a usable one.
+ */
+void
+numstat_load()
+{
+	int fd = openat(stor_fd, NUMSTAT_FILE, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			perror("numstat_load:openat");
+		}
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < sizeof (ns_hdr_t)) {
+		(void) close(fd);
+		fprintf(stderr, "Ignoring numstat cache: truncated.\n");
+		return;
+	}
+	char *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE, fd, 0);
+	(void) close(fd);
+	if (base == MAP_FAILED) {
+		perror("numstat_load:mmap");
+		return;
+	}
+	ns_hdr_t *nh = (ns_hdr_t *)base;
+	uint64_t clen = nh->nh_ncommits * sizeof (ns_commit_t);
+	uint64_t flen = nh->nh_nfiles * sizeof (numstat_file_t);
+	/* the body is padded to a multiple of 8 bytes, for snap_sum() */
+	uint64_t blen = NUMSTAT_ROUNDUP(clen + flen);
+	uint64_t s1;
+	uint64_t s2;
+	const char *why = NULL;
+	if (strncmp(nh->nh_magic, NUMSTAT_MAGIC, sizeof (nh->nh_magic)) != 0 ||
+	    nh->nh_version != NUMSTAT_VERSION || nh->nh_bom != NUMSTAT_BOM) {
+		why = "incompatible version";
+	} else if (nh->nh_ncommits > (uint64_t)st.st_size ||
+	    nh->nh_nfiles > (uint64_t)st.st_size ||
+	    sizeof (ns_hdr_t) + blen != (uint64_t)st.st_size) {
+		why = "truncated";
+	} else {
+		snap_sum(base + sizeof (ns_hdr_t), blen, &s1, &s2);
+		if (s1 != nh->nh_sum1 || s2 != nh->nh_sum2) {
+			why = "checksum mismatch";
+		}
+	}
+	if (why != NULL) {
+		fprintf(stderr, "Ignoring numstat cache: %s.\n", why);
+		(void) munmap(base, st.st_size);
+		return;
+	}
+	ilm_vec_map(&ns_commits, base + sizeof (ns_hdr_t), nh->nh_ncommits);
+	ilm_vec_map(&ns_files, base + sizeof (ns_hdr_t) + clen,
+	    nh->nh_nfiles);
+}
+
+void
+numstat_save()
+{
+	int fd = openat(stor_fd, NUMSTAT_TMP_FILE,
+	    O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		perror("numstat_save:openat");
+		return;
+	}
+	ns_hdr_t nh;
+	bzero(&nh, sizeof (ns_hdr_t));
+	bcopy(NUMSTAT_MAGIC, nh.nh_magic, sizeof (NUMSTAT_MAGIC));
+	nh.nh_version = NUMSTAT_VERSION;
+	nh.nh_bom = NUMSTAT_BOM;
+	nh.nh_ncommits = ns_commits.v_len;
+	nh.nh_nfiles = ns_files.v_len;
+	uint64_t clen = ns_commits.v_len * sizeof (ns_commit_t);
+	uint64_t flen = ns_files.v_len * sizeof (numstat_file_t);
+	uint64_t blen = NUMSTAT_ROUNDUP(clen + flen);
+	uint64_t zero = 0;
+	atomic_write(fd, &nh, sizeof (ns_hdr_t));
+	atomic_write(fd, ns_commits.v_buf, clen);
+	atomic_write(fd, ns_files.v_buf, flen);
+	atomic_write(fd, &zero, blen - clen - flen);
+	/* the header goes in last, once the body can be summed */
+	char *m = mmap(NULL, sizeof (ns_hdr_t) + blen, PROT_READ, MAP_SHARED,
+	    fd, 0);
+	if (m == MAP_FAILED) {
+		perror("numstat_save:mmap");
+		(void) close(fd);
+		return;
+	}
+	snap_sum(m + sizeof (ns_hdr_t), blen, &nh.nh_sum1, &nh.nh_sum2);
+	(void) munmap(m, sizeof (ns_hdr_t) + blen);
+	if (pwrite(fd, &nh, sizeof (ns_hdr_t), 0) != sizeof (ns_hdr_t)) {
+		perror("numstat_save:pwrite");
+		(void) close(fd);
+		return;
+	}
+	if (fsync(fd) < 0) {
+		perror("numstat_save:fsync");
+	}
+	(void) close(fd);
+	if (renameat(stor_fd, NUMSTAT_TMP_FILE, stor_fd, NUMSTAT_FILE) < 0) {
+		perror("numstat_save:renameat");
+	}
+}
+
+/*
+ * Computes the line counts of every file of a commit.
+ */
+int
+numstat_commit(git_repository *g, ilm_arena_t *a, ns_job_t *nj)
+{
+	git_diff *diff;
+	repo_commit_t *c = cstore_get(nj->nj_commit);
+	int error = diff_commit(g, &c->rc_sha1, &diff);
+	if (error < 0 || diff == NULL) {
+		git_diff_free(diff);
+		return (error);
+	}
+	uint32_t n = git_diff_num_deltas(diff);
+	nj->nj_files = ilm_arena_alloc(a, sizeof (numstat_file_t) * n);
+	uint32_t i = 0;
+	while (i < n) {
+		const git_diff_delta *d = git_diff_get_delta(diff, i);
+		numstat_file_t *nf = &nj->nj_files[i];
+		git_patch *patch;
+		size_t added = 0;
+		size_t removed = 0;
+		error = git_patch_from_diff(&patch, diff, i);
+		if (error < 0) {
+			nj->nj_files = NULL;
+			break;
+		}
+		/* binary files have no lines, like in `git log --numstat` */
+		if (patch != NULL) {
+			(void) git_patch_line_stats(NULL, &added, &removed,
+			    patch);
+		}
+		git_patch_free(patch);
+		nf->nf_path = numstat_path_hash(d->new_file.path);
+		nf->nf_added = added > UINT32_MAX ? UINT32_MAX : added;
+		nf->nf_removed = removed > UINT32_MAX ? UINT32_MAX : removed;
+		i++;
+	}
+	if (error >= 0) {
+		nj->nj_nfiles = n;
+	}
+	git_diff_free(diff);
+	return (error);
+}
+
+void *
+numstat_worker(void *arg)
+{
+	ns_worker_t *nw = arg;
+	ns_ctx_t *nx = nw->nw_ctx;
+	git_repository *g;
+	if (git_repository_open(&g, nx->nx_path) < 0) {
+		return (NULL);
+	}
+	while (1) {
+		(void) pthread_mutex_lock(&nx->nx_lock);
+		uint32_t start = nx->nx_next;
+		uint32_t end = start + NUMSTAT_CHUNK;
+		if (end > nx->nx_end) {
+			end = nx->nx_end;
+		}
+		nx->nx_next = end;
+		(void) pthread_mutex_unlock(&nx->nx_lock);
+		if (start >= end) {
+			break;
+		}
+		while (start < end) {
+			ns_job_t *nj = &nx->nx_jobs[start];
+			nj->nj_error = numstat_commit(g, &nw->nw_arena, nj);
+			start++;
+		}
+	}
+	git_repository_free(g);
+	return (NULL);
+}
+
+int
+ns_job_sha1_cmp(const void *a, const void *b)
+{
+	const ns_job_t *ja = a;
+	const ns_job_t *jb = b;
+	int cmp = ns_sha1_cmp(&cstore_get(ja->nj_commit)->rc_sha1,
+	    &cstore_get(jb->nj_commit)->rc_sha1);
+	if (cmp != 0) {
+		return (cmp);
+	}
+	return (ja->nj_commit < jb->nj_commit ? -1 : 1);
+}
+
+int
+ns_job_repo_cmp(const void *a, const void *b)
+{
+	const ns_job_t *ja = a;
+	const ns_job_t *jb = b;
+	uint32_t ra = cstore_get(ja->nj_commit)->rc_repo;
+	uint32_t rb = cstore_get(jb->nj_commit)->rc_repo;
+	if (ra != rb) {
+		return (ra < rb ? -1 : 1);
+	}
+	return (ja->nj_commit < jb->nj_commit ? -1 :
+	    ja->nj_commit > jb->nj_commit);
+}
+
+/*
+ * Merges the diffed jobs (sorted by SHA-1) into the index.
+ */
+void
+numstat_merge(ns_job_t *jobs, uint32_t njobs)
+{
+	ilm_vec_t merged;
+	ilm_vec_init(&merged, sizeof (ns_commit_t));
+	ns_commit_t *old = ns_commits.v_buf;
+	uint64_t nold = ns_commits.v_len;
+	uint64_t i = 0;
+	uint32_t j = 0;
+	while (i < nold || j < njobs) {
+		if (j < njobs && jobs[j].nj_error < 0) {
+			j++;
+			continue;
+		}
+		ns_commit_t *nc = ilm_vec_append(&merged, 1);
+		if (j == njobs || (i < nold && ns_sha1_cmp(&old[i].nc_sha1,
+		    &cstore_get(jobs[j].nj_commit)->rc_sha1) < 0)) {
+			*nc = old[i++];
+			continue;
+		}
+		ns_job_t *nj = &jobs[j++];
+		nc->nc_sha1 = cstore_get(nj->nj_commit)->rc_sha1;
+		nc->nc_nfiles = nj->nj_nfiles;
+		nc->nc_off = ns_files.v_len;
+		if (nj->nj_nfiles > 0) {
+			bcopy(nj->nj_files, ilm_vec_append(&ns_files,
+			    nj->nj_nfiles),
+			    sizeof (numstat_file_t) * nj->nj_nfiles);
+		}
+	}
+	if (!ns_commits.v_mapped) {
+		ilm_vec_fini(&ns_commits);
+	}
+	ns_commits = merged;
+}
+
+/*
+ * Makes sure that every commit in the store by `who` (an author or an email,
+ * or anyone if 0) and within the `-D` dates is in the cache, computing the
+ * ones that aren't.
+ */
+void
+numstat_prepare(ilm_id_t who)
+{
+	numstat_load();
+	ilm_vec_t misses;
+	ilm_vec_init(&misses, sizeof (ns_job_t));
+	uint32_t i = 0;
+	while (i < cstore_count()) {
+		repo_commit_t *c = cstore_get(i);
+		uint32_t n;
+		i++;
+		if (who != 0 && c->rc_author != who && c->rc_email != who) {
+			continue;
+		}
+		/* `-D` leaves the rest out of the report, so don't diff them */
+		if (c->rc_time < constraints.cn_start_date ||
+		    c->rc_time > constraints.cn_end_date) {
+			continue;
+		}
+		if (numstat_get(&c->rc_sha1, &n) != NULL) {
+			ILLUMETRICS_CACHE_HIT("numstat");
+			continue;
+		}
+		ILLUMETRICS_CACHE_MISS("numstat");
+		ns_job_t *nj = ilm_vec_append(&misses, 1);
+		bzero(nj, sizeof (ns_job_t));
+		nj->nj_commit = i - 1;
+		nj->nj_error = -1;
+	}
+	ns_job_t *jobs = misses.v_buf;
+	uint32_t njobs = misses.v_len;
+	if (njobs == 0) {
+		ilm_vec_fini(&misses);
+		return;
+	}
+
+	/* the same commit in several forks is only diffed once */
+	qsort(jobs, njobs, sizeof (ns_job_t), ns_job_sha1_cmp);
+	uint32_t u = 0;
+	i = 0;
+	while (i < njobs) {
+		sha1_t *sha1 = &cstore_get(jobs[i].nj_commit)->rc_sha1;
+		if (u == 0 || ns_sha1_cmp(sha1,
+		    &cstore_get(jobs[u - 1].nj_commit)->rc_sha1) != 0) {
+			jobs[u++] = jobs[i];
+		}
+		i++;
+	}
+	njobs = u;
+	fprintf(stderr, "Counting the lines of %u commits...\n", njobs);
+
+	/* diff each repository's commits in its own pool of threads */
+	qsort(jobs, njobs, sizeof (ns_job_t), ns_job_repo_cmp);
+	int nw = ilm_nthreads();
+	ns_worker_t *args = ilm_mk_buf(sizeof (ns_worker_t) * nw);
+	int w = 0;
+	while (w < nw) {
+		ilm_arena_init(&args[w++].nw_arena, NUMSTAT_ARENA_BLKSZ);
+	}
+	i = 0;
+	while (i < njobs) {
+		uint32_t rid = cstore_get(jobs[i].nj_commit)->rc_repo;
+		uint32_t end = i;
+		while (end < njobs &&
+		    cstore_get(jobs[end].nj_commit)->rc_repo == rid) {
+			end++;
+		}
+		char path[PATH_MAX];
+		repo_get_path(repo_table[rid], path);
+		ns_ctx_t nx;
+		nx.nx_jobs = jobs;
+		nx.nx_next = i;
+		nx.nx_end = end;
+		nx.nx_path = path;
+		(void) pthread_mutex_init(&nx.nx_lock, NULL);
+		w = 0;
+		while (w < nw) {
+			args[w++].nw_ctx = &nx;
+		}
+		ilm_run_threads(numstat_worker, args, sizeof (ns_worker_t), nw);
+		(void) pthread_mutex_destroy(&nx.nx_lock);
+		i = end;
+	}
+
+	uint32_t failed = 0;
+	qsort(jobs, njobs, sizeof (ns_job_t), ns_job_sha1_cmp);
+	numstat_merge(jobs, njobs);
+	w = 0;
+	while (w < nw) {
+		ilm_arena_fini(&args[w++].nw_arena);
+	}
+	ilm_rm_buf(args, sizeof (ns_worker_t) * nw);
+	i = 0;
+	while (i < njobs) {
+		failed += jobs[i].nj_error < 0;
+		i++;
+	}
+	if (failed > 0) {
+		fprintf(stderr, "Couldn't count the lines of %u commits.\n",
+		    failed);
+	}
+	ilm_vec_fini(&misses);
+	numstat_save();
+}
+
+/*
+ * Adds up the lines added and removed by `c` in the files of its file list.
+ * Returns non-zero if the commit isn't in the cache.
+ */
+int
+numstat_lines(repo_commit_t *c, uint64_t *added, uint64_t *removed)
+{
+	uint32_t n;
+	numstat_file_t *nf = numstat_get(&c->rc_sha1, &n);
+	if (nf == NULL) {
+		return (-1);
+	}
+	ilm_id_t *files = cstore_files(c);
+	uint32_t i = 0;
+	uint32_t j = 0;
+	/* the file list is a subsequence of the diff */
+	while (i < n && j < c->rc_nfiles) {
+		if (n == c->rc_nfiles ||
+		    nf[i].nf_path == numstat_path_hash(ilm_id_str(files[j]))) {
+			*added += nf[i].nf_added;
+			*removed += nf[i].nf_removed;
+			j++;
+		}
+		i++;
+	}
+	return (0);
+}
@@ -0,0 +1,418 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Author Projection
+ * =================
+ *
+ * This is the "Duality of Persons and Groups" transform described in
+ * illumetrics_impl.h: the bipartite graph of files and authors becomes a graph
+ * of authors, in which two authors are connected if they have modified a
+ * common file, and the edge's weight is the number of files they have in
+ * common.
+ *
+ * The obvious way to do this is to emit every pair of authors of every file,
+ * and to sort and count the pairs at the end. But a file with k authors emits
+ * k^2 / 2 pairs, and all of them have to be held in memory until the end,
+ * even though most of them are repeats. Instead, we work one author at a
+ * time. For author a, we visit a's files, and each of their authors b, and
+ * bump a counter for b in a dense array. Once all of a's files have been
+ * visited, the non-zero counters are exactly a's row of the projection, with
+ * its weights. So memory is proportional to the output, not to the number of
+ * pairs, and rows are independent of each other, so the authors are spread
+ * across threads without any merging at the end. To avoid doing every pair
+ * twice, a only counts the authors that come after it; the frozen graph adds
+ * the other direction.
+ *
+ * Some files are modified by nearly everyone: top-level Makefiles, package
+ * manifests (`usr/src/pkg/manifests`), copyright files, and so on. Sharing one
+ * of those says nothing about two authors, and each of them costs k^2 / 2
+ * pairs. So files with more than `-H` authors are hubs, and are left out of
+ * the projection. We keep track of how many pairs each hub would have
+ * contributed, so that the cap can be tuned.
+ *
+ * Even so, projecting every author of every repository takes much longer
+ * than the neighborhood queries that use it. So the snapshot saves the
+ * projection at the default cap, and queries that use that cap get it
+ * straight from the mapping (see proj_get()).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "illumetrics_impl.h"
+
+/* authors a thread grabs at a time */
+#define	PROJ_CHUNK	64
+
+/* the SK_PROJ_INFO section */
+typedef struct proj_snap_info {
+	uint64_t	psi_hubcap;
+	uint64_t	psi_pairs;
+	uint64_t	psi_skipped;
+} proj_snap_info_t;
+
+/*
+ * The projection at the default cap, from the snapshot that we loaded or the
+ * one that we saved. It lives until we exit.
+ */
+proj_t *proj_snapped;
+int proj_snapped_mapped; /* bool, its arrays are in a snapshot */
+
+typedef struct proj_worker {
+	struct proj_ctx	*pw_ctx;
+	uint32_t	*pw_acc; /* dense, indexed by vertex */
+	ilm_vec_t	pw_touched; /* uint32_t, vertices with acc != 0 */
+	ilm_vec_t	pw_edges; /* ilm_edge_t */
+	ilm_vec_t	pw_wt; /* uint32_t */
+	uint64_t	pw_pairs;
+} proj_worker_t;
+
+typedef struct proj_ctx {
+	csr_t		*pc_bip;
+	uint32_t	pc_hubcap;
+	uint32_t	pc_first; /* first author vertex */
+	uint32_t	pc_end; /* one past the last author vertex */
+	uint32_t	pc_next; /* next author to hand out */
+	pthread_mutex_t	pc_lock;
+} proj_ctx_t;
+
+int
+proj_hub_cmp(const void *a, const void *b)
+{
+	const proj_hub_t *ha = a;
+	const proj_hub_t *hb = b;
+	return (ha->ph_pairs < hb->ph_pairs ? 1 : ha->ph_pairs > hb->ph_pairs ?
+	    -1 : 0);
+}
+
+int
+proj_next_chunk(proj_ctx_t *pc, uint32_t *start, uint32_t *end)
+{
+	(void) pthread_mutex_lock(&pc->pc_lock);
+	*start = pc->pc_next;
+	*end = *start + PROJ_CHUNK;
+	if (*end > pc->pc_end) {
+		*end = pc->pc_end;
+	}
+	pc->pc_next = *end;
+	(void) pthread_mutex_unlock(&pc->pc_lock);
+	return (*start < *end);
+}
+
+void *
+proj_worker(void *arg)
+{
+	proj_worker_t *pw = arg;
+	proj_ctx_t *pc = pw->pw_ctx;
+	csr_t *bip = pc->pc_bip;
+	uint32_t start;
+	uint32_t end;
+	while (proj_next_chunk(pc, &start, &end)) {
+		uint32_t a = start;
+		while (a < end) {
+			uint64_t i = bip->cs_off[a];
+			while (i < bip->cs_off[a + 1]) {
+				uint32_t f = bip->cs_adj[i];
+				i++;
+				if (CSR_DEG(bip, f) > pc->pc_hubcap) {
+					continue;
+				}
+				uint64_t j = bip->cs_off[f];
+				while (j < bip->cs_off[f + 1]) {
+					uint32_t b = bip->cs_adj[j];
+					j++;
+					if (b <= a) {
+						continue;
+					}
+					if (pw->pw_acc[b] == 0) {
+						uint32_t *t = ilm_vec_append(
+						    &pw->pw_touched, 1);
+						*t = b;
+					}
+					pw->pw_acc[b]++;
+					pw->pw_pairs++;
+				}
+			}
+			uint64_t k = 0;
+			uint32_t *touched = pw->pw_touched.v_buf;
+			while (k < pw->pw_touched.v_len) {
+				uint32_t b = touched[k];
+				ilm_edge_t *e;
+				uint32_t *w;
+				e = ilm_vec_append(&pw->pw_edges, 1);
+				w = ilm_vec_append(&pw->pw_wt, 1);
+				e->ed_src = bip->cs_keys[a];
+				e->ed_dst = bip->cs_keys[b];
+				*w = pw->pw_acc[b];
+				pw->pw_acc[b] = 0;
+				k++;
+			}
+			pw->pw_touched.v_len = 0;
+			a++;
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Collects the files that have more than `hubcap` authors, biggest first.
+ */
+void
+proj_find_hubs(proj_t *pj, csr_t *bip, uint32_t hubcap)
+{
+	ilm_vec_t hubs;
+	ilm_vec_init(&hubs, sizeof (proj_hub_t));
+	uint32_t v = 0;
+	while (v < bip->cs_nverts) {
+		uint64_t k = CSR_DEG(bip, v);
+		if (NODE_KIND(bip->cs_keys[v]) == NK_FILE && k > hubcap) {
+			proj_hub_t *h = ilm_vec_append(&hubs, 1);
+			h->ph_file = NODE_ID(bip->cs_keys[v]);
+			h->ph_nauthors = k;
+			h->ph_pairs = k * (k - 1) / 2;
+			pj->pj_skipped += h->ph_pairs;
+		}
+		v++;
+	}
+	pj->pj_nhubs = hubs.v_len;
+	pj->pj_hubs = ilm_mk_buf_as(sizeof (proj_hub_t) * (hubs.v_len + 1),
+	    AC_SCRATCH);
+	if (hubs.v_len > 0) {
+		qsort(hubs.v_buf, hubs.v_len, sizeof (proj_hub_t),
+		    proj_hub_cmp);
+		bcopy(hubs.v_buf, pj->pj_hubs,
+		    sizeof (proj_hub_t) * hubs.v_len);
+	}
+	ilm_vec_fini(&hubs);
+}
+
+/*
+ * Projects the file -> author graph onto the authors, leaving out files that
+ * have more than `hubcap` authors.
+ */
+proj_t *
+proj_authors(uint32_t hubcap)
+{
+	proj_t *pj = ilm_mk_zbuf_as(sizeof (proj_t), AC_SCRATCH);
+	pj->pj_hubcap = hubcap;
+	csr_t *bip = csr_freeze(GR_FILE2AUTHOR, CSR_UNDIRECTED);
+	proj_find_hubs(pj, bip, hubcap);
+
+	/* the keys are sorted, so the authors are contiguous */
+	proj_ctx_t pc;
+	bzero(&pc, sizeof (proj_ctx_t));
+	pc.pc_bip = bip;
+	pc.pc_hubcap = hubcap;
+	pc.pc_first = csr_vertex_ge(bip, NODE_KEY(NK_AUTHOR, 0));
+	pc.pc_end = csr_vertex_ge(bip, NODE_KEY(NK_AUTHOR + 1, 0));
+	pc.pc_next = pc.pc_first;
+	(void) pthread_mutex_init(&pc.pc_lock, NULL);
+
+	int nw = ilm_nthreads();
+	proj_worker_t *pw = ilm_mk_zbuf_as(sizeof (proj_worker_t) * nw,
+	    AC_SCRATCH);
+	int i = 0;
+	while (i < nw) {
+		pw[i].pw_ctx = &pc;
+		pw[i].pw_acc = ilm_mk_zbuf_as(sizeof (uint32_t) *
+		    (bip->cs_nverts + 1), AC_SCRATCH);
+		ilm_vec_init(&pw[i].pw_touched, sizeof (uint32_t));
+		ilm_vec_init(&pw[i].pw_edges, sizeof (ilm_edge_t));
+		ilm_vec_init(&pw[i].pw_wt, sizeof (uint32_t));
+		i++;
+	}
+	ilm_run_threads(proj_worker, pw, sizeof (proj_worker_t), nw);
+
+	/* stitch the rows of all of the threads together */
+	ilm_vec_t edges;
+	ilm_vec_t wt;
+	ilm_vec_init(&edges, sizeof (ilm_edge_t));
+	ilm_vec_init(&wt, sizeof (uint32_t));
+	i = 0;
+	while (i < nw) {
+		uint64_t n = pw[i].pw_edges.v_len;
+		if (n > 0) {
+			bcopy(pw[i].pw_edges.v_buf, ilm_vec_append(&edges, n),
+			    sizeof (ilm_edge_t) * n);
+			bcopy(pw[i].pw_wt.v_buf, ilm_vec_append(&wt, n),
+			    sizeof (uint32_t) * n);
+		}
+		pj->pj_pairs += pw[i].pw_pairs;
+		ilm_vec_fini(&pw[i].pw_edges);
+		ilm_vec_fini(&pw[i].pw_wt);
+		ilm_vec_fini(&pw[i].pw_touched);
+		ilm_rm_buf(pw[i].pw_acc, sizeof (uint32_t) *
+		    (bip->cs_nverts + 1));
+		i++;
+	}
+	pj->pj_graph = csr_build(edges.v_buf, edges.v_len, wt.v_buf,
+	    CSR_UNDIRECTED);
+	ilm_vec_fini(&edges);
+	ilm_vec_fini(&wt);
+	ilm_rm_buf(pw, sizeof (proj_worker_t) * nw);
+	(void) pthread_mutex_destroy(&pc.pc_lock);
+	csr_destroy(bip);
+	return (pj);
+}
+
+/*
+ * Returns the projection with a cap of `hubcap`, from the snapshot if it has
+ * one. Either way, the caller passes it to proj_destroy() when done.
+ */
+proj_t *
+proj_get(uint32_t hubcap)
+{
+	if (proj_snapped != NULL && proj_snapped->pj_hubcap == hubcap) {
+		return (proj_snapped);
+	}
+	return (proj_authors(hubcap));
+}
+
+void
+proj_destroy(proj_t *pj)
+{
+	if (pj == proj_snapped) {
+		return;
+	}
+	csr_destroy(pj->pj_graph);
+	ilm_rm_buf(pj->pj_hubs, sizeof (proj_hub_t) * (pj->pj_nhubs + 1));
+	ilm_rm_buf(pj, sizeof (proj_t));
+}
+
+/*
+ * Prints the `n` biggest hubs, and how many pairs each of them would have
+ * added to the projection.
+ */
+void
+proj_print_hubs(proj_t *pj, uint32_t n)
+{
+	fprintf(stderr, "Projected %llu author pairs into %llu edges, "
+	    "skipped %llu pairs from %u hub files.\n",
+	    (unsigned long long)pj->pj_pairs,
+	    (unsigned long long)pj->pj_graph->cs_nedges / 2,
+	    (unsigned long long)pj->pj_skipped, pj->pj_nhubs);
+	uint32_t i = 0;
+	while (i < n && i < pj->pj_nhubs) {
+		proj_hub_t *h = &pj->pj_hubs[i];
+		fprintf(stderr, "%12llu pairs %8u authors  %s\n",
+		    (unsigned long long)h->ph_pairs, h->ph_nauthors,
+		    ilm_id_str(h->ph_file));
+		i++;
+	}
+}
+
+/*
+ * Drops the projection that we loaded from the snapshot, if any. Its arrays
+ * stay mapped, like the rest of the snapshot.
+ */
+void
+proj_snap_drop()
+{
+	if (proj_snapped == NULL) {
+		return;
+	}
+	if (proj_snapped_mapped) {
+		ilm_rm_buf(proj_snapped->pj_graph, sizeof (csr_t));
+		ilm_rm_buf(proj_snapped, sizeof (proj_t));
+	} else {
+		csr_destroy(proj_snapped->pj_graph);
+		ilm_rm_buf(proj_snapped->pj_hubs, sizeof (proj_hub_t) *
+		    (proj_snapped->pj_nhubs + 1));
+		ilm_rm_buf(proj_snapped, sizeof (proj_t));
+	}
+	proj_snapped = NULL;
+	proj_snapped_mapped = 0;
+}
+
+/*
+ * Projects the graphs that are being saved at the default cap, and keeps the
+ * projection around for the queries of this invocation.
+ */
+void
+proj_snap_write(snap_writer_t *sw)
+{
+	proj_snap_drop();
+	proj_t *pj = proj_authors(PROJ_DEFAULT_HUBCAP);
+	csr_t *g = pj->pj_graph;
+	proj_snap_info_t psi;
+	bzero(&psi, sizeof (proj_snap_info_t));
+	psi.psi_hubcap = pj->pj_hubcap;
+	psi.psi_pairs = pj->pj_pairs;
+	psi.psi_skipped = pj->pj_skipped;
+	snap_sect_begin(sw, SK_PROJ_INFO, 1);
+	snap_sect_write(sw, &psi, sizeof (proj_snap_info_t));
+	snap_sect_end(sw);
+	snap_sect_begin(sw, SK_PROJ_KEYS, g->cs_nverts);
+	snap_sect_write(sw, g->cs_keys, sizeof (uint64_t) * g->cs_nverts);
+	snap_sect_end(sw);
+	snap_sect_begin(sw, SK_PROJ_OFF, g->cs_nverts + 1);
+	snap_sect_write(sw, g->cs_off, sizeof (uint64_t) *
+	    (g->cs_nverts + 1));
+	snap_sect_end(sw);
+	snap_sect_begin(sw, SK_PROJ_ADJ, g->cs_nedges);
+	snap_sect_write(sw, g->cs_adj, sizeof (uint32_t) * g->cs_nedges);
+	snap_sect_end(sw);
+	snap_sect_begin(sw, SK_PROJ_WT, g->cs_nedges);
+	snap_sect_write(sw, g->cs_wt, sizeof (uint32_t) * g->cs_nedges);
+	snap_sect_end(sw);
+	snap_sect_begin(sw, SK_PROJ_HUBS, pj->pj_nhubs);
+	snap_sect_write(sw, pj->pj_hubs, sizeof (proj_hub_t) * pj->pj_nhubs);
+	snap_sect_end(sw);
+	proj_snapped = pj;
+}
+
+int
+proj_snap_load(snap_t *s)
+{
+	uint64_t ilen;
+	uint64_t klen;
+	uint64_t olen;
+	uint64_t alen;
+	uint64_t wlen;
+	uint64_t hlen;
+	uint64_t nv;
+	uint64_t no;
+	uint64_t m;
+	uint64_t mw;
+	uint64_t nh;
+	proj_snap_info_t *psi = snap_sect(s, SK_PROJ_INFO, &ilen, NULL);
+	uint64_t *keys = snap_sect(s, SK_PROJ_KEYS, &klen, &nv);
+	uint64_t *off = snap_sect(s, SK_PROJ_OFF, &olen, &no);
+	uint32_t *adj = snap_sect(s, SK_PROJ_ADJ, &alen, &m);
+	uint32_t *wt = snap_sect(s, SK_PROJ_WT, &wlen, &mw);
+	proj_hub_t *hubs = snap_sect(s, SK_PROJ_HUBS, &hlen, &nh);
+	if (ilen != sizeof (proj_snap_info_t) || nv >= UINT32_MAX ||
+	    klen != sizeof (uint64_t) * nv || no != nv + 1 ||
+	    olen != sizeof (uint64_t) * no || off[nv] != m || mw != m ||
+	    alen != sizeof (uint32_t) * m || wlen != sizeof (uint32_t) * m ||
+	    nh >= UINT32_MAX || hlen != sizeof (proj_hub_t) * nh) {
+		return (-1);
+	}
+	proj_snap_drop();
+	csr_t *g = ilm_mk_zbuf_as(sizeof (csr_t), AC_SCRATCH);
+	g->cs_nverts = nv;
+	g->cs_flags = CSR_UNDIRECTED;
+	g->cs_nedges = m;
+	g->cs_keys = keys;
+	g->cs_off = off;
+	g->cs_adj = adj;
+	g->cs_wt = wt;
+	proj_t *pj = ilm_mk_zbuf_as(sizeof (proj_t), AC_SCRATCH);
+	pj->pj_graph = g;
+	pj->pj_hubs = hubs;
+	pj->pj_nhubs = nh;
+	pj->pj_hubcap = psi->psi_hubcap;
+	pj->pj_pairs = psi->psi_pairs;
+	pj->pj_skipped = psi->psi_skipped;
+	proj_snapped = pj;
+	proj_snapped_mapped = 1;
+	return (0);
+}
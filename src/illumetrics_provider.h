@@ -22,6 +22,96 @@ extern "C" {
 #define	ILLUMETRICS_GOT_HERE_ENABLED() \
 	__dtraceenabled_illumetrics___got_here(0)
 #endif
+#define	ILLUMETRICS_PULL_START(arg0, arg1) \
+	__dtrace_illumetrics___pull__start(arg0, arg1)
+#ifndef	__sparc
+#define	ILLUMETRICS_PULL_START_ENABLED() \
+	__dtraceenabled_illumetrics___pull__start()
+#else
+#define	ILLUMETRICS_PULL_START_ENABLED() \
+	__dtraceenabled_illumetrics___pull__start(0)
+#endif
+#define	ILLUMETRICS_PULL_DONE(arg0, arg1, arg2, arg3, arg4) \
+	__dtrace_illumetrics___pull__done(arg0, arg1, arg2, arg3, arg4)
+#ifndef	__sparc
+#define	ILLUMETRICS_PULL_DONE_ENABLED() \
+	__dtraceenabled_illumetrics___pull__done()
+#else
+#define	ILLUMETRICS_PULL_DONE_ENABLED() \
+	__dtraceenabled_illumetrics___pull__done(0)
+#endif
+#define	ILLUMETRICS_COMMIT_INGESTED(arg0, arg1, arg2) \
+	__dtrace_illumetrics___commit__ingested(arg0, arg1, arg2)
+#ifndef	__sparc
+#define	ILLUMETRICS_COMMIT_INGESTED_ENABLED() \
+	__dtraceenabled_illumetrics___commit__ingested()
+#else
+#define	ILLUMETRICS_COMMIT_INGESTED_ENABLED() \
+	__dtraceenabled_illumetrics___commit__ingested(0)
+#endif
+#define	ILLUMETRICS_EDGE_ADD(arg0, arg1, arg2) \
+	__dtrace_illumetrics___edge__add(arg0, arg1, arg2)
+#ifndef	__sparc
+#define	ILLUMETRICS_EDGE_ADD_ENABLED() \
+	__dtraceenabled_illumetrics___edge__add()
+#else
+#define	ILLUMETRICS_EDGE_ADD_ENABLED() \
+	__dtraceenabled_illumetrics___edge__add(0)
+#endif
+#define	ILLUMETRICS_CENT_START(arg0, arg1) \
+	__dtrace_illumetrics___cent__start(arg0, arg1)
+#ifndef	__sparc
+#define	ILLUMETRICS_CENT_START_ENABLED() \
+	__dtraceenabled_illumetrics___cent__start()
+#else
+#define	ILLUMETRICS_CENT_START_ENABLED() \
+	__dtraceenabled_illumetrics___cent__start(0)
+#endif
+#define	ILLUMETRICS_CENT_DONE(arg0, arg1) \
+	__dtrace_illumetrics___cent__done(arg0, arg1)
+#ifndef	__sparc
+#define	ILLUMETRICS_CENT_DONE_ENABLED() \
+	__dtraceenabled_illumetrics___cent__done()
+#else
+#define	ILLUMETRICS_CENT_DONE_ENABLED() \
+	__dtraceenabled_illumetrics___cent__done(0)
+#endif
+#define	ILLUMETRICS_COMMIT_DIFFED(arg0, arg1, arg2) \
+	__dtrace_illumetrics___commit__diffed(arg0, arg1, arg2)
+#ifndef	__sparc
+#define	ILLUMETRICS_COMMIT_DIFFED_ENABLED() \
+	__dtraceenabled_illumetrics___commit__diffed()
+#else
+#define	ILLUMETRICS_COMMIT_DIFFED_ENABLED() \
+	__dtraceenabled_illumetrics___commit__diffed(0)
+#endif
+#define	ILLUMETRICS_COMMIT_DEDUP(arg0, arg1) \
+	__dtrace_illumetrics___commit__dedup(arg0, arg1)
+#ifndef	__sparc
+#define	ILLUMETRICS_COMMIT_DEDUP_ENABLED() \
+	__dtraceenabled_illumetrics___commit__dedup()
+#else
+#define	ILLUMETRICS_COMMIT_DEDUP_ENABLED() \
+	__dtraceenabled_illumetrics___commit__dedup(0)
+#endif
+#define	ILLUMETRICS_CACHE_HIT(arg0) \
+	__dtrace_illumetrics___cache__hit(arg0)
+#ifndef	__sparc
+#define	ILLUMETRICS_CACHE_HIT_ENABLED() \
+	__dtraceenabled_illumetrics___cache__hit()
+#else
+#define	ILLUMETRICS_CACHE_HIT_ENABLED() \
+	__dtraceenabled_illumetrics___cache__hit(0)
+#endif
+#define	ILLUMETRICS_CACHE_MISS(arg0) \
+	__dtrace_illumetrics___cache__miss(arg0)
+#ifndef	__sparc
+#define	ILLUMETRICS_CACHE_MISS_ENABLED() \
+	__dtraceenabled_illumetrics___cache__miss()
+#else
+#define	ILLUMETRICS_CACHE_MISS_ENABLED() \
+	__dtraceenabled_illumetrics___cache__miss(0)
+#endif
 
 
 extern void __dtrace_illumetrics___got_here(int);
@@ -30,11 +120,91 @@ extern int __dtraceenabled_illumetrics___got_here(void);
 #else
 extern int __dtraceenabled_illumetrics___got_here(long);
 #endif
+extern void __dtrace_illumetrics___pull__start(char *, char *);
+#ifndef	__sparc
+extern int __dtraceenabled_illumetrics___pull__start(void);
+#else
+extern int __dtraceenabled_illumetrics___pull__start(long);
+#endif
+extern void __dtrace_illumetrics___pull__done(char *, char *, int, uint64_t, uint64_t);
+#ifndef	__sparc
+extern int __dtraceenabled_illumetrics___pull__done(void);
+#else
+extern int __dtraceenabled_illumetrics___pull__done(long);
+#endif
+extern void __dtrace_illumetrics___commit__ingested(uint32_t, uint8_t *, uint32_t);
+#ifndef	__sparc
+extern int __dtraceenabled_illumetrics___commit__ingested(void);
+#else
+extern int __dtraceenabled_illumetrics___commit__ingested(long);
+#endif
+extern void __dtrace_illumetrics___edge__add(int, uint64_t, uint64_t);
+#ifndef	__sparc
+extern int __dtraceenabled_illumetrics___edge__add(void);
+#else
+extern int __dtraceenabled_illumetrics___edge__add(long);
+#endif
+extern void __dtrace_illumetrics___cent__start(int, uint32_t);
+#ifndef	__sparc
+extern int __dtraceenabled_illumetrics___cent__start(void);
+#else
+extern int __dtraceenabled_illumetrics___cent__start(long);
+#endif
+extern void __dtrace_illumetrics___cent__done(int, uint32_t);
+#ifndef	__sparc
+extern int __dtraceenabled_illumetrics___cent__done(void);
+#else
+extern int __dtraceenabled_illumetrics___cent__done(long);
+#endif
+extern void __dtrace_illumetrics___commit__diffed(uint32_t, uint8_t *, uint32_t);
+#ifndef	__sparc
+extern int __dtraceenabled_illumetrics___commit__diffed(void);
+#else
+extern int __dtraceenabled_illumetrics___commit__diffed(long);
+#endif
+extern void __dtrace_illumetrics___commit__dedup(uint32_t, uint8_t *);
+#ifndef	__sparc
+extern int __dtraceenabled_illumetrics___commit__dedup(void);
+#else
+extern int __dtraceenabled_illumetrics___commit__dedup(long);
+#endif
+extern void __dtrace_illumetrics___cache__hit(char *);
+#ifndef	__sparc
+extern int __dtraceenabled_illumetrics___cache__hit(void);
+#else
+extern int __dtraceenabled_illumetrics___cache__hit(long);
+#endif
+extern void __dtrace_illumetrics___cache__miss(char *);
+#ifndef	__sparc
+extern int __dtraceenabled_illumetrics___cache__miss(void);
+#else
+extern int __dtraceenabled_illumetrics___cache__miss(long);
+#endif
 
 #else
 
 #define	ILLUMETRICS_GOT_HERE(arg0)
 #define	ILLUMETRICS_GOT_HERE_ENABLED() (0)
+#define	ILLUMETRICS_PULL_START(arg0, arg1)
+#define	ILLUMETRICS_PULL_START_ENABLED() (0)
+#define	ILLUMETRICS_PULL_DONE(arg0, arg1, arg2, arg3, arg4)
+#define	ILLUMETRICS_PULL_DONE_ENABLED() (0)
+#define	ILLUMETRICS_COMMIT_INGESTED(arg0, arg1, arg2)
+#define	ILLUMETRICS_COMMIT_INGESTED_ENABLED() (0)
+#define	ILLUMETRICS_EDGE_ADD(arg0, arg1, arg2)
+#define	ILLUMETRICS_EDGE_ADD_ENABLED() (0)
+#define	ILLUMETRICS_CENT_START(arg0, arg1)
+#define	ILLUMETRICS_CENT_START_ENABLED() (0)
+#define	ILLUMETRICS_CENT_DONE(arg0, arg1)
+#define	ILLUMETRICS_CENT_DONE_ENABLED() (0)
+#define	ILLUMETRICS_COMMIT_DIFFED(arg0, arg1, arg2)
+#define	ILLUMETRICS_COMMIT_DIFFED_ENABLED() (0)
+#define	ILLUMETRICS_COMMIT_DEDUP(arg0, arg1)
+#define	ILLUMETRICS_COMMIT_DEDUP_ENABLED() (0)
+#define	ILLUMETRICS_CACHE_HIT(arg0)
+#define	ILLUMETRICS_CACHE_HIT_ENABLED() (0)
+#define	ILLUMETRICS_CACHE_MISS(arg0)
+#define	ILLUMETRICS_CACHE_MISS_ENABLED() (0)
 
 #endif
 
@@ -0,0 +1,105 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * The probes of `illumetrics_provider.d`, for systems without DTrace.
+ *
+ * On illumos, `illumetrics_provider.h` is generated by `dtrace -h`, and the
+ * probes are DTrace USDT probes. On Linux we fire the same probes, with the
+ * same provider, probe names and arguments, through the SystemTap
+ * `<sys/sdt.h>` macros, which bpftrace, perf and SystemTap all understand:
+ *
+ *	bpftrace -e 'usdt:./illumetrics:illumetrics:commit__ingested
+ *	    { @[arg0] = count(); }'
+ *
+ * A disabled probe is a single nop. We don't use the SystemTap semaphores
+ * (which would need `dtrace -G` from SystemTap), so the _ENABLED() macros are
+ * always true, and no probe site computes an argument just for the probe.
+ *
+ * A build without <sys/sdt.h> would silently lose the probes, so it's an
+ * error. Building with -D ILLUMETRICS_NO_SDT compiles the probes to nothing
+ * on purpose.
+ */
+
+#ifndef	_ILLUMETRICS_SDT_H
+#define	_ILLUMETRICS_SDT_H
+
+#ifndef	ILLUMETRICS_NO_SDT
+
+#if defined(__has_include)
+#if !__has_include(<sys/sdt.h>)
+#error "no <sys/sdt.h>, install it or build with -D ILLUMETRICS_NO_SDT"
+#endif
+#endif
+
+#include <sys/sdt.h>
+
+#define	ILLUMETRICS_GOT_HERE(arg0) \
+	DTRACE_PROBE1(illumetrics, got_here, arg0)
+#define	ILLUMETRICS_GOT_HERE_ENABLED() (1)
+#define	ILLUMETRICS_PULL_START(arg0, arg1) \
+	DTRACE_PROBE2(illumetrics, pull__start, arg0, arg1)
+#define	ILLUMETRICS_PULL_START_ENABLED() (1)
+#define	ILLUMETRICS_PULL_DONE(arg0, arg1, arg2, arg3, arg4) \
+	DTRACE_PROBE5(illumetrics, pull__done, arg0, arg1, arg2, arg3, arg4)
+#define	ILLUMETRICS_PULL_DONE_ENABLED() (1)
+#define	ILLUMETRICS_COMMIT_INGESTED(arg0, arg1, arg2) \
+	DTRACE_PROBE3(illumetrics, commit__ingested, arg0, arg1, arg2)
+#define	ILLUMETRICS_COMMIT_INGESTED_ENABLED() (1)
+#define	ILLUMETRICS_EDGE_ADD(arg0, arg1, arg2) \
+	DTRACE_PROBE3(illumetrics, edge__add, arg0, arg1, arg2)
+#define	ILLUMETRICS_EDGE_ADD_ENABLED() (1)
+#define	ILLUMETRICS_CENT_START(arg0, arg1) \
+	DTRACE_PROBE2(illumetrics, cent__start, arg0, arg1)
+#define	ILLUMETRICS_CENT_START_ENABLED() (1)
+#define	ILLUMETRICS_CENT_DONE(arg0, arg1) \
+	DTRACE_PROBE2(illumetrics, cent__done, arg0, arg1)
+#define	ILLUMETRICS_CENT_DONE_ENABLED() (1)
+#define	ILLUMETRICS_COMMIT_DIFFED(arg0, arg1, arg2) \
+	DTRACE_PROBE3(illumetrics, commit__diffed, arg0, arg1, arg2)
+#define	ILLUMETRICS_COMMIT_DIFFED_ENABLED() (1)
+#define	ILLUMETRICS_COMMIT_DEDUP(arg0, arg1) \
+	DTRACE_PROBE2(illumetrics, commit__dedup, arg0, arg1)
+#define	ILLUMETRICS_COMMIT_DEDUP_ENABLED() (1)
+#define	ILLUMETRICS_CACHE_HIT(arg0) \
+	DTRACE_PROBE1(illumetrics, cache__hit, arg0)
+#define	ILLUMETRICS_CACHE_HIT_ENABLED() (1)
+#define	ILLUMETRICS_CACHE_MISS(arg0) \
+	DTRACE_PROBE1(illumetrics, cache__miss, arg0)
+#define	ILLUMETRICS_CACHE_MISS_ENABLED() (1)
+
+#else
+
+#define	ILLUMETRICS_GOT_HERE(arg0)
+#define	ILLUMETRICS_GOT_HERE_ENABLED() (0)
+#define	ILLUMETRICS_PULL_START(arg0, arg1)
+#define	ILLUMETRICS_PULL_START_ENABLED() (0)
+#define	ILLUMETRICS_PULL_DONE(arg0, arg1, arg2, arg3, arg4)
+#define	ILLUMETRICS_PULL_DONE_ENABLED() (0)
+#define	ILLUMETRICS_COMMIT_INGESTED(arg0, arg1, arg2)
+#define	ILLUMETRICS_COMMIT_INGESTED_ENABLED() (0)
+#define	ILLUMETRICS_EDGE_ADD(arg0, arg1, arg2)
+#define	ILLUMETRICS_EDGE_ADD_ENABLED() (0)
+#define	ILLUMETRICS_CENT_START(arg0, arg1)
+#define	ILLUMETRICS_CENT_START_ENABLED() (0)
+#define	ILLUMETRICS_CENT_DONE(arg0, arg1)
+#define	ILLUMETRICS_CENT_DONE_ENABLED() (0)
+#define	ILLUMETRICS_COMMIT_DIFFED(arg0, arg1, arg2)
+#define	ILLUMETRICS_COMMIT_DIFFED_ENABLED() (0)
+#define	ILLUMETRICS_COMMIT_DEDUP(arg0, arg1)
+#define	ILLUMETRICS_COMMIT_DEDUP_ENABLED() (0)
+#define	ILLUMETRICS_CACHE_HIT(arg0)
+#define	ILLUMETRICS_CACHE_HIT_ENABLED() (0)
+#define	ILLUMETRICS_CACHE_MISS(arg0)
+#define	ILLUMETRICS_CACHE_MISS_ENABLED() (0)
+
+#endif
+
+#endif	/* _ILLUMETRICS_SDT_H */
@@ -0,0 +1,439 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Snapshots
+ * =========
+ *
+ * Walking and diffing the history of every repository takes a long time, and
+ * most invocations only want to query the graphs. So once the graphs have
+ * been built, we save everything that they are made of to a single file,
+ * `stor/SNAP_FILE`: the interned strings, the commit store, the path trie,
+ * the degree counters, the merged edge log of every graph, and the author
+ * projection. The next invocation maps that file into memory, and points the
+ * subsystems straight at it.
+ * Nothing gets parsed or copied, so loading a snapshot only touches the pages
+ * that the query ends up reading.
+ *
+ * The file starts with a header, followed by the sections. Each subsystem
+ * writes and loads its own sections (see the *_snap_write() and
+ * *_snap_load() functions). Every section starts on a page boundary, so that
+ * the arrays in it are suitably aligned in memory. The header records where
+ * each section is, how long it is, and its checksum.
+ *
+ * Verifying every checksum would read the whole file, which is what mapping
+ * it is meant to avoid. The snapshot is written to a temporary file, synced,
+ * and renamed into place, so a crash can't leave a torn one behind. So a load
+ * only checks the header, the section table, and the (small) list of
+ * repositories, and `--verify-snapshot` checks every section.
+ *
+ * The file is mapped privately and writable. When a `pull` appends to a
+ * loaded store, the appends copy the arrays out of the mapping (see
+ * ilm_vec_map()), and in-place updates (like trie stamps) are
+ * copy-on-write. The file itself is never modified; a new snapshot is written
+ * to a temporary file, which is renamed over the old one.
+ *
+ * A snapshot is only good for the list of repositories it was built from,
+ * since commits refer to repositories by their index. So the first section
+ * is the list of repositories, and a snapshot whose list doesn't match the
+ * current one is rebuilt from scratch. A snapshot that fails any other check
+ * is also rebuilt from scratch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "illumetrics_impl.h"
+
+#define	SNAP_FILE	".illumetrics_snap"
+#define	SNAP_TMP_FILE	".illumetrics_snap.tmp"
+#define	SNAP_MAGIC	"ILMSNAP"
+#define	SNAP_VERSION	7
+#define	SNAP_BOM	0x01020304 /* catches snapshots from the other endian */
+#define	SNAP_ALIGN	4096
+#define	SNAP_PADDED(len) \
+	(((len) + SNAP_ALIGN - 1) & ~(uint64_t)(SNAP_ALIGN - 1))
+
+typedef struct snap_sect_hdr {
+	uint32_t	ss_kind; /* 0 if the section is missing */
+	uint32_t	ss_pad;
+	uint64_t	ss_off; /* from the start of the file */
+	uint64_t	ss_len; /* in bytes, without the padding */
+	uint64_t	ss_count; /* what this means depends on the kind */
+	uint64_t	ss_sum1; /* checksum of the section, with the padding */
+	uint64_t	ss_sum2;
+} snap_sect_hdr_t;
+
+typedef struct snap_hdr {
+	char		sh_magic[8];
+	uint32_t	sh_version;
+	uint32_t	sh_bom;
+	uint64_t	sh_size; /* of the whole file */
+	snap_sect_hdr_t	sh_sect[SK_NKINDS]; /* indexed by snap_kind_t */
+} snap_hdr_t;
+
+typedef char snap_hdr_sz_check[sizeof (snap_hdr_t) <= SNAP_ALIGN ? 1 : -1];
+
+struct snap {
+	char		*s_base;
+	uint64_t	s_size;
+	snap_hdr_t	*s_hdr;
+};
+
+struct snap_writer {
+	int		sw_fd;
+	uint64_t	sw_off;
+	snap_hdr_t	sw_hdr;
+	snap_sect_hdr_t	*sw_cur;
+};
+
+/*
+ * The loaded snapshot. It stays mapped until we exit, because the subsystems
+ * point into it.
+ */
+snap_t snap;
+
+/*
+ * A Fletcher-like sum over 64-bit words. The second sum makes it sensitive to
+ * the order of the words. `len` must be a multiple of 8, which it always is,
+ * because sections are padded to SNAP_ALIGN.
+ */
+void
+snap_sum(const char *buf, uint64_t len, uint64_t *s1, uint64_t *s2)
+{
+	const uint64_t *w = (const uint64_t *)buf;
+	uint64_t n = len / sizeof (uint64_t);
+	uint64_t a = 0;
+	uint64_t b = 0;
+	uint64_t i = 0;
+	while (i < n) {
+		a += w[i];
+		b += a;
+		i++;
+	}
+	*s1 = a;
+	*s2 = b;
+}
+
+/*
+ * Returns a pointer to the section of kind `k`. If `len` or `count` aren't
+ * NULL, the section's length in bytes and its count are stored there.
+ * snap_load() makes sure that every section is present.
+ */
+void *
+snap_sect(snap_t *s, snap_kind_t k, uint64_t *len, uint64_t *count)
+{
+	snap_sect_hdr_t *ss = &s->s_hdr->sh_sect[k];
+	if (len != NULL) {
+		*len = ss->ss_len;
+	}
+	if (count != NULL) {
+		*count = ss->ss_count;
+	}
+	return (s->s_base + ss->ss_off);
+}
+
+void
+snap_sect_begin(snap_writer_t *sw, snap_kind_t k, uint64_t count)
+{
+	sw->sw_cur = &sw->sw_hdr.sh_sect[k];
+	sw->sw_cur->ss_kind = k;
+	sw->sw_cur->ss_off = sw->sw_off;
+	sw->sw_cur->ss_count = count;
+}
+
+void
+snap_sect_write(snap_writer_t *sw, const void *buf, uint64_t len)
+{
+	atomic_write(sw->sw_fd, (void *)buf, len);
+	sw->sw_off += len;
+}
+
+void
+snap_sect_zero(snap_writer_t *sw, uint64_t len)
+{
+	char zeros[SNAP_ALIGN];
+	bzero(zeros, SNAP_ALIGN);
+	while (len > 0) {
+		uint64_t n = len < SNAP_ALIGN ? len : SNAP_ALIGN;
+		snap_sect_write(sw, zeros, n);
+		len -= n;
+	}
+}
+
+void
+snap_sect_end(snap_writer_t *sw)
+{
+	sw->sw_cur->ss_len = sw->sw_off - sw->sw_cur->ss_off;
+	uint64_t rem = sw->sw_off % SNAP_ALIGN;
+	if (rem != 0) {
+		snap_sect_zero(sw, SNAP_ALIGN - rem);
+	}
+	sw->sw_cur = NULL;
+}
+
+/*
+ * Most subsystems keep their state in ilm_vec_t's, which are saved and loaded
+ * as a single section each.
+ */
+void
+snap_vec_write(snap_writer_t *sw, snap_kind_t k, ilm_vec_t *v)
+{
+	snap_sect_begin(sw, k, v->v_len);
+	snap_sect_write(sw, v->v_buf, v->v_len * v->v_esz);
+	snap_sect_end(sw);
+}
+
+int
+snap_vec_load(snap_t *s, snap_kind_t k, ilm_vec_t *v)
+{
+	uint64_t len;
+	uint64_t count;
+	void *buf = snap_sect(s, k, &len, &count);
+	if (len != count * v->v_esz) {
+		return (-1);
+	}
+	ilm_vec_map(v, buf, count);
+	return (0);
+}
+
+/*
+ * The list of repositories, as NUL-terminated `owner/name` strings, in the
+ * order of their IDs.
+ */
+void
+snap_repos_write(snap_writer_t *sw)
+{
+	snap_sect_begin(sw, SK_REPOS, nrepos);
+	uint32_t i = 0;
+	while (i < nrepos) {
+		repo_t *r = repo_table[i];
+		snap_sect_write(sw, r->rp_owner, strlen(r->rp_owner));
+		snap_sect_write(sw, "/", 1);
+		snap_sect_write(sw, r->rp_name, strlen(r->rp_name) + 1);
+		i++;
+	}
+	snap_sect_end(sw);
+}
+
+int
+snap_repos_match(snap_t *s)
+{
+	uint64_t len;
+	uint64_t count;
+	char *p = snap_sect(s, SK_REPOS, &len, &count);
+	char *end = p + len;
+	if (count != nrepos) {
+		return (0);
+	}
+	uint32_t i = 0;
+	while (i < nrepos) {
+		repo_t *r = repo_table[i];
+		size_t olen = strlen(r->rp_owner);
+		size_t nlen = strlen(r->rp_name);
+		if ((uint64_t)(end - p) < olen + nlen + 2 ||
+		    strncmp(p, r->rp_owner, olen) != 0 || p[olen] != '/' ||
+		    strncmp(p + olen + 1, r->rp_name, nlen) != 0 ||
+		    p[olen + 1 + nlen] != '\0') {
+			return (0);
+		}
+		p += olen + nlen + 2;
+		i++;
+	}
+	return (1);
+}
+
+/*
+ * Checksums the section `ss` of the file at `base`, including its padding.
+ */
+void
+snap_sect_sum(char *base, snap_sect_hdr_t *ss, uint64_t *s1, uint64_t *s2)
+{
+	snap_sum(base + ss->ss_off, SNAP_PADDED(ss->ss_len), s1, s2);
+}
+
+int
+snap_sect_ok(snap_t *s, snap_kind_t k)
+{
+	snap_sect_hdr_t *ss = &s->s_hdr->sh_sect[k];
+	uint64_t s1;
+	uint64_t s2;
+	snap_sect_sum(s->s_base, ss, &s1, &s2);
+	return (s1 == ss->ss_sum1 && s2 == ss->ss_sum2);
+}
+
+/*
+ * Returns NULL if the mapped file looks like a complete snapshot of the
+ * current repositories, and the reason why it doesn't otherwise. Only the
+ * list of repositories is checksummed, unless `verify` is set.
+ */
+const char *
+snap_check(snap_t *s, int verify)
+{
+	snap_hdr_t *sh = s->s_hdr;
+	if (s->s_size < SNAP_ALIGN ||
+	    strncmp(sh->sh_magic, SNAP_MAGIC, sizeof (sh->sh_magic)) != 0) {
+		return ("not a snapshot");
+	}
+	if (sh->sh_version != SNAP_VERSION || sh->sh_bom != SNAP_BOM) {
+		return ("incompatible version");
+	}
+	if (sh->sh_size != s->s_size) {
+		return ("truncated");
+	}
+	int k = SK_REPOS;
+	while (k < SK_NKINDS) {
+		snap_sect_hdr_t *ss = &sh->sh_sect[k];
+		if (ss->ss_kind != (uint32_t)k || ss->ss_off < SNAP_ALIGN ||
+		    ss->ss_off % SNAP_ALIGN != 0 || ss->ss_off > s->s_size ||
+		    SNAP_PADDED(ss->ss_len) > s->s_size - ss->ss_off) {
+			return ("bad section table");
+		}
+		k++;
+	}
+	if (!snap_sect_ok(s, SK_REPOS)) {
+		return ("checksum mismatch");
+	}
+	k = SK_REPOS + 1;
+	while (verify && k < SK_NKINDS) {
+		if (!snap_sect_ok(s, k)) {
+			return ("checksum mismatch");
+		}
+		k++;
+	}
+	if (!snap_repos_match(s)) {
+		return ("the list of repositories changed");
+	}
+	return (NULL);
+}
+
+/*
+ * Maps the snapshot, and loads it into the subsystems. Must be called before
+ * anything has been interned or stored. Returns non-zero if there is no
+ * usable snapshot, in which case nothing has been loaded.
+ */
+int
+snap_load()
+{
+	int fd = openat(stor_fd, SNAP_FILE, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			perror("snap_load:openat");
+		}
+		return (-1);
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		perror("snap_load:fstat");
+		(void) close(fd);
+		return (-1);
+	}
+	if ((uint64_t)st.st_size < SNAP_ALIGN) {
+		(void) close(fd);
+		fprintf(stderr, "Ignoring snapshot: truncated.\n");
+		return (-1);
+	}
+	void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE, fd, 0);
+	(void) close(fd);
+	if (base == MAP_FAILED) {
+		perror("snap_load:mmap");
+		return (-1);
+	}
+	snap.s_base = base;
+	snap.s_size = st.st_size;
+	snap.s_hdr = base;
+	const char *why = snap_check(&snap, constraints.cn_snap_verify);
+	if (why != NULL) {
+		fprintf(stderr, "Ignoring snapshot: %s.\n", why);
+		(void) munmap(base, st.st_size);
+		bzero(&snap, sizeof (snap_t));
+		return (-1);
+	}
+	/*
+	 * The section table checked out, so a subsystem rejecting its sections
+	 * means that the snapshot was written by a broken illumetrics, or was
+	 * damaged. We can't undo the subsystems that already loaded, so we
+	 * bail.
+	 */
+	if (ilm_intern_snap_load(&snap) != 0 || cstore_snap_load(&snap) != 0 ||
+	    cset_snap_load(&snap) != 0 || trie_snap_load(&snap) != 0 ||
+	    deg_snap_load(&snap) != 0 || graph_snap_load(&snap) != 0 ||
+	    proj_snap_load(&snap) != 0) {
+		fprintf(stderr, "Corrupt snapshot, remove %s and retry.\n",
+		    SNAP_FILE);
+		exit(-1);
+	}
+	return (0);
+}
+
+/*
+ * Writes a new snapshot, and atomically replaces the old one with it.
+ */
+void
+snap_save()
+{
+	snap_writer_t sw;
+	bzero(&sw, sizeof (snap_writer_t));
+	sw.sw_fd = openat(stor_fd, SNAP_TMP_FILE, O_RDWR | O_CREAT | O_TRUNC,
+	    S_IRUSR | S_IWUSR);
+	if (sw.sw_fd < 0) {
+		perror("snap_save:openat");
+		exit(-1);
+	}
+	/* the header goes in last, once we know where everything is */
+	snap_sect_zero(&sw, SNAP_ALIGN);
+	snap_repos_write(&sw);
+	ilm_intern_snap_write(&sw);
+	cstore_snap_write(&sw);
+	cset_snap_write(&sw);
+	trie_snap_write(&sw);
+	deg_snap_write(&sw);
+	graph_snap_write(&sw);
+	proj_snap_write(&sw);
+
+	snap_hdr_t *sh = &sw.sw_hdr;
+	bcopy(SNAP_MAGIC, sh->sh_magic, sizeof (SNAP_MAGIC));
+	sh->sh_version = SNAP_VERSION;
+	sh->sh_bom = SNAP_BOM;
+	sh->sh_size = sw.sw_off;
+	char *m = mmap(NULL, sw.sw_off, PROT_READ, MAP_SHARED, sw.sw_fd, 0);
+	if (m == MAP_FAILED) {
+		perror("snap_save:mmap");
+		exit(-1);
+	}
+	int k = SK_REPOS;
+	while (k < SK_NKINDS) {
+		snap_sect_hdr_t *ss = &sh->sh_sect[k];
+		snap_sect_sum(m, ss, &ss->ss_sum1, &ss->ss_sum2);
+		k++;
+	}
+	(void) munmap(m, sw.sw_off);
+	if (pwrite(sw.sw_fd, sh, sizeof (snap_hdr_t), 0) !=
+	    sizeof (snap_hdr_t)) {
+		perror("snap_save:pwrite");
+		exit(-1);
+	}
+	if (fsync(sw.sw_fd) < 0) {
+		perror("snap_save:fsync");
+		exit(-1);
+	}
+	(void) close(sw.sw_fd);
+	if (renameat(stor_fd, SNAP_TMP_FILE, stor_fd, SNAP_FILE) < 0) {
+		perror("snap_save:renameat");
+		exit(-1);
+	}
+}
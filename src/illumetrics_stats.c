@@ -0,0 +1,310 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Run Statistics
+ * ==============
+ *
+ * With `--stats`, we report how a run spent its time and memory, phase by
+ * phase, so that regressions can be tracked across releases and batch hosts
+ * can be sized. The phases are:
+ *
+ *	load		reading the list-files and setting up the commit set
+ *	pull		cloning and fetching (see update_all_repos())
+ *	graphs		construct_graphs(), including the walk and the diffs
+ *	walk		reading commits out of the history walk
+ *	diff		diffing the walked commits, in parallel
+ *	centrality	the centrality step, including the projection
+ *
+ * The walk and the diffs alternate, a batch at a time, so they are entered
+ * once per batch, and their totals add up to most of `graphs`.
+ *
+ * For every phase we add up the wall time and the CPU time (of all of the
+ * threads) spent in it, and the bytes that were allocated in it, by what they
+ * were allocated for (see alloc_cache_t): the repo_t cache, arenas (which
+ * count the blocks they allocate, rather than every object they hand out),
+ * growing arrays, the string table, the commit set, frozen graphs, the
+ * scratch space of the analyses, and everything else. We also record the peak
+ * RSS of the process at the end of the phase, and the commits and edges that
+ * the phase got through, from which we get its rates.
+ *
+ * The numbers are always collected, since the load phase runs before the
+ * arguments are parsed, and collecting them is cheap: a couple of getrusage()
+ * calls per batch and an atomic add per buffer, and the hot paths allocate
+ * whole arrays, pages and blocks, not objects (see illumetrics_umem.c).
+ * `--stats` prints them on stderr, and `--stats=<file>` writes them to
+ * `<file>` as JSON instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#ifndef	__linux__
+#include <procfs.h>
+#endif
+#include "illumetrics_impl.h"
+
+typedef struct stat_rec {
+	uint64_t	sr_calls;
+	int64_t		sr_wall; /* nsec */
+	int64_t		sr_cpu; /* nsec */
+	uint64_t	sr_rss; /* KB, the peak at the end of the phase */
+	uint64_t	sr_commits;
+	uint64_t	sr_edges;
+	uint64_t	sr_alloc[AC_NCACHES]; /* bytes */
+	/* the clocks and counters at stats_begin() */
+	int64_t		sr_wall0;
+	int64_t		sr_cpu0;
+	uint64_t	sr_alloc0[AC_NCACHES];
+} stat_rec_t;
+
+char *stats_phase_names[SP_NPHASES] = {
+	"load", "pull", "graphs", "walk", "diff", "centrality"
+};
+
+char *stats_cache_names[AC_NCACHES] = {
+	"repo", "buf", "arena", "vec", "str", "cset", "csr", "scratch"
+};
+
+static stat_rec_t st[SP_NPHASES];
+static uint64_t st_alloc[AC_NCACHES];
+static uint64_t st_peak_rss;
+
+/*
+ * Returns the CPU time of the process (all of its threads), in nsec.
+ */
+int64_t
+stats_cpu()
+{
+	struct rusage ru;
+	(void) getrusage(RUSAGE_SELF, &ru);
+	return ((ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000LL +
+	    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000LL);
+}
+
+/*
+ * Returns the peak RSS of the process so far, in KB. Linux keeps track of the
+ * peak for us. illumos doesn't fill in `ru_maxrss`, so there we sample the
+ * current RSS from psinfo, and keep the largest sample.
+ */
+uint64_t
+stats_rss()
+{
+#ifdef	__linux__
+	struct rusage ru;
+	(void) getrusage(RUSAGE_SELF, &ru);
+	uint64_t rss = ru.ru_maxrss;
+#else
+	uint64_t rss = 0;
+	psinfo_t ps;
+	int fd = open("/proc/self/psinfo", O_RDONLY);
+	if (fd >= 0) {
+		if (pread(fd, &ps, sizeof (ps), 0) == sizeof (ps)) {
+			rss = ps.pr_rssize;
+		}
+		(void) close(fd);
+	}
+#endif
+	if (rss > st_peak_rss) {
+		st_peak_rss = rss;
+	}
+	return (st_peak_rss);
+}
+
+/*
+ * Counts `sz` bytes allocated from cache `c`. Called by every ilm_mk_*
+ * function, from any thread.
+ */
+void
+stats_alloc(alloc_cache_t c, size_t sz)
+{
+	(void) __sync_fetch_and_add(&st_alloc[c], sz);
+}
+
+void
+stats_begin(stat_phase_t p)
+{
+	stat_rec_t *sr = &st[p];
+	sr->sr_calls++;
+	int c = 0;
+	while (c < AC_NCACHES) {
+		sr->sr_alloc0[c] = st_alloc[c];
+		c++;
+	}
+	sr->sr_cpu0 = stats_cpu();
+	sr->sr_wall0 = ilm_gethrtime();
+}
+
+void
+stats_end(stat_phase_t p)
+{
+	stat_rec_t *sr = &st[p];
+	sr->sr_wall += ilm_gethrtime() - sr->sr_wall0;
+	sr->sr_cpu += stats_cpu() - sr->sr_cpu0;
+	int c = 0;
+	while (c < AC_NCACHES) {
+		sr->sr_alloc[c] += st_alloc[c] - sr->sr_alloc0[c];
+		c++;
+	}
+	uint64_t rss = stats_rss();
+	if (rss > sr->sr_rss) {
+		sr->sr_rss = rss;
+	}
+}
+
+/*
+ * Counts the commits and edges that phase `p` got through.
+ */
+void
+stats_count(stat_phase_t p, uint64_t commits, uint64_t edges)
+{
+	st[p].sr_commits += commits;
+	st[p].sr_edges += edges;
+}
+
+double
+stats_rate(uint64_t n, int64_t nsec)
+{
+	return (nsec == 0 ? 0 : (double)n * 1e9 / nsec);
+}
+
+void
+stats_print()
+{
+	fprintf(stderr, "\n%-10s %5s %9s %9s %10s %11s %11s\n", "PHASE",
+	    "CALLS", "WALL(s)", "CPU(s)", "RSS(KB)", "COMMITS/s", "EDGES/s");
+	int p = 0;
+	while (p < SP_NPHASES) {
+		stat_rec_t *sr = &st[p];
+		if (sr->sr_calls > 0) {
+			fprintf(stderr, "%-10s %5llu %9.3f %9.3f %10llu "
+			    "%11.0f %11.0f\n", stats_phase_names[p],
+			    (unsigned long long)sr->sr_calls,
+			    (double)sr->sr_wall / 1e9,
+			    (double)sr->sr_cpu / 1e9,
+			    (unsigned long long)sr->sr_rss,
+			    stats_rate(sr->sr_commits, sr->sr_wall),
+			    stats_rate(sr->sr_edges, sr->sr_wall));
+		}
+		p++;
+	}
+	fprintf(stderr, "\n%-10s", "ALLOC(B)");
+	int c = 0;
+	while (c < AC_NCACHES) {
+		fprintf(stderr, " %14s", stats_cache_names[c]);
+		c++;
+	}
+	fprintf(stderr, "\n");
+	p = 0;
+	while (p < SP_NPHASES) {
+		if (st[p].sr_calls > 0) {
+			fprintf(stderr, "%-10s", stats_phase_names[p]);
+			c = 0;
+			while (c < AC_NCACHES) {
+				fprintf(stderr, " %14llu",
+				    (unsigned long long)st[p].sr_alloc[c]);
+				c++;
+			}
+			fprintf(stderr, "\n");
+		}
+		p++;
+	}
+	fprintf(stderr, "%-10s", "total");
+	c = 0;
+	while (c < AC_NCACHES) {
+		fprintf(stderr, " %14llu", (unsigned long long)st_alloc[c]);
+		c++;
+	}
+	fprintf(stderr, "\n");
+}
+
+void
+stats_json_allocs(FILE *f, uint64_t *alloc)
+{
+	fprintf(f, "{");
+	int c = 0;
+	while (c < AC_NCACHES) {
+		fprintf(f, "%s\"%s\": %llu", c == 0 ? "" : ", ",
+		    stats_cache_names[c], (unsigned long long)alloc[c]);
+		c++;
+	}
+	fprintf(f, "}");
+}
+
+/*
+ * Writes the statistics to `path` (or to stdout, if it's "-") as JSON.
+ */
+void
+stats_write_json(char *path)
+{
+	FILE *f = stdout;
+	if (strcmp(path, "-")) {
+		f = fopen(path, "w");
+		if (f == NULL) {
+			perror("stats_write_json:fopen");
+			exit(-1);
+		}
+	}
+	fprintf(f, "{\n  \"peak_rss_kb\": %llu,\n  \"alloc_bytes\": ",
+	    (unsigned long long)stats_rss());
+	stats_json_allocs(f, st_alloc);
+	fprintf(f, ",\n  \"phases\": [");
+	int first = 1;
+	int p = 0;
+	while (p < SP_NPHASES) {
+		stat_rec_t *sr = &st[p];
+		if (sr->sr_calls == 0) {
+			p++;
+			continue;
+		}
+		fprintf(f, "%s\n    {\"name\": \"%s\", \"calls\": %llu, "
+		    "\"wall_sec\": %.6f, \"cpu_sec\": %.6f, "
+		    "\"peak_rss_kb\": %llu, \"commits\": %llu, "
+		    "\"commits_per_sec\": %.1f, \"edges\": %llu, "
+		    "\"edges_per_sec\": %.1f, \"alloc_bytes\": ",
+		    first ? "" : ",", stats_phase_names[p],
+		    (unsigned long long)sr->sr_calls,
+		    (double)sr->sr_wall / 1e9, (double)sr->sr_cpu / 1e9,
+		    (unsigned long long)sr->sr_rss,
+		    (unsigned long long)sr->sr_commits,
+		    stats_rate(sr->sr_commits, sr->sr_wall),
+		    (unsigned long long)sr->sr_edges,
+		    stats_rate(sr->sr_edges, sr->sr_wall));
+		stats_json_allocs(f, sr->sr_alloc);
+		fprintf(f, "}");
+		first = 0;
+		p++;
+	}
+	fprintf(f, "\n  ]\n}\n");
+	if (f != stdout) {
+		if (fclose(f) != 0) {
+			perror("stats_write_json:fclose");
+			exit(-1);
+		}
+	}
+}
+
+/*
+ * Prints the statistics, or writes them to `path` as JSON if it's non-NULL.
+ */
+void
+stats_report(char *path)
+{
+	if (path == NULL) {
+		stats_print();
+	} else {
+		stats_write_json(path);
+	}
+}
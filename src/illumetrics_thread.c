@@ -0,0 +1,69 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Worker Threads
+ * ==============
+ *
+ * The analyses split their work across a fixed set of threads, each of which
+ * gets its own argument struct. These helpers spawn and reap those threads,
+ * so that the analyses only have to say what each thread does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "illumetrics_impl.h"
+
+/*
+ * Returns the number of threads to use: `-j` if it was given, otherwise one
+ * per online CPU.
+ */
+int
+ilm_nthreads()
+{
+	if (constraints.cn_jobs > 0) {
+		return (constraints.cn_jobs);
+	}
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	return (ncpu < 1 ? 1 : (int)ncpu);
+}
+
+/*
+ * Runs `fn` on `n` threads, and waits for all of them. Thread `i` is passed
+ * `args + i * argsz`. A single thread just runs in the caller.
+ */
+void
+ilm_run_threads(void *(*fn)(void *), void *args, size_t argsz, int n)
+{
+	if (n == 1) {
+		(void) fn(args);
+		return;
+	}
+	pthread_t *thr = ilm_mk_buf(sizeof (pthread_t) * n);
+	int i = 0;
+	while (i < n) {
+		int pc = pthread_create(&thr[i], NULL, fn,
+		    (char *)args + i * argsz);
+		if (pc != 0) {
+			fprintf(stderr, "ilm_run_threads:pthread_create: %s\n",
+			    strerror(pc));
+			exit(-1);
+		}
+		i++;
+	}
+	i = 0;
+	while (i < n) {
+		(void) pthread_join(thr[i], NULL);
+		i++;
+	}
+	ilm_rm_buf(thr, sizeof (pthread_t) * n);
+}
@@ -0,0 +1,262 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Path Trie
+ * =========
+ *
+ * The graphs built in build_graphs_foldr() only know about files. To answer
+ * questions about directories (`-f <directory>`, and the subdirectory
+ * histograms of `-h`) we keep a trie of path components. Each node is one
+ * interned component, and points to its parent, so `usr/src/uts/common/fs`
+ * is five nodes hanging off of the root. Every interned file path is split
+ * into components exactly once, the first time it is seen. From then on, the
+ * file's leaf node is found through an array indexed by the path's ID, and
+ * everything else is done by chasing parent indices. No path string is ever
+ * split or hashed again.
+ *
+ * Since directories are shared by many files, a commit that touches 100 files
+ * in `usr/src/uts/common/fs/zfs` must count once towards `zfs`, `fs`,
+ * `common`, and so on. Each node has a stamp, which is set to the commit that
+ * last reached it. When we walk up from a file, we stop at the first ancestor
+ * that already carries the current commit's stamp, because all of its
+ * ancestors do too. So each directory is visited at most once per commit.
+ *
+ * Nodes live in one array, and node 0 is the root (the top of every
+ * repository). A node is always created after its parent, which means that
+ * walking the array backwards visits children before their parents. That is
+ * how counts are rolled up the trie.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include <limits.h>
+#include "illumetrics_impl.h"
+
+ilm_vec_t trie_nodes; /* path_node_t */
+ilm_vec_t trie_leaves; /* uint32_t, indexed by the path's ilm_id_t */
+uint32_t trie_stamp_gen;
+
+void
+trie_init()
+{
+	ilm_vec_init(&trie_nodes, sizeof (path_node_t));
+	ilm_vec_init(&trie_leaves, sizeof (uint32_t));
+	path_node_t *root = ilm_vec_append(&trie_nodes, 1);
+	bzero(root, sizeof (path_node_t));
+}
+
+path_node_t *
+trie_node(uint32_t n)
+{
+	return (ILM_VEC_GET(&trie_nodes, path_node_t, n));
+}
+
+uint32_t
+trie_nnodes()
+{
+	return (trie_nodes.v_len);
+}
+
+/*
+ * Returns the child of `parent` named `name`, creating it if needed.
+ */
+uint32_t
+trie_child(uint32_t parent, ilm_id_t name)
+{
+	uint32_t c = trie_node(parent)->pn_child;
+	while (c != 0) {
+		path_node_t *cn = trie_node(c);
+		if (cn->pn_name == name) {
+			return (c);
+		}
+		c = cn->pn_sibling;
+	}
+	c = trie_nodes.v_len;
+	path_node_t *cn = ilm_vec_append(&trie_nodes, 1);
+	path_node_t *pn = trie_node(parent);
+	bzero(cn, sizeof (path_node_t));
+	cn->pn_name = name;
+	cn->pn_parent = parent;
+	cn->pn_depth = pn->pn_depth + 1;
+	cn->pn_sibling = pn->pn_child;
+	pn->pn_child = c;
+	return (c);
+}
+
+/*
+ * Returns the node for `path`, creating all of the missing nodes along the
+ * way. Leading, trailing, and repeated slashes are ignored.
+ */
+uint32_t
+trie_insert(const char *path)
+{
+	uint32_t n = 0;
+	const char *p = path;
+	while (*p != '\0') {
+		while (*p == '/') {
+			p++;
+		}
+		const char *e = p;
+		while (*e != '\0' && *e != '/') {
+			e++;
+		}
+		if (e > p) {
+			n = trie_child(n, ilm_intern(p, e - p));
+		}
+		p = e;
+	}
+	return (n);
+}
+
+/*
+ * Returns the leaf node of the file whose path was interned as `fid`.
+ */
+uint32_t
+trie_file(ilm_id_t fid)
+{
+	if (fid >= trie_leaves.v_len) {
+		uint64_t old = trie_leaves.v_len;
+		uint32_t *l = ilm_vec_append(&trie_leaves, fid + 1 - old);
+		bzero(l, sizeof (uint32_t) * (fid + 1 - old));
+	}
+	uint32_t *leaf = ILM_VEC_GET(&trie_leaves, uint32_t, fid);
+	if (*leaf == 0) {
+		*leaf = trie_insert(ilm_id_str(fid));
+	}
+	return (*leaf);
+}
+
+/*
+ * Returns non-zero if `n` is `anc` or lies below it.
+ */
+int
+trie_is_under(uint32_t n, uint32_t anc)
+{
+	uint32_t depth = trie_node(anc)->pn_depth;
+	while (trie_node(n)->pn_depth > depth) {
+		n = trie_node(n)->pn_parent;
+	}
+	return (n == anc);
+}
+
+/*
+ * Returns a stamp that no node carries yet. Each commit needs a new one. In
+ * the unlikely event that we run out of stamps, we clear all of them and
+ * start over.
+ */
+uint32_t
+trie_new_stamp()
+{
+	trie_stamp_gen++;
+	if (trie_stamp_gen == 0) {
+		uint64_t n = 0;
+		while (n < trie_nodes.v_len) {
+			trie_node(n)->pn_stamp = 0;
+			n++;
+		}
+		trie_stamp_gen = 1;
+	}
+	return (trie_stamp_gen);
+}
+
+/*
+ * Calls `cb` on every directory above the leaf `n` (but not on the root) that
+ * hasn't been stamped with `stamp` yet, and stamps it. Stamps come from
+ * trie_new_stamp().
+ */
+void
+trie_stamp_dirs(uint32_t n, uint32_t stamp, void (*cb)(uint32_t, void *),
+    void *arg)
+{
+	n = trie_node(n)->pn_parent;
+	while (n != 0) {
+		path_node_t *pn = trie_node(n);
+		if (pn->pn_stamp == stamp) {
+			break;
+		}
+		pn->pn_stamp = stamp;
+		if (cb != NULL) {
+			cb(n, arg);
+		}
+		n = pn->pn_parent;
+	}
+}
+
+/*
+ * Writes the path of node `n` into `buf`, which must be PATH_MAX bytes.
+ */
+void
+trie_path(uint32_t n, char *buf)
+{
+	uint32_t stack[PATH_MAX / 2];
+	int depth = 0;
+	while (n != 0 && depth < PATH_MAX / 2) {
+		stack[depth] = n;
+		depth++;
+		n = trie_node(n)->pn_parent;
+	}
+	size_t off = 0;
+	buf[0] = '\0';
+	while (depth > 0) {
+		depth--;
+		const char *c = ilm_id_str(trie_node(stack[depth])->pn_name);
+		int w = snprintf(buf + off, PATH_MAX - off, "%s%s",
+		    off == 0 ? "" : "/", c);
+		if (w < 0 || off + w >= PATH_MAX) {
+			break;
+		}
+		off += w;
+	}
+}
+
+/*
+ * Adds each node's count to its parent's, bottom up, so that every directory
+ * ends up with the sum of everything below it. `counts` is indexed by node.
+ */
+void
+trie_rollup(uint64_t *counts)
+{
+	uint32_t n = trie_nodes.v_len;
+	while (n > 1) {
+		n--;
+		counts[trie_node(n)->pn_parent] += counts[n];
+	}
+}
+
+/*
+ * The stamps are saved along with the nodes, so the stamp generator has to
+ * be saved too. Otherwise a new stamp could match a saved one.
+ */
+void
+trie_snap_write(snap_writer_t *sw)
+{
+	snap_vec_write(sw, SK_TRIE_NODES, &trie_nodes);
+	snap_vec_write(sw, SK_TRIE_LEAVES, &trie_leaves);
+	snap_sect_begin(sw, SK_TRIE_STAMP, trie_stamp_gen);
+	snap_sect_end(sw);
+}
+
+int
+trie_snap_load(snap_t *s)
+{
+	uint64_t gen;
+	(void) snap_sect(s, SK_TRIE_STAMP, NULL, &gen);
+	if (gen > UINT32_MAX ||
+	    snap_vec_load(s, SK_TRIE_NODES, &trie_nodes) != 0 ||
+	    trie_nodes.v_len == 0 ||
+	    snap_vec_load(s, SK_TRIE_LEAVES, &trie_leaves) != 0) {
+		return (-1);
+	}
+	trie_stamp_gen = gen;
+	return (0);
+}
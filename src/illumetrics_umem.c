@@ -8,99 +8,402 @@
  * Copyright (c) 2015, Nick Zivkovic
  */
 
+/*
+ * Allocation
+ * ==========
+ *
+ * Memory comes in three flavors:
+ *
+ *	ilm_mk_buf()	general buffers, from umem_alloc() on illumos and from
+ *			malloc() elsewhere.
+ *	ilm_cache_t	caches of objects of one type, which are allocated and
+ *			freed one at a time (e.g. repo_t).
+ *	ilm_arena_t	bump arenas, for memory that is all freed at once (e.g.
+ *			the file lists of a batch of diffed commits).
+ *
+ * On illumos an ilm_cache_t is a libumem object cache. Everywhere else it's a
+ * small slab allocator: objects are carved out of SLAB_SZ slabs, and freed
+ * objects go on a free list, all under the cache's lock. The caches are only
+ * used from one thread at a time (repo_t's are made while the lists of
+ * repositories are read), so there are no per-thread magazines. Slabs are
+ * never given back, since the caches live as long as the process.
+ *
+ * Objects in a cache are always handed out zeroed. They are zeroed on free,
+ * so that allocations don't have to.
+ *
+ * An arena hands out memory from big blocks by bumping an offset. Resetting
+ * an arena frees everything in it at once, and keeps the blocks around for
+ * the next round. An arena belongs to a single thread, so parallel workers
+ * each use their own.
+ *
+ * There are no typed caches for commits, interned strings, edges or traversal
+ * scratch space, and so no per-thread magazines either, because none of
+ * those are allocated one at a time. Commits are appended to the commit store,
+ * strings to the string arena, and edges to the edge logs, all of which are
+ * big arrays that grow by doubling or by whole pages (see ilm_vec_append(),
+ * illumetrics_intern.c and illumetrics_cset.c), and their files come from the
+ * diff workers' arenas. Scratch space is a handful of arrays per query or per
+ * worker, sized by the graph. So a commit costs no allocator call at all,
+ * amortized, and the pages and arrays are too big for a slab anyway. The lock
+ * that the diff workers did contend on was the string table's, and lookups
+ * don't take it anymore.
+ */
 
 #ifdef UMEM
 #include <umem.h>
 #endif
+#include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
+#include <string.h>
 #include "illumetrics_impl.h"
 
 #define UNUSED(x) (void)(x)
-#define CTOR_HEAD       UNUSED(ignored); UNUSED(flags)
 
-umem_cache_t *cache_repo;
+/* everything we hand out is aligned to this */
+#define	ILM_ALIGN		8
+#define	ILM_ROUNDUP(x)	(((x) + ILM_ALIGN - 1) & ~(size_t)(ILM_ALIGN - 1))
+
+struct ilm_cache {
+	char		*ic_name;
+	size_t		ic_size;
+	alloc_cache_t	ic_stat; /* what `--stats` counts it as */
+#ifdef UMEM
+	umem_cache_t	*ic_umem;
+#else
+	pthread_mutex_t	ic_lock; /* protects everything below */
+	void		*ic_free; /* linked through their first word */
+	char		*ic_slab; /* the part of the newest slab not carved */
+	size_t		ic_slab_left;
+#endif
+};
+
+ilm_cache_t *cache_repo;
 
 #ifdef UMEM
 //constructors...
 
 int
-repo_ctor(void *buf, void *ignored, int flags)
+ilm_cache_ctor(void *buf, void *priv, int flags)
 {
-	CTOR_HEAD;
-	repo_t *r = buf;
-	bzero(r, sizeof (repo_t));
+	UNUSED(flags);
+	ilm_cache_t *c = priv;
+	bzero(buf, c->ic_size);
 	return (0);
 }
+#else
+
+#define	SLAB_SZ		(64 * 1024)
 #endif
 
-int
-illumetrics_umem_init()
+/*
+ * Creates a cache of `size` byte objects, which can't be bigger than a slab.
+ * Caches are created during initialization, before there are any other
+ * threads, and are never destroyed.
+ */
+ilm_cache_t *
+ilm_cache_create(char *name, size_t size, alloc_cache_t stat)
 {
+	ilm_cache_t *c = ilm_mk_zbuf(sizeof (ilm_cache_t));
+	c->ic_name = name;
+	c->ic_size = ILM_ROUNDUP(size);
+	c->ic_stat = stat;
 #ifdef UMEM
-	cache_repo = umem_cache_create("repo",
-		sizeof (repo_t),
-		0,
-		repo_ctor,
-		NULL,
-		NULL,
-		NULL,
-		NULL,
-		0);
-
+	c->ic_umem = umem_cache_create(name, c->ic_size, 0, ilm_cache_ctor,
+	    NULL, NULL, c, NULL, 0);
+#else
+	if (c->ic_size == 0 || c->ic_size > SLAB_SZ) {
+		fprintf(stderr, "ilm_cache_create: %s: bad object size %zu\n",
+		    name, size);
+		exit(-1);
+	}
+	(void) pthread_mutex_init(&c->ic_lock, NULL);
 #endif
-	return (0);
-
+	return (c);
 }
 
-repo_t *
-ilm_mk_repo()
+void *
+ilm_cache_alloc(ilm_cache_t *c)
 {
+	stats_alloc(c->ic_stat, c->ic_size);
 #ifdef UMEM
-	return (umem_cache_alloc(cache_repo, UMEM_NOFAIL));
+	return (umem_cache_alloc(c->ic_umem, UMEM_NOFAIL));
 #else
-	return (calloc(1, sizeof (repo_t)));
+	(void) pthread_mutex_lock(&c->ic_lock);
+	void **obj = c->ic_free;
+	if (obj != NULL) {
+		c->ic_free = *obj;
+		*obj = NULL;
+	} else {
+		if (c->ic_slab_left < c->ic_size) {
+			c->ic_slab = calloc(1, SLAB_SZ);
+			if (c->ic_slab == NULL) {
+				fprintf(stderr, "%s: out of memory\n",
+				    c->ic_name);
+				exit(-1);
+			}
+			c->ic_slab_left = SLAB_SZ;
+		}
+		obj = (void **)c->ic_slab;
+		c->ic_slab += c->ic_size;
+		c->ic_slab_left -= c->ic_size;
+	}
+	(void) pthread_mutex_unlock(&c->ic_lock);
+	return (obj);
 #endif
 }
 
 void
-ilm_rm_repo(repo_t *r)
+ilm_cache_free(ilm_cache_t *c, void *obj)
 {
+	bzero(obj, c->ic_size);
 #ifdef UMEM
-	bzero(r, sizeof (repo_t));
-	umem_cache_free(cache_repo, r);
+	umem_cache_free(c->ic_umem, obj);
 #else
-	bzero(r, sizeof (repo_t));
-	free(r);
+	(void) pthread_mutex_lock(&c->ic_lock);
+	*(void **)obj = c->ic_free;
+	c->ic_free = obj;
+	(void) pthread_mutex_unlock(&c->ic_lock);
 #endif
 }
 
+int
+illumetrics_umem_init()
+{
+	cache_repo = ilm_cache_create("repo", sizeof (repo_t), AC_REPO);
+	return (0);
+}
+
+repo_t *
+ilm_mk_repo()
+{
+	return (ilm_cache_alloc(cache_repo));
+}
+
+void
+ilm_rm_repo(repo_t *r)
+{
+	ilm_cache_free(cache_repo, r);
+}
+
+/*
+ * Allocates a buffer that `--stats` counts against `stat`, which says what
+ * the buffer is for. Released with ilm_rm_buf().
+ */
 void *
-ilm_mk_buf(size_t sz)
+ilm_mk_buf_as(size_t sz, alloc_cache_t stat)
 {
+	stats_alloc(stat, sz);
 #ifdef UMEM
 	return (umem_alloc(sz, UMEM_NOFAIL));
 #else
-	return (malloc(sz));
+	void *p = malloc(sz);
+	if (p == NULL) {
+		perror("ilm_mk_buf:malloc");
+		exit(-1);
+	}
+	return (p);
 #endif
 }
 
 void *
-ilm_mk_zbuf(size_t sz)
+ilm_mk_buf(size_t sz)
 {
+	return (ilm_mk_buf_as(sz, AC_BUF));
+}
+
+void *
+ilm_mk_zbuf_as(size_t sz, alloc_cache_t stat)
+{
+	stats_alloc(stat, sz);
 #ifdef UMEM
 	return (umem_zalloc(sz, UMEM_NOFAIL));
 #else
-	return (calloc(1, sz));
+	void *p = calloc(1, sz);
+	if (p == NULL) {
+		perror("ilm_mk_zbuf:calloc");
+		exit(-1);
+	}
+	return (p);
 #endif
 }
 
+void *
+ilm_mk_zbuf(size_t sz)
+{
+	return (ilm_mk_zbuf_as(sz, AC_BUF));
+}
+
 void
 ilm_rm_buf(void *s, size_t sz)
 {
 #ifdef UMEM
 	umem_free(s, sz);
 #else
+	UNUSED(sz);
 	free(s);
 #endif
 }
+
+/*
+ * Returns a copy of `s`, which must be released with ilm_rm_str().
+ */
+char *
+ilm_mk_str(const char *s)
+{
+	size_t sz = strlen(s) + 1;
+	char *c = ilm_mk_buf(sz);
+	bcopy(s, c, sz);
+	return (c);
+}
+
+void
+ilm_rm_str(char *s)
+{
+	ilm_rm_buf(s, strlen(s) + 1);
+}
+
+struct ilm_arena_blk {
+	struct ilm_arena_blk	*ab_next;
+	size_t			ab_size; /* bytes after the header */
+};
+
+/*
+ * Sets up an (empty) arena that allocates `blksz` bytes at a time.
+ */
+void
+ilm_arena_init(ilm_arena_t *a, size_t blksz)
+{
+	bzero(a, sizeof (ilm_arena_t));
+	a->ia_blksz = blksz;
+}
+
+/*
+ * Arenas are counted by the blocks they allocate, not by the objects they hand
+ * out, which keeps ilm_arena_alloc() free of shared state.
+ */
+ilm_arena_blk_t *
+arena_blk_create(size_t size)
+{
+	ilm_arena_blk_t *b = ilm_mk_buf_as(sizeof (ilm_arena_blk_t) + size,
+	    AC_ARENA);
+	b->ab_next = NULL;
+	b->ab_size = size;
+	return (b);
+}
+
+/*
+ * Returns `sz` bytes, which stay around until the arena is reset. Once the
+ * current block is used up we move on to the next one, which is left over
+ * from before the last reset, or is a new one. A request that is bigger than
+ * a block gets a block of its own.
+ */
+void *
+ilm_arena_alloc(ilm_arena_t *a, size_t sz)
+{
+	sz = ILM_ROUNDUP(sz);
+	ilm_arena_blk_t *cur = a->ia_cur;
+	if (cur == NULL || a->ia_off + sz > cur->ab_size) {
+		ilm_arena_blk_t *next = cur == NULL ? a->ia_head :
+		    cur->ab_next;
+		if (next == NULL || next->ab_size < sz) {
+			ilm_arena_blk_t *b = arena_blk_create(
+			    sz > a->ia_blksz ? sz : a->ia_blksz);
+			b->ab_next = next;
+			if (cur == NULL) {
+				a->ia_head = b;
+			} else {
+				cur->ab_next = b;
+			}
+			next = b;
+		}
+		a->ia_cur = next;
+		a->ia_off = 0;
+	}
+	void *p = (char *)(a->ia_cur + 1) + a->ia_off;
+	a->ia_off += sz;
+	return (p);
+}
+
+/*
+ * Frees everything that was allocated from the arena, in one go.
+ */
+void
+ilm_arena_reset(ilm_arena_t *a)
+{
+	a->ia_cur = NULL;
+	a->ia_off = 0;
+}
+
+void
+ilm_arena_fini(ilm_arena_t *a)
+{
+	ilm_arena_blk_t *b = a->ia_head;
+	while (b != NULL) {
+		ilm_arena_blk_t *next = b->ab_next;
+		ilm_rm_buf(b, sizeof (ilm_arena_blk_t) + b->ab_size);
+		b = next;
+	}
+	bzero(a, sizeof (ilm_arena_t));
+}
+
+void
+ilm_vec_init(ilm_vec_t *v, size_t esz)
+{
+	bzero(v, sizeof (ilm_vec_t));
+	v->v_esz = esz;
+}
+
+/*
+ * Makes room for `n` more elements at the end of the array, and returns a
+ * pointer to the first of them. The array grows by doubling.
+ */
+void *
+ilm_vec_append(ilm_vec_t *v, uint64_t n)
+{
+	if (v->v_len + n > v->v_cap) {
+		uint64_t cap = v->v_cap == 0 ? 64 : v->v_cap;
+		while (cap < v->v_len + n) {
+			cap *= 2;
+		}
+		void *buf = ilm_mk_buf_as(cap * v->v_esz, AC_VEC);
+		if (v->v_len > 0) {
+			bcopy(v->v_buf, buf, v->v_len * v->v_esz);
+		}
+		if (v->v_cap > 0 && !v->v_mapped) {
+			ilm_rm_buf(v->v_buf, v->v_cap * v->v_esz);
+		}
+		v->v_buf = buf;
+		v->v_cap = cap;
+		v->v_mapped = 0;
+	}
+	void *e = (char *)v->v_buf + v->v_len * v->v_esz;
+	v->v_len += n;
+	return (e);
+}
+
+/*
+ * Points the (empty) array at `n` elements that live in memory we don't own.
+ * The memory has to stay around for as long as the array does. It is never
+ * written to by appends, but elements can still be modified in place.
+ */
+void
+ilm_vec_map(ilm_vec_t *v, void *buf, uint64_t n)
+{
+	size_t esz = v->v_esz;
+	ilm_vec_fini(v);
+	v->v_esz = esz;
+	v->v_buf = buf;
+	v->v_len = n;
+	v->v_cap = n;
+	v->v_mapped = 1;
+}
+
+void
+ilm_vec_fini(ilm_vec_t *v)
+{
+	if (v->v_cap > 0 && !v->v_mapped) {
+		ilm_rm_buf(v->v_buf, v->v_cap * v->v_esz);
+	}
+	bzero(v, sizeof (ilm_vec_t));
+}
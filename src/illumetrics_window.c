@@ -0,0 +1,349 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Temporal Windows
+ * ================
+ *
+ * The author projection (illumetrics_proj.c) connects two authors if they
+ * ever modified a common file, no matter if it was the same week or fifteen
+ * years apart. For bus-factor questions we want "who recently worked on the
+ * same code", so with `-W <days>` the author graph is built from the temporal
+ * distance between modifications instead: two modifications of a file by
+ * different authors connect them if they are at most a window apart, with a
+ * weight that halves every half window.
+ *
+ * Comparing every pair of modifications of a file is quadratic in busy files.
+ * Instead, each file's modifications are visited in time order, keeping a
+ * window of the ones that are recent enough, and the distinct authors in it.
+ * A modification by `a` at time `t` first evicts the modifications that are
+ * too old, then adds 2^(-(t - t_b) / half window) to the edge (a, b) for
+ * every other author `b` in the window, where `t_b` is b's latest
+ * modification. Every modification enters and leaves the window once, so the
+ * window is maintained in time linear in the number of modifications, and
+ * the rest of the work is one step per edge increment.
+ *
+ * To get every file's modifications in time order without sorting each file,
+ * the commits are sorted by time once and then scattered into per-file runs
+ * (a counting sort on the file), which keeps the order.
+ *
+ * Files with more than `-H` distinct authors in the range are hubs, and are
+ * left out, just like in the projection.
+ *
+ * Weights are summed in a hash table keyed by author pair, and then the graph
+ * is frozen with the weights in fixed point (WIN_SCALE per full-strength
+ * co-modification).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <math.h>
+#include "illumetrics_impl.h"
+
+#define	WIN_HT_MIN_SZ	(1 << 16)
+
+typedef struct win_mod {
+	int64_t		wm_time;
+	ilm_id_t	wm_author;
+} win_mod_t;
+
+typedef struct win_pair {
+	uint64_t	wp_key; /* (a << 32) | b with a < b, 0 if empty */
+	double		wp_weight;
+} win_pair_t;
+
+typedef struct win_ht {
+	win_pair_t	*wh_buckets;
+	uint64_t	wh_sz; /* power of 2 */
+	uint64_t	wh_n;
+} win_ht_t;
+
+/*
+ * The distinct authors in the window. An author's count is the number of its
+ * modifications in the window, and `wa_pos` is its index in `wa_list`.
+ */
+typedef struct win_authors {
+	uint32_t	*wa_count; /* indexed by author */
+	uint32_t	*wa_pos; /* indexed by author */
+	int64_t		*wa_last; /* indexed by author */
+	ilm_id_t	*wa_list;
+	uint32_t	wa_n;
+} win_authors_t;
+
+uint64_t
+win_hash(uint64_t key)
+{
+	/* the finalizer of MurmurHash3 */
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return (key);
+}
+
+win_pair_t *
+win_ht_probe(win_pair_t *b, uint64_t sz, uint64_t key)
+{
+	uint64_t mask = sz - 1;
+	uint64_t i = win_hash(key) & mask;
+	while (b[i].wp_key != 0 && b[i].wp_key != key) {
+		i = (i + 1) & mask;
+	}
+	return (&b[i]);
+}
+
+void
+win_ht_add(win_ht_t *ht, ilm_id_t a, ilm_id_t b, double w)
+{
+	uint64_t key = a < b ? ((uint64_t)a << 32) | b :
+	    ((uint64_t)b << 32) | a;
+	win_pair_t *p = win_ht_probe(ht->wh_buckets, ht->wh_sz, key);
+	if (p->wp_key == 0) {
+		p->wp_key = key;
+		ht->wh_n++;
+	}
+	p->wp_weight += w;
+	/* keep the load factor under 3/4 */
+	if (ht->wh_n * 4 > ht->wh_sz * 3) {
+		uint64_t osz = ht->wh_sz;
+		win_pair_t *ob = ht->wh_buckets;
+		ht->wh_sz = osz * 2;
+		ht->wh_buckets = ilm_mk_zbuf_as(sizeof (win_pair_t) * ht->wh_sz,
+		    AC_SCRATCH);
+		uint64_t i = 0;
+		while (i < osz) {
+			if (ob[i].wp_key != 0) {
+				*win_ht_probe(ht->wh_buckets, ht->wh_sz,
+				    ob[i].wp_key) = ob[i];
+			}
+			i++;
+		}
+		ilm_rm_buf(ob, sizeof (win_pair_t) * osz);
+	}
+}
+
+int
+win_commit_cmp(const void *a, const void *b)
+{
+	const repo_commit_t *ca = cstore_get(*(const uint32_t *)a);
+	const repo_commit_t *cb = cstore_get(*(const uint32_t *)b);
+	if (ca->rc_time != cb->rc_time) {
+		return (ca->rc_time < cb->rc_time ? -1 : 1);
+	}
+	return (*(const uint32_t *)a < *(const uint32_t *)b ? -1 : 1);
+}
+
+int
+win_in_range(repo_commit_t *c)
+{
+	return (c->rc_time >= constraints.cn_start_date &&
+	    c->rc_time <= constraints.cn_end_date);
+}
+
+void
+win_leave(win_authors_t *wa, ilm_id_t a)
+{
+	if (--wa->wa_count[a] > 0) {
+		return;
+	}
+	/* swap the last author into a's place */
+	ilm_id_t last = wa->wa_list[--wa->wa_n];
+	wa->wa_list[wa->wa_pos[a]] = last;
+	wa->wa_pos[last] = wa->wa_pos[a];
+}
+
+/*
+ * Counts the distinct authors of one file's modifications, using the window's
+ * counters as scratch space.
+ */
+uint32_t
+win_nauthors(win_authors_t *wa, win_mod_t *m, uint64_t n)
+{
+	uint32_t na = 0;
+	uint64_t i = 0;
+	while (i < n) {
+		if (wa->wa_count[m[i].wm_author]++ == 0) {
+			na++;
+		}
+		i++;
+	}
+	i = 0;
+	while (i < n) {
+		wa->wa_count[m[i].wm_author] = 0;
+		i++;
+	}
+	return (na);
+}
+
+/*
+ * Runs the window over one file's modifications, in time order.
+ */
+void
+win_file(win_ht_t *ht, win_authors_t *wa, win_mod_t *m, uint64_t n,
+    int64_t window)
+{
+	double half = (double)window / 2;
+	uint64_t lo = 0;
+	uint64_t i = 0;
+	while (i < n) {
+		int64_t t = m[i].wm_time;
+		ilm_id_t a = m[i].wm_author;
+		while (t - m[lo].wm_time > window) {
+			win_leave(wa, m[lo].wm_author);
+			lo++;
+		}
+		uint32_t k = 0;
+		while (k < wa->wa_n) {
+			ilm_id_t b = wa->wa_list[k];
+			if (b != a) {
+				win_ht_add(ht, a, b,
+				    exp2(-(double)(t - wa->wa_last[b]) / half));
+			}
+			k++;
+		}
+		if (wa->wa_count[a]++ == 0) {
+			wa->wa_pos[a] = wa->wa_n;
+			wa->wa_list[wa->wa_n++] = a;
+		}
+		wa->wa_last[a] = t;
+		i++;
+	}
+	while (lo < n) {
+		win_leave(wa, m[lo].wm_author);
+		lo++;
+	}
+}
+
+/*
+ * Builds the undirected author graph of modifications to common files that
+ * are at most `window` seconds apart, using the commits in the `-D` range.
+ * Files with more than `hubcap` authors are left out.
+ */
+csr_t *
+win_authors(int64_t window, uint32_t hubcap)
+{
+	uint32_t nids = ilm_intern_count() + 1; /* ID 0 included */
+	uint32_t nc = cstore_count();
+
+	/* the commits in time order */
+	uint32_t *order = ilm_mk_buf_as(sizeof (uint32_t) * (nc + 1),
+	    AC_SCRATCH);
+	uint32_t n = 0;
+	uint32_t i = 0;
+	while (i < nc) {
+		if (win_in_range(cstore_get(i))) {
+			order[n++] = i;
+		}
+		i++;
+	}
+	if (n > 0) {
+		qsort(order, n, sizeof (uint32_t), win_commit_cmp);
+	}
+
+	/* scatter the modifications into per-file runs */
+	uint64_t *off = ilm_mk_zbuf_as(sizeof (uint64_t) * (nids + 1),
+	    AC_SCRATCH);
+	i = 0;
+	while (i < n) {
+		repo_commit_t *c = cstore_get(order[i]);
+		ilm_id_t *files = cstore_files(c);
+		uint32_t j = 0;
+		while (j < c->rc_nfiles) {
+			off[files[j] + 1]++;
+			j++;
+		}
+		i++;
+	}
+	uint32_t f = 0;
+	while (f < nids) {
+		off[f + 1] += off[f];
+		f++;
+	}
+	uint64_t nmods = off[nids];
+	win_mod_t *mods = ilm_mk_buf_as(sizeof (win_mod_t) * (nmods + 1),
+	    AC_SCRATCH);
+	uint64_t *fill = ilm_mk_buf_as(sizeof (uint64_t) * (nids + 1),
+	    AC_SCRATCH);
+	bcopy(off, fill, sizeof (uint64_t) * (nids + 1));
+	i = 0;
+	while (i < n) {
+		repo_commit_t *c = cstore_get(order[i]);
+		ilm_id_t *files = cstore_files(c);
+		uint32_t j = 0;
+		while (j < c->rc_nfiles) {
+			win_mod_t *m = &mods[fill[files[j]]++];
+			m->wm_time = c->rc_time;
+			m->wm_author = c->rc_author;
+			j++;
+		}
+		i++;
+	}
+	ilm_rm_buf(fill, sizeof (uint64_t) * (nids + 1));
+	ilm_rm_buf(order, sizeof (uint32_t) * (nc + 1));
+
+	win_ht_t ht;
+	ht.wh_sz = WIN_HT_MIN_SZ;
+	ht.wh_n = 0;
+	ht.wh_buckets = ilm_mk_zbuf_as(sizeof (win_pair_t) * ht.wh_sz,
+	    AC_SCRATCH);
+	win_authors_t wa;
+	wa.wa_count = ilm_mk_zbuf_as(sizeof (uint32_t) * nids, AC_SCRATCH);
+	wa.wa_pos = ilm_mk_buf_as(sizeof (uint32_t) * nids, AC_SCRATCH);
+	wa.wa_last = ilm_mk_buf_as(sizeof (int64_t) * nids, AC_SCRATCH);
+	wa.wa_list = ilm_mk_buf_as(sizeof (ilm_id_t) * nids, AC_SCRATCH);
+	wa.wa_n = 0;
+	uint32_t nhubs = 0;
+	f = 0;
+	while (f < nids) {
+		uint64_t nm = off[f + 1] - off[f];
+		if (nm > hubcap && win_nauthors(&wa, &mods[off[f]], nm) >
+		    hubcap) {
+			nhubs++;
+		} else if (nm > 1) {
+			win_file(&ht, &wa, &mods[off[f]], nm, window);
+		}
+		f++;
+	}
+	ilm_rm_buf(wa.wa_count, sizeof (uint32_t) * nids);
+	ilm_rm_buf(wa.wa_pos, sizeof (uint32_t) * nids);
+	ilm_rm_buf(wa.wa_last, sizeof (int64_t) * nids);
+	ilm_rm_buf(wa.wa_list, sizeof (ilm_id_t) * nids);
+	ilm_rm_buf(mods, sizeof (win_mod_t) * (nmods + 1));
+	ilm_rm_buf(off, sizeof (uint64_t) * (nids + 1));
+
+	/* freeze the pairs, with the weights in fixed point */
+	ilm_edge_t *e = ilm_mk_buf_as(sizeof (ilm_edge_t) * (ht.wh_n + 1),
+	    AC_SCRATCH);
+	uint32_t *wt = ilm_mk_buf_as(sizeof (uint32_t) * (ht.wh_n + 1),
+	    AC_SCRATCH);
+	uint64_t ne = 0;
+	uint64_t b = 0;
+	while (b < ht.wh_sz) {
+		win_pair_t *p = &ht.wh_buckets[b++];
+		if (p->wp_key == 0) {
+			continue;
+		}
+		double w = p->wp_weight * WIN_SCALE + 0.5;
+		e[ne].ed_src = NODE_KEY(NK_AUTHOR, p->wp_key >> 32);
+		e[ne].ed_dst = NODE_KEY(NK_AUTHOR, p->wp_key & UINT32_MAX);
+		wt[ne] = w >= UINT32_MAX ? UINT32_MAX : w < 1 ? 1 : (uint32_t)w;
+		ne++;
+	}
+	csr_t *g = csr_build(e, ne, wt, CSR_UNDIRECTED);
+	ilm_rm_buf(e, sizeof (ilm_edge_t) * (ht.wh_n + 1));
+	ilm_rm_buf(wt, sizeof (uint32_t) * (ht.wh_n + 1));
+	ilm_rm_buf(ht.wh_buckets, sizeof (win_pair_t) * ht.wh_sz);
+	fprintf(stderr, "Windowed %llu modifications into %llu author pairs, "
+	    "skipped %u hub files.\n", (unsigned long long)nmods,
+	    (unsigned long long)ne, nhubs);
+	return (g);
+}
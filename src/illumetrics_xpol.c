@@ -0,0 +1,534 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * Cross-Polination
+ * ================
+ *
+ * The illumos forks (Joyent, Nexenta, Delphix, OmniOS, ...) keep merging from
+ * illumos-gate and from each other. For every commit we want to know which
+ * repository it originated in, and the path along which it spread to the
+ * others. Answering "which repositories have commit X" with a revwalk per
+ * commit would take forever. Instead, everything is computed in a single pass
+ * over the commit set (see illumetrics_cset.c), which already is the commit
+ * graph of all of the repositories, with each commit in it once, and with
+ * the set of repositories that have it.
+ *
+ * A repository's mainline is the first-parent chain from its tip. A commit
+ * on the mainline landed in that repository. Any other commit in the
+ * repository was brought in by the first merge on the mainline that can reach
+ * it. We say that the commit arrived in the repository at that mainline
+ * commit (or at itself, if it's on the mainline).
+ *
+ * Arrivals are ordered by generation number. A commit's generation is one
+ * more than the largest generation of its parents, so a commit always has a
+ * larger generation than anything it can reach. That makes generations a
+ * clock that all of the repositories agree on, unlike commit times, which
+ * are made up by whoever made the commit. The generations are computed by
+ * visiting the commits parents-first (Kahn's algorithm).
+ *
+ * Then the arrivals are computed children-first, so that every commit passes
+ * its arrivals on to its parents, and each parent keeps the earliest arrival
+ * per repository. A commit only has an arrival for the repositories that
+ * have it, so the arrivals are packed, per commit, in the order of the bits
+ * of its set of repositories.
+ *
+ * A commit's propagation path is the list of repositories that it arrived in,
+ * in order of arrival. The first is its origin. The history that a fork got
+ * when it was forked is on both mainlines, so it arrives in both at once, and
+ * ties go to the repository that is listed first (i.e. illumos-gate). Every
+ * step along the path is counted in a matrix, from the repository it had
+ * arrived in most recently to the one it arrived in next. Repositories that
+ * it arrived in at the same generation got it at once, from the same place,
+ * and not from each other: the ones tied with the origin got it from the
+ * origin, and the others from the first repository of the latest earlier
+ * generation. Commits that aren't on any mainline, and that no mainline merge
+ * reaches, haven't arrived anywhere, and have the repository they were first
+ * seen in as their origin.
+ *
+ * `repository -X <sha1>` prints the path of a single commit, with the commit
+ * at which it arrived in each repository.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "illumetrics_impl.h"
+
+struct xpol {
+	uint32_t	xp_n; /* commits are 1..xp_n */
+	uint32_t	xp_setw; /* words per set of repositories */
+	uint64_t	*xp_poff; /* xp_n + 2, into xp_par */
+	uint32_t	*xp_par; /* parent IDs, 0 if not in the set */
+	uint32_t	*xp_gen;
+	uint32_t	*xp_order; /* parents first */
+	uint32_t	xp_norder;
+	uint64_t	*xp_aoff; /* xp_n + 2, into xp_arr */
+	uint32_t	*xp_arr; /* arrival commit, 0 if none */
+	uint64_t	*xp_origins; /* nrepos, commits that originated in it */
+	uint64_t	*xp_arrived; /* nrepos, commits that came from others */
+	uint64_t	*xp_flow; /* nrepos * nrepos, from * nrepos + to */
+};
+
+uint64_t *
+xpol_set(uint32_t id)
+{
+	return (cset_repo_set(cset_get(id)->ce_repos));
+}
+
+/*
+ * Returns the arrival of commit `id` in repository `r`, which it must be in.
+ */
+uint32_t *
+xpol_arr(xpol_t *xp, uint32_t id, uint32_t r)
+{
+	uint64_t *set = xpol_set(id);
+	uint64_t rank = 0;
+	uint32_t w = 0;
+	while (w < (r >> 6)) {
+		rank += __builtin_popcountll(set[w]);
+		w++;
+	}
+	rank += __builtin_popcountll(set[w] & ((1ULL << (r & 63)) - 1));
+	return (&xp->xp_arr[xp->xp_aoff[id] + rank]);
+}
+
+/*
+ * Resolves the parents of every commit to IDs, and makes room for the
+ * arrivals.
+ */
+void
+xpol_load(xpol_t *xp)
+{
+	uint32_t n = xp->xp_n;
+	uint64_t npar = 0;
+	uint64_t narr = 0;
+	uint32_t id = 1;
+	while (id <= n) {
+		uint32_t np;
+		(void) cset_parents(id, &np);
+		xp->xp_poff[id] = npar;
+		xp->xp_aoff[id] = narr;
+		npar += np;
+		uint64_t *set = xpol_set(id);
+		uint32_t w = 0;
+		while (w < xp->xp_setw) {
+			narr += __builtin_popcountll(set[w]);
+			w++;
+		}
+		id++;
+	}
+	xp->xp_poff[n + 1] = npar;
+	xp->xp_aoff[n + 1] = narr;
+	xp->xp_par = ilm_mk_buf_as(sizeof (uint32_t) * (npar + 1), AC_SCRATCH);
+	xp->xp_arr = ilm_mk_zbuf_as(sizeof (uint32_t) * (narr + 1), AC_SCRATCH);
+	id = 1;
+	while (id <= n) {
+		uint32_t np;
+		sha1_t *p = cset_parents(id, &np);
+		uint32_t i = 0;
+		while (i < np) {
+			/* parents outside of the walked range aren't there */
+			xp->xp_par[xp->xp_poff[id] + i] = cset_lookup(&p[i]);
+			i++;
+		}
+		id++;
+	}
+}
+
+/*
+ * Computes the generation numbers, and a parents-first order of the commits.
+ */
+void
+xpol_generations(xpol_t *xp)
+{
+	uint32_t n = xp->xp_n;
+	uint32_t *npending = ilm_mk_zbuf_as(sizeof (uint32_t) * (n + 1),
+	    AC_SCRATCH);
+	uint64_t *coff = ilm_mk_zbuf_as(sizeof (uint64_t) * (n + 2),
+	    AC_SCRATCH);
+	uint64_t nch = 0;
+	uint32_t id = 1;
+	while (id <= n) {
+		uint64_t j = xp->xp_poff[id];
+		while (j < xp->xp_poff[id + 1]) {
+			if (xp->xp_par[j] != 0) {
+				npending[id]++;
+				coff[xp->xp_par[j]]++;
+				nch++;
+			}
+			j++;
+		}
+		id++;
+	}
+	/* turn the counts of children into offsets */
+	uint64_t sum = 0;
+	id = 1;
+	while (id <= n + 1) {
+		uint64_t c = coff[id];
+		coff[id] = sum;
+		sum += c;
+		id++;
+	}
+	uint32_t *child = ilm_mk_buf_as(sizeof (uint32_t) * (nch + 1),
+	    AC_SCRATCH);
+	uint64_t *cnext = ilm_mk_buf_as(sizeof (uint64_t) * (n + 2),
+	    AC_SCRATCH);
+	bcopy(coff, cnext, sizeof (uint64_t) * (n + 2));
+	id = 1;
+	while (id <= n) {
+		uint64_t j = xp->xp_poff[id];
+		while (j < xp->xp_poff[id + 1]) {
+			if (xp->xp_par[j] != 0) {
+				child[cnext[xp->xp_par[j]]++] = id;
+			}
+			j++;
+		}
+		id++;
+	}
+	/* xp_order doubles as the queue */
+	uint32_t head = 0;
+	uint32_t tail = 0;
+	id = 1;
+	while (id <= n) {
+		if (npending[id] == 0) {
+			xp->xp_gen[id] = 1;
+			xp->xp_order[tail++] = id;
+		}
+		id++;
+	}
+	while (head < tail) {
+		uint32_t v = xp->xp_order[head++];
+		uint64_t j = coff[v];
+		while (j < coff[v + 1]) {
+			uint32_t c = child[j++];
+			if (xp->xp_gen[v] + 1 > xp->xp_gen[c]) {
+				xp->xp_gen[c] = xp->xp_gen[v] + 1;
+			}
+			if (--npending[c] == 0) {
+				xp->xp_order[tail++] = c;
+			}
+		}
+	}
+	/* a cycle takes a SHA-1 collision, but let's not hang on one */
+	if (tail < n) {
+		fprintf(stderr, "Left out %u commits that are in a cycle.\n",
+		    n - tail);
+	}
+	xp->xp_norder = tail;
+	ilm_rm_buf(cnext, sizeof (uint64_t) * (n + 2));
+	ilm_rm_buf(child, sizeof (uint32_t) * (nch + 1));
+	ilm_rm_buf(coff, sizeof (uint64_t) * (n + 2));
+	ilm_rm_buf(npending, sizeof (uint32_t) * (n + 1));
+}
+
+/*
+ * Every commit on repository `r`'s mainline arrives at itself.
+ */
+void
+xpol_mainline(xpol_t *xp, uint32_t r, sha1_t *tip)
+{
+	uint32_t id = cset_lookup(tip);
+	while (id != 0) {
+		uint64_t *set = xpol_set(id);
+		if (((set[r >> 6] >> (r & 63)) & 1) == 0) {
+			break;
+		}
+		uint32_t *a = xpol_arr(xp, id, r);
+		if (*a == id) {
+			break;
+		}
+		*a = id;
+		id = xp->xp_poff[id] < xp->xp_poff[id + 1] ?
+		    xp->xp_par[xp->xp_poff[id]] : 0;
+	}
+}
+
+/*
+ * Passes the arrivals down from children to parents. A parent keeps the
+ * earliest arrival in each repository.
+ */
+void
+xpol_propagate(xpol_t *xp)
+{
+	uint32_t k = xp->xp_norder;
+	while (k > 0) {
+		uint32_t c = xp->xp_order[--k];
+		uint64_t *cset = xpol_set(c);
+		uint64_t j = xp->xp_poff[c];
+		while (j < xp->xp_poff[c + 1]) {
+			uint32_t p = xp->xp_par[j++];
+			if (p == 0) {
+				continue;
+			}
+			uint64_t *pset = xpol_set(p);
+			uint32_t w = 0;
+			while (w < xp->xp_setw) {
+				uint64_t bits = cset[w] & pset[w];
+				while (bits != 0) {
+					uint32_t r = w * 64 +
+					    __builtin_ctzll(bits);
+					bits &= bits - 1;
+					uint32_t ac = *xpol_arr(xp, c, r);
+					uint32_t *ap = xpol_arr(xp, p, r);
+					if (ac != 0 && (*ap == 0 ||
+					    xp->xp_gen[ac] <
+					    xp->xp_gen[*ap])) {
+						*ap = ac;
+					}
+				}
+				w++;
+			}
+		}
+	}
+}
+
+typedef struct xpol_hop {
+	uint32_t	xh_gen; /* generation of the arrival */
+	uint32_t	xh_repo;
+	uint32_t	xh_arr; /* arrival commit */
+	uint32_t	xh_from; /* index of the hop it came from */
+} xpol_hop_t;
+
+/*
+ * Fills `path`, which has room for every repository, with the propagation path
+ * of commit `id`, and returns its length.
+ */
+uint32_t
+xpol_path(xpol_t *xp, uint32_t id, xpol_hop_t *path)
+{
+	uint64_t *set = xpol_set(id);
+	uint32_t len = 0;
+	uint32_t w = 0;
+	while (w < xp->xp_setw) {
+		uint64_t bits = set[w];
+		while (bits != 0) {
+			uint32_t r = w * 64 + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			uint32_t a = *xpol_arr(xp, id, r);
+			if (a == 0) {
+				continue;
+			}
+			/* insertion sort, ties go to the lower repo */
+			uint32_t i = len++;
+			while (i > 0 && path[i - 1].xh_gen > xp->xp_gen[a]) {
+				path[i] = path[i - 1];
+				i--;
+			}
+			path[i].xh_gen = xp->xp_gen[a];
+			path[i].xh_repo = r;
+			path[i].xh_arr = a;
+		}
+		w++;
+	}
+	/* from the first hop of the previous generation, or from the origin */
+	uint32_t from = 0;
+	uint32_t gstart = 0;
+	uint32_t i = 1;
+	while (i < len) {
+		if (path[i].xh_gen > path[i - 1].xh_gen) {
+			from = gstart;
+			gstart = i;
+		}
+		path[i].xh_from = from;
+		i++;
+	}
+	if (len > 0) {
+		path[0].xh_from = 0;
+	}
+	return (len);
+}
+
+/*
+ * Follows every commit's propagation path, and counts its steps.
+ */
+void
+xpol_paths(xpol_t *xp)
+{
+	xpol_hop_t *path = ilm_mk_buf_as(sizeof (xpol_hop_t) * (nrepos + 1),
+	    AC_SCRATCH);
+	uint32_t id = 1;
+	while (id <= xp->xp_n) {
+		uint32_t len = xpol_path(xp, id, path);
+		if (len == 0) {
+			xp->xp_origins[cset_get(id)->ce_repo]++;
+			id++;
+			continue;
+		}
+		xp->xp_origins[path[0].xh_repo]++;
+		uint32_t i = 1;
+		while (i < len) {
+			xp->xp_arrived[path[i].xh_repo]++;
+			xp->xp_flow[(uint64_t)path[path[i].xh_from].xh_repo *
+			    nrepos + path[i].xh_repo]++;
+			i++;
+		}
+		id++;
+	}
+	ilm_rm_buf(path, sizeof (xpol_hop_t) * (nrepos + 1));
+}
+
+/*
+ * Computes the origins and paths of all of the commits in the commit set.
+ * `tips` has the tip of each repository's mainline, indexed by repository
+ * ID, or NULL where a repository has none.
+ */
+xpol_t *
+xpol_create(sha1_t **tips)
+{
+	xpol_t *xp = ilm_mk_zbuf_as(sizeof (xpol_t), AC_SCRATCH);
+	uint32_t n = cset_count();
+	xp->xp_n = n;
+	xp->xp_setw = cset_set_words();
+	xp->xp_poff = ilm_mk_zbuf_as(sizeof (uint64_t) * (n + 2), AC_SCRATCH);
+	xp->xp_aoff = ilm_mk_zbuf_as(sizeof (uint64_t) * (n + 2), AC_SCRATCH);
+	xp->xp_gen = ilm_mk_zbuf_as(sizeof (uint32_t) * (n + 1), AC_SCRATCH);
+	xp->xp_order = ilm_mk_buf_as(sizeof (uint32_t) * (n + 1), AC_SCRATCH);
+	xp->xp_origins = ilm_mk_zbuf_as(sizeof (uint64_t) * (nrepos + 1),
+	    AC_SCRATCH);
+	xp->xp_arrived = ilm_mk_zbuf_as(sizeof (uint64_t) * (nrepos + 1),
+	    AC_SCRATCH);
+	xp->xp_flow = ilm_mk_zbuf_as(sizeof (uint64_t) *
+	    ((uint64_t)nrepos * nrepos + 1), AC_SCRATCH);
+	xpol_load(xp);
+	xpol_generations(xp);
+	uint32_t r = 0;
+	while (r < nrepos) {
+		if (tips[r] != NULL) {
+			xpol_mainline(xp, r, tips[r]);
+		}
+		r++;
+	}
+	xpol_propagate(xp);
+	xpol_paths(xp);
+	return (xp);
+}
+
+void
+xpol_destroy(xpol_t *xp)
+{
+	uint32_t n = xp->xp_n;
+	ilm_rm_buf(xp->xp_par, sizeof (uint32_t) *
+	    (xp->xp_poff[n + 1] + 1));
+	ilm_rm_buf(xp->xp_arr, sizeof (uint32_t) *
+	    (xp->xp_aoff[n + 1] + 1));
+	ilm_rm_buf(xp->xp_poff, sizeof (uint64_t) * (n + 2));
+	ilm_rm_buf(xp->xp_aoff, sizeof (uint64_t) * (n + 2));
+	ilm_rm_buf(xp->xp_gen, sizeof (uint32_t) * (n + 1));
+	ilm_rm_buf(xp->xp_order, sizeof (uint32_t) * (n + 1));
+	ilm_rm_buf(xp->xp_origins, sizeof (uint64_t) * (nrepos + 1));
+	ilm_rm_buf(xp->xp_arrived, sizeof (uint64_t) * (nrepos + 1));
+	ilm_rm_buf(xp->xp_flow, sizeof (uint64_t) *
+	    ((uint64_t)nrepos * nrepos + 1));
+	ilm_rm_buf(xp, sizeof (xpol_t));
+}
+
+/*
+ * Prints the number of commits that originated in each repository, and the
+ * number that arrived from others, followed by the flow matrix. Only the
+ * repositories that take part in the flow get a row and a column.
+ */
+void
+xpol_print(xpol_t *xp)
+{
+	uint32_t *idx = ilm_mk_buf_as(sizeof (uint32_t) * (nrepos + 1),
+	    AC_SCRATCH);
+	uint32_t m = 0;
+	printf("%10s %10s  %s\n", "ORIGIN", "ARRIVED", "REPOSITORY");
+	uint32_t r = 0;
+	while (r < nrepos) {
+		repo_t *rp = repo_table[r];
+		printf("%10llu %10llu  %s/%s\n",
+		    (unsigned long long)xp->xp_origins[r],
+		    (unsigned long long)xp->xp_arrived[r], rp->rp_owner,
+		    rp->rp_name);
+		uint64_t out = 0;
+		uint32_t s = 0;
+		while (s < nrepos) {
+			out += xp->xp_flow[(uint64_t)r * nrepos + s];
+			s++;
+		}
+		if (out > 0 || xp->xp_arrived[r] > 0) {
+			idx[m++] = r;
+		}
+		r++;
+	}
+	if (m == 0) {
+		ilm_rm_buf(idx, sizeof (uint32_t) * (nrepos + 1));
+		return;
+	}
+	printf("\nFLOW (from row to column)\n%4s", "");
+	uint32_t i = 0;
+	while (i < m) {
+		printf(" %8u", i + 1);
+		i++;
+	}
+	printf("\n");
+	i = 0;
+	while (i < m) {
+		printf("%4u", i + 1);
+		uint32_t j = 0;
+		while (j < m) {
+			uint64_t f = xp->xp_flow[(uint64_t)idx[i] * nrepos +
+			    idx[j]];
+			if (i == j) {
+				printf(" %8s", "-");
+			} else {
+				printf(" %8llu", (unsigned long long)f);
+			}
+			j++;
+		}
+		printf("  %s/%s\n", repo_table[idx[i]]->rp_owner,
+		    repo_table[idx[i]]->rp_name);
+		i++;
+	}
+	ilm_rm_buf(idx, sizeof (uint32_t) * (nrepos + 1));
+}
+
+/*
+ * Prints the origin of commit `id`, and the path along which it spread: the
+ * generation at which it arrived in each repository, the commit at which it
+ * arrived, and the repository it came from.
+ */
+void
+xpol_print_commit(xpol_t *xp, uint32_t id)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+	git_oid oid;
+	xpol_hop_t *path = ilm_mk_buf_as(sizeof (xpol_hop_t) * (nrepos + 1),
+	    AC_SCRATCH);
+	uint32_t len = xpol_path(xp, id, path);
+	if (len == 0) {
+		repo_t *rp = repo_table[cset_get(id)->ce_repo];
+		printf("Not on any mainline, first seen in %s/%s.\n",
+		    rp->rp_owner, rp->rp_name);
+		ilm_rm_buf(path, sizeof (xpol_hop_t) * (nrepos + 1));
+		return;
+	}
+	printf("%10s  %-40s  %s\n", "GENERATION", "ARRIVED AT", "REPOSITORY");
+	uint32_t i = 0;
+	while (i < len) {
+		repo_t *rp = repo_table[path[i].xh_repo];
+		repo_t *from = repo_table[path[path[i].xh_from].xh_repo];
+		sha1_to_oid(&oid, &cset_get(path[i].xh_arr)->ce_sha1);
+		git_oid_fmt(hex, &oid);
+		hex[GIT_OID_HEXSZ] = '\0';
+		if (i == 0) {
+			printf("%10u  %s  %s/%s (origin)\n", path[i].xh_gen,
+			    hex, rp->rp_owner, rp->rp_name);
+		} else {
+			printf("%10u  %s  %s/%s (from %s/%s)\n",
+			    path[i].xh_gen, hex, rp->rp_owner, rp->rp_name,
+			    from->rp_owner, from->rp_name);
+		}
+		i++;
+	}
+	ilm_rm_buf(path, sizeof (xpol_hop_t) * (nrepos + 1));
+}
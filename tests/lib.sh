@@ -0,0 +1,116 @@
+#
+# This Source Code Form is subject to the terms of the Mozilla Public License,
+# v. 2.0. If a copy of the MPL was not distributed with this file, You can
+# obtain one at http://mozilla.org/MPL/2.0/.
+#
+
+#
+# Copyright (c) 2015, Nick Zivkovic
+#
+
+#
+# Sourced by every test. A test runs illumetrics in a scratch $HOME, with its
+# own list-files, against bare repositories that it makes with git(1) under
+# $T/remote, and names with `file://` URLs. Nothing outside of $T is touched,
+# and $T is removed when the test exits.
+#
+# $ILLUMETRICS is the binary under test (see run.sh).
+#
+
+set -e
+
+ILLUMETRICS=${ILLUMETRICS:-illumetrics}
+T=$(mktemp -d "${TMPDIR:-/tmp}/illumetrics_test.XXXXXX")
+trap 'rm -rf "$T"' EXIT
+
+export HOME=$T/home
+unset ILLUMETRICS_STOR
+LISTS=$HOME/.illumetrics/lists
+STOR=$HOME/.illumetrics/stor
+mkdir -p $LISTS $T/remote $T/work
+for l in build_system distributed_storage documentation compiler kernel \
+    userland orchestration virtualization; do
+	: > $LISTS/$l
+done
+
+export GIT_COMMITTER_NAME=tester
+export GIT_COMMITTER_EMAIL=tester@example.com
+
+fail()
+{
+	echo "FAIL: $*" >&2
+	exit 1
+}
+
+# Runs illumetrics, with its output in $T/out.
+ilm()
+{
+	"$ILLUMETRICS" "$@" > $T/out 2>&1 || {
+		cat $T/out >&2
+		fail "illumetrics $*"
+	}
+}
+
+# Fails unless the output of the last ilm() matches the regular expression.
+expect()
+{
+	grep -E -q -- "$1" $T/out || {
+		cat $T/out >&2
+		fail "expected /$1/"
+	}
+}
+
+# mk_repo <owner>/<name> [<upstream owner>/<name>]
+#
+# Makes the bare repository $T/remote/<owner>/<name>.git, and a clone of it to
+# commit in. A fork starts out as a copy of its upstream.
+mk_repo()
+{
+	mkdir -p $(dirname $T/remote/$1) $(dirname $T/work/$1)
+	if [ -n "$2" ]; then
+		git clone -q --bare $T/remote/$2.git $T/remote/$1.git
+		git clone -q $T/remote/$1.git $T/work/$1
+	else
+		git init -q --bare $T/remote/$1.git
+		git --git-dir=$T/remote/$1.git symbolic-ref HEAD \
+		    refs/heads/master
+		git init -q $T/work/$1
+		git -C $T/work/$1 symbolic-ref HEAD refs/heads/master
+		git -C $T/work/$1 remote add origin $T/remote/$1.git
+	fi
+}
+
+# commit <owner>/<name> <author> <file> [<date>]
+#
+# Commits a change to <file> as <author>, and pushes it.
+commit()
+{
+	mkdir -p $(dirname $T/work/$1/$3)
+	echo "$2 $3 ${4:-now}" >> $T/work/$1/$3
+	git -C $T/work/$1 add -A
+	GIT_AUTHOR_NAME=$2 GIT_AUTHOR_EMAIL=$2@example.com \
+	    GIT_AUTHOR_DATE="${4:-$(date -R)}" \
+	    GIT_COMMITTER_DATE="${4:-$(date -R)}" \
+	    git -C $T/work/$1 commit -q -m "$3"
+	git -C $T/work/$1 push -q origin HEAD:master
+}
+
+# Prints the commit that master points to in the remote <owner>/<name>.
+tip()
+{
+	git --git-dir=$T/remote/$1.git rev-parse refs/heads/master
+}
+
+# list <type> <owner>/<name> [<upstream owner>/<name>]
+list()
+{
+	echo "file://$T/remote/$2.git${3:+ $3}" >> $LISTS/$1
+}
+
+# Runs git on the stored copy of <owner>/<name>.
+stor_git()
+{
+	r=$1
+	shift
+	git --git-dir=$STOR/$r "$@"
+}
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# This Source Code Form is subject to the terms of the Mozilla Public License,
+# v. 2.0. If a copy of the MPL was not distributed with this file, You can
+# obtain one at http://mozilla.org/MPL/2.0/.
+#
+
+#
+# Copyright (c) 2015, Nick Zivkovic
+#
+
+#
+# Runs every test_*.sh next to this script against the illumetrics binary
+# given as the first argument, and reports the ones that failed. The tests
+# only need git(1), and local bare repositories that they make themselves.
+#
+
+if [ $# -ne 1 ]; then
+	echo "usage: $0 <path to illumetrics>" >&2
+	exit 2
+fi
+ILLUMETRICS=$(cd $(dirname $1) && pwd)/$(basename $1)
+export ILLUMETRICS
+dir=$(cd $(dirname $0) && pwd)
+failed=0
+for t in $dir/test_*.sh; do
+	if sh $t > /dev/null; then
+		echo "pass  $(basename $t)"
+	else
+		echo "FAIL  $(basename $t)"
+		failed=$((failed + 1))
+	fi
+done
+if [ $failed -gt 0 ]; then
+	echo "$failed test(s) failed."
+	exit 1
+fi
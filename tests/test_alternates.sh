@@ -0,0 +1,63 @@
+#
+# This Source Code Form is subject to the terms of the Mozilla Public License,
+# v. 2.0. If a copy of the MPL was not distributed with this file, You can
+# obtain one at http://mozilla.org/MPL/2.0/.
+#
+
+#
+# Copyright (c) 2015, Nick Zivkovic
+#
+
+#
+# A fork that names its upstream in the list-files borrows the upstream's
+# objects through git alternates, and only stores the objects that the
+# upstream doesn't have. Its history is still walked in full, and the commits
+# that it shares with the upstream are counted as shared.
+#
+
+. $(dirname $0)/lib.sh
+
+# the number of objects in a repository's own object database
+objects()
+{
+	stor_git $1 count-objects -v |
+	    awk '$1 == "count:" || $1 == "in-pack:" { n += $2 } END { print n }'
+}
+
+mk_repo alice/one
+commit alice/one alice a.c
+commit alice/one alice b.c
+commit alice/one alice c.c
+mk_repo joe/fork alice/one
+commit joe/fork joe d.c
+list kernel alice/one
+list kernel joe/fork alice/one
+
+ilm pull
+expect '^cloned .* alice/one$'
+expect '^cloned .* joe/fork$'
+
+grep -q "$STOR/alice/one/objects" $STOR/joe/fork/objects/info/alternates ||
+    fail "joe/fork doesn't borrow the objects of alice/one"
+stor_git joe/fork show-ref | grep -q ' refs/upstream/master$' ||
+    fail "joe/fork has no copy of the upstream's refs"
+[ "$(objects joe/fork)" -lt "$(objects alice/one)" ] ||
+    fail "joe/fork stores $(objects joe/fork) objects," \
+    "alice/one only $(objects alice/one)"
+
+# the fork's history is complete, and only its own tips are walked
+[ "$(stor_git joe/fork rev-parse refs/remotes/origin/master)" = \
+    "$(tip joe/fork)" ] || fail "joe/fork isn't at its tip"
+[ "$(stor_git joe/fork rev-list --count refs/remotes/origin/master)" = 4 ] ||
+    fail "joe/fork's history is incomplete"
+ilm repository -l
+expect '^ +3 +3 +0  alice/one$'
+expect '^ +4 +1 +3  joe/fork$'
+
+# a fetch keeps the sharing going
+commit alice/one alice e.c
+commit joe/fork joe f.c
+ilm pull
+expect '^fetched .* joe/fork$'
+[ "$(stor_git joe/fork rev-list --count refs/remotes/origin/master)" = 5 ] ||
+    fail "joe/fork's fetch is incomplete"
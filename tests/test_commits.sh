@@ -0,0 +1,47 @@
+#
+# This Source Code Form is subject to the terms of the Mozilla Public License,
+# v. 2.0. If a copy of the MPL was not distributed with this file, You can
+# obtain one at http://mozilla.org/MPL/2.0/.
+#
+
+#
+# Copyright (c) 2015, Nick Zivkovic
+#
+
+#
+# Every field of the packed commit records (see repo_commit_t) makes it into
+# the reports: the repository, the author and the email, the commit time
+# (which `-D` compares as epoch seconds), and the run of file IDs. The size of
+# the record itself is checked at compile time, see REPO_COMMIT_SZ.
+#
+
+. $(dirname $0)/lib.sh
+
+mk_repo alice/one
+mk_repo bob/two
+commit alice/one alice a.c "Mon, 01 Jul 2019 12:00:00 +0000"
+commit alice/one alice b.c "Wed, 01 Jul 2020 12:00:00 +0000"
+commit alice/one bob a.c "Thu, 01 Jul 2021 12:00:00 +0000"
+commit alice/one alice c.c "Fri, 02 Jul 2021 12:00:00 +0000"
+commit bob/two bob x.c "Fri, 02 Jul 2021 12:00:00 +0000"
+list kernel alice/one
+list userland bob/two
+
+ilm pull
+ilm repository -l
+expect '^ +4 +4 +0  alice/one$'
+expect '^ +1 +1 +0  bob/two$'
+
+# by name, and by email
+ilm author -a alice
+expect '^alice: 3 commits, 3 file modifications$'
+ilm author -a alice@example.com
+expect '^alice@example.com: 3 commits, 3 file modifications$'
+ilm author -a bob
+expect '^bob: 2 commits, 2 file modifications$'
+
+# the range is inclusive, and the end date covers all of its day
+ilm author -a alice -D 01/01/20,07/02/21
+expect '^alice: 2 commits, 2 file modifications$'
+ilm author -a alice -D 01/01/19,12/31/19
+expect '^alice: 1 commits, 1 file modifications$'
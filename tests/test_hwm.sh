@@ -0,0 +1,53 @@
+#
+# This Source Code Form is subject to the terms of the Mozilla Public License,
+# v. 2.0. If a copy of the MPL was not distributed with this file, You can
+# obtain one at http://mozilla.org/MPL/2.0/.
+#
+
+#
+# Copyright (c) 2015, Nick Zivkovic
+#
+
+#
+# `pull` records the tip of every branch as the repository's high-water mark,
+# and the next `pull` only walks the commits above it. Without a snapshot to
+# add them to, the marks are ignored, and the history is walked in full.
+#
+
+. $(dirname $0)/lib.sh
+
+HWM=$STOR/alice/one/.illumetrics_hwm
+
+mk_repo alice/one
+commit alice/one alice a.c
+commit alice/one alice b.c
+list kernel alice/one
+
+ilm pull --stats=$T/stats.json
+grep -E -q '"name": "walk".*"commits": 2,' $T/stats.json ||
+    fail "the first pull didn't walk all of history"
+grep -q "^$(tip alice/one) refs/remotes/origin/master$" $HWM ||
+    fail "the mark isn't at the tip"
+
+commit alice/one alice c.c
+ilm pull --stats=$T/stats.json
+grep -E -q '"name": "walk".*"commits": 1,' $T/stats.json ||
+    fail "the second pull didn't walk just the new commit"
+grep -q "^$(tip alice/one) refs/remotes/origin/master$" $HWM ||
+    fail "the mark didn't move to the new tip"
+ilm author -a alice
+expect '^alice: 3 commits, 3 file modifications$'
+
+# a walk that doesn't save a snapshot leaves the marks alone
+cp $HWM $T/hwm
+commit alice/one alice d.c
+ilm pull -D 01/01/70,12/31/37
+cmp -s $HWM $T/hwm || fail "a pull restricted to a date range moved the mark"
+
+# no snapshot, so the marks don't apply
+rm $STOR/.illumetrics_snap
+ilm pull --stats=$T/stats.json
+grep -E -q '"name": "walk".*"commits": 4,' $T/stats.json ||
+    fail "the pull without a snapshot didn't walk all of history"
+ilm author -a alice
+expect '^alice: 4 commits, 4 file modifications$'
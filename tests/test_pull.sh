@@ -0,0 +1,58 @@
+#
+# This Source Code Form is subject to the terms of the Mozilla Public License,
+# v. 2.0. If a copy of the MPL was not distributed with this file, You can
+# obtain one at http://mozilla.org/MPL/2.0/.
+#
+
+#
+# Copyright (c) 2015, Nick Zivkovic
+#
+
+#
+# `pull -j` clones, and then fetches, two repositories through the pull pool,
+# as bare repositories. A repository that can't be pulled fails on its own,
+# and doesn't take the other pulls down with it.
+#
+
+. $(dirname $0)/lib.sh
+
+mk_repo alice/one
+mk_repo bob/two
+commit alice/one alice a.c
+commit bob/two bob b.c
+list kernel alice/one
+list userland bob/two
+
+ilm pull -j 2
+expect '^cloned .* alice/one$'
+expect '^cloned .* bob/two$'
+for r in alice/one bob/two; do
+	[ "$(stor_git $r rev-parse --is-bare-repository)" = true ] ||
+	    fail "$r isn't bare"
+	stor_git $r cat-file -e $(tip $r) || fail "$r is missing its tip"
+done
+
+commit alice/one alice a.c
+commit bob/two carol c.c
+ilm pull -j 2
+expect '^fetched .* alice/one$'
+expect '^fetched .* bob/two$'
+for r in alice/one bob/two; do
+	stor_git $r cat-file -e $(tip $r) || fail "$r didn't fetch its tip"
+done
+
+# stor/<owner> can't be a directory, and the source of bad/gone is missing
+mk_repo carol/three
+commit carol/three carol d.c
+list kernel carol/three
+list kernel bad/gone
+echo > $STOR/carol
+commit alice/one alice a.c
+ilm pull -j 2
+expect '^FAILED .* carol/three$'
+expect 'repo_pull:openat:stor/owner'
+expect '^FAILED .* bad/gone$'
+expect '^fetched .* alice/one$'
+expect '^fetched .* bob/two$'
+stor_git alice/one cat-file -e $(tip alice/one) ||
+    fail "alice/one didn't fetch its tip"
@@ -0,0 +1,79 @@
+#
+# This Source Code Form is subject to the terms of the Mozilla Public License,
+# v. 2.0. If a copy of the MPL was not distributed with this file, You can
+# obtain one at http://mozilla.org/MPL/2.0/.
+#
+
+#
+# Copyright (c) 2015, Nick Zivkovic
+#
+
+#
+# A walk saves the graphs to a snapshot in `stor`, and the queries after it
+# load the snapshot instead of walking. The queries answer the same from the
+# snapshot as from a walk. A damaged snapshot is ignored, and replaced by the
+# next walk.
+#
+
+. $(dirname $0)/lib.sh
+
+SNAP=$STOR/.illumetrics_snap
+
+# appends the answer of the last query to $1, without the walk's report
+answer()
+{
+	grep -E -v '^(Diffs|Skipped) ' $T/out >> $1
+}
+
+mk_repo alice/one
+mk_repo bob/two
+commit alice/one alice a.c
+commit alice/one bob a.c
+commit alice/one carol b.c
+commit alice/one alice b.c
+commit bob/two bob x.c
+commit bob/two carol x.c
+list kernel alice/one
+list userland bob/two
+
+ilm pull
+[ -f $SNAP ] || fail "the pull saved no snapshot"
+[ $(($(wc -c < $SNAP) % 4096)) = 0 ] || fail "the snapshot isn't padded"
+
+# the answers from a walk, which doesn't use the snapshot
+ilm centrality -c degree -D 01/01/70,12/31/37
+answer $T/walked
+ilm author -a carol -D 01/01/70,12/31/37
+answer $T/walked
+ilm repository -l -D 01/01/70,12/31/37
+answer $T/walked
+
+# the same answers from the snapshot
+ilm centrality -c degree --stats=$T/stats.json
+grep -q '"name": "walk"' $T/stats.json && fail "the query walked"
+answer $T/loaded
+ilm author -a carol --verify-snapshot
+grep -q 'Ignoring snapshot' $T/out && fail "the snapshot didn't verify"
+answer $T/loaded
+ilm repository -l
+answer $T/loaded
+cmp -s $T/walked $T/loaded || {
+	diff $T/walked $T/loaded >&2
+	fail "the snapshot answers differently"
+}
+expect '^ +4 +4 +0  alice/one$'
+
+# damage the padding at the end, which only --verify-snapshot reads
+sz=$(wc -c < $SNAP)
+printf X | dd of=$SNAP bs=1 seek=$((sz - 1)) conv=notrunc 2>/dev/null
+ilm author -a carol --verify-snapshot
+expect '^Ignoring snapshot: checksum mismatch\.$'
+expect '^carol: 2 commits, 2 file modifications$'
+ilm author -a carol --verify-snapshot
+grep -q 'Ignoring snapshot' $T/out && fail "the snapshot wasn't replaced"
+
+# a truncated snapshot
+: > $SNAP
+ilm author -a carol
+expect '^Ignoring snapshot: truncated\.$'
+expect '^carol: 2 commits, 2 file modifications$'